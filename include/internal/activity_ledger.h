@@ -0,0 +1,46 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2011-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+
+#ifndef _ACTIVITY_LEDGER_H_
+#define _ACTIVITY_LEDGER_H_
+
+#include <stdbool.h>
+#include <time.h>
+#include <glib.h>
+
+/**
+ * Ledger bookkeeping embedded in every activity of the roster.
+ */
+typedef struct
+{
+	GList *link;              // node in the ledger's queue of open charges
+	const char *activity_id;  // owned by the activity
+	gint64 start_ms;
+	gint64 end_ms;
+	double share_start;       // ledger share counter when the charge was opened
+	bool open;
+} PwrEventCharge;
+
+void PwrEventLedgerOpen(PwrEventCharge *charge, const char *activity_id,
+                        struct timespec *start, struct timespec *end);
+void PwrEventLedgerClose(PwrEventCharge *charge, struct timespec *now);
+
+char *PwrEventLedgerToJson(int top_n);
+
+#endif
@@ -54,6 +54,9 @@ bool PwrEventClientRegister(ClientUID uid);
 
 bool PwrEventClientUnregister(ClientUID uid);
 
+void PwrEventClientSetName(struct PwrEventClientInfo *info,
+                           const char *clientName);
+
 void PwrEventClientTableCreate(void);
 void PwrEventClientTableDestroy(void);
 
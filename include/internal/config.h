@@ -44,6 +44,9 @@ typedef struct
 
 	bool disable_rtc_alarms;
 
+	/* Service wakeups caused by our own RTC alarm without resuming the whole system */
+	bool dark_wake;
+
 	const char *preference_dir;
 
 	/* These aren't really config, they are runtime parameters */
@@ -53,4 +56,8 @@ typedef struct
 
 extern SleepConfiguration gSleepConfig;
 
+int ConfigGeneration(void);
+int ConfigSnapshot(SleepConfiguration *config);
+void ConfigPublish(const SleepConfiguration *config);
+
 #endif // _CONFIG_H_
@@ -20,30 +20,42 @@
 #ifndef _INIT_H_
 #define _INIT_H_
 
+#include <stdbool.h>
+
 void TheOneInit(void);
 
-enum
-{
-    INIT_FUNC_FIRST  = 0,
-    INIT_FUNC_EARLY  = 10,
-    INIT_FUNC_MIDDLE = 50,
-    INIT_FUNC_END    = 100,
-};
-typedef int InitFuncPriority;
+void InitNoteReply(void);
+char *InitStartupToJson(void);
 
 typedef int (*InitFunc)(void);
 
-void NamedInitFuncAdd(const char *initListName, InitFuncPriority priority,
-                      InitFunc func, const char *func_name);
+void InitFuncAdd(InitFunc func, const char *func_name, const char *after,
+                 bool async);
 
-#define COMMON_INIT_NAME "init-common"
 /**
  * Declare a func to be inited for all devices including "simulator".
+ *
+ * 'after' lists, separated by spaces, the names of the init funcs which must
+ * have completed before this one runs. Funcs without a dependency between them
+ * may run in any order.
  */
-#define INIT_FUNC(priority, func)                           \
+#define INIT_FUNC(after, func)                              \
 static void __attribute__ ((constructor))                   \
 ModuleInitializer##func(void)                               \
 {                                                           \
-    NamedInitFuncAdd(COMMON_INIT_NAME, priority, func, #func);    \
+    InitFuncAdd(func, #func, after, false);                 \
 }
+
+/**
+ * Like INIT_FUNC, for a func which may run on an init worker thread, concurrently
+ * with the other funcs. It must not touch the luna service handle or the main
+ * loop: only files, devices and its own module state.
+ */
+#define INIT_FUNC_ASYNC(after, func)                        \
+static void __attribute__ ((constructor))                   \
+ModuleInitializer##func(void)                               \
+{                                                           \
+    InitFuncAdd(func, #func, after, true);                  \
+}
+
 #endif
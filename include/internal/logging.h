@@ -50,6 +50,8 @@
 
 /** config.c */
 #define MSGID_CONFIG_FILE_LOAD_ERR                "CONFIG_FILE_LOAD_ERR"     //Could not load config file from specified path
+#define MSGID_CONFIG_WATCH_ERR                    "CONFIG_WATCH_ERR"         //Could not watch the config file for changes
+#define MSGID_CONFIG_VALUE_ERR                    "CONFIG_VALUE_ERR"         //Config file value out of range, ignored
 
 /** main.c */
 #define MSGID_NYX_DEVICE_OPEN_FAIL                "NYX_DEVICE_OPEN_FAIL"     //Failed to open nyx device
@@ -69,6 +71,10 @@
 #define MSGID_DB_REMOVE_ERR                       "DB_REMOVE_ERR"                  //failed to remove db file
 #define MSGID_INTEGRITY_CHK_FAIL                  "INTEGRITY_CHK_FAIL"             //db integrity check failed
 #define MSGID_SET_SYNCOFF_ERR                     "SET_SYNCOFF_ERR"                //Failed to set syncoff on provided path
+#define MSGID_SET_WAL_ERR                         "SET_WAL_ERR"                    //Failed to switch the db to WAL journaling
+#define MSGID_WAL_CHECKPOINT_ERR                  "WAL_CHECKPOINT_ERR"             //WAL checkpoint failed
+#define MSGID_DB_SALVAGED                         "DB_SALVAGED"                    //corrupted db rebuilt from its readable rows
+#define MSGID_DB_SALVAGE_ERR                      "DB_SALVAGE_ERR"                 //corrupted db could not be salvaged
 
 /** timeout_alarm.c */
 #define MSGID_RTC_ERR                             "RTC_ERR"                        //RTC not working properly
@@ -97,13 +103,13 @@
 
 /** init.c */
 #define MSGID_HOOKINIT_FAIL                       "HOOKINIT_FAIL"                  //Failed to initialize
-#define MSGID_NAMED_INIT_FUNC_OOM                 "NAMED_INIT_FUNC_OOM"            //Out of memory on initialization
-#define MSGID_NAMED_HOOK_LIST_OOM                 "NAMED_HOOK_LIST_OOM"            //Out of memory on initialization
+#define MSGID_INIT_DONE                           "INIT_DONE"                      //All init funcs completed
 
 /** timesaver.c */
 #define MSGID_TIME_NOT_SAVED                      "TIME_NOT_SAVED"                //time not be saved to temp file before battery was pulledout
 
 /** activity.c */
+#define MSGID_ACTIVITY_CHECKPOINT_ERR             "ACTIVITY_CHECKPOINT_ERR"  // Could not map the activity checkpoint file
 
 /** machine.c */
 #define MSGID_FRC_SHUTDOWN                        "FRC_SHUTDOWN"             // Force Shutdown
@@ -113,6 +119,9 @@
 #define MSGID_SHUTDOWN_APPS_SIG_FAIL              "SHUTDOWN_APPS_SIG_FAIL"   // Could not send shutdown applications
 #define MSGID_SHUTDOWN_SRVC_SIG_FAIL              "SHUTDOWN_SRVC_SIG_FAIL"   // Could not send shutdown Services
 #define MSGID_SHUTDOWN_REPLY_FAIL                 "SHUTDOWN_REPLY_FAIL"      // Could not send shutdown success message
+#define MSGID_SHUTDOWN_HISTORY_SAVE_FAIL          "SHUTDOWN_HISTORY_SAVE_FAIL" // Could not save shutdown deadlines
+#define MSGID_SHUTDOWN_TIMING_SAVE_FAIL           "SHUTDOWN_TIMING_SAVE_FAIL" // Could not save shutdown timing
+#define MSGID_FAST_HALT                           "FAST_HALT"                // State flushed for a fast halt
 #define MSGID_LSMSG_REPLY_FAIL                    "LSMSG_REPLY_FAIL"         // Could not send reply to caller
 #define MSGID_LSSUBSCRI_ADD_FAIL                  "LSSUBSCRI_ADD_FAIL"       // LSSubscriptionAdd failed
 
@@ -27,4 +27,10 @@ void LSMessageReplyErrorInvalidParams(LSHandle *sh, LSMessage *message);
 void LSMessageReplyErrorBadJSON(LSHandle *sh, LSMessage *message);
 void LSMessageReplySuccess(LSHandle *sh, LSMessage *message);
 
+bool LSRegisterCategoryNoted(LSHandle *sh, const char *category,
+                             LSMethod *methods, LSSignal *signals, LSError *lserror);
+bool LSPalmServiceRegisterCategoryNoted(LSPalmService *psh, const char *category,
+                                        LSMethod *public_methods, LSMethod *private_methods,
+                                        LSSignal *signals, LSError *lserror);
+
 #endif
@@ -23,16 +23,18 @@
 #include <stdbool.h>
 
 
-bool MachineCanSleep(void);
+bool MachineCanSleep(bool suspend_with_charger);
 
 const char *MachineCantSleepReason(void);
 
-void MachineSleep(void);
+void MachineSleep(bool visual_leds_suspend);
 
 void MachineForceReboot(const char *reason);
 
 void MachineForceShutdown(const char *reason);
 
+void MachineFastHalt(bool reboot, const char *reason);
+
 void TurnBypassOn(void);
 
 void TurnBypassOff(void);
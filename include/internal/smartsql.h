@@ -20,11 +20,22 @@
 #ifndef _SMARTSQL_H_
 #define _SMARTSQL_H_
 
+#include <stdbool.h>
 #include <sqlite3.h>
+#include <glib.h>
+
+typedef void (*SmartSqlCorruptFunc)(sqlite3 *db, gpointer user_data);
 
 bool smart_sql_open(const char *path, sqlite3 **ret_db);
 void smart_sql_close(sqlite3 *db);
 
 bool smart_sql_exec(sqlite3 *db, const char *cmd);
 
+bool smart_sql_salvage(const char *path);
+guint smart_sql_check_start(sqlite3 *db, SmartSqlCorruptFunc on_corrupt,
+                            gpointer user_data);
+
+int smart_sql_wal_pending(void);
+int smart_sql_checkpoint(sqlite3 *db);
+
 #endif
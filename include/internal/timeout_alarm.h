@@ -35,6 +35,9 @@ typedef struct _AlarmTimeout
 	bool        wakeup;
 	bool        calendar;
 	time_t      expiry;
+	int         window_s;    // wakeup may be delayed by up to window_s to share a wake
+	int         early_s;     // non-wakeup may fire up to early_s early on a wake
+	int         period_s;    // re-armed every period_s seconds after it fires, if not 0
 } _AlarmTimeout;
 
 typedef struct _AlarmTimeoutNonConst
@@ -51,6 +54,9 @@ typedef struct _AlarmTimeoutNonConst
 	bool        wakeup;
 	bool        calendar;
 	time_t      expiry;
+	int         window_s;
+	int         early_s;
+	int         period_s;
 } _AlarmTimeoutNonConst;
 
 void _timeout_create(_AlarmTimeout *timeout,
@@ -82,6 +88,32 @@ bool queue_next_wakeup();
 
 bool timeout_get_next_wakeup(time_t *expiry, gchar **app_id, gchar **key);
 
+/**
+ * Tell whether the wakeup timeout the RTC alarm was last armed for is due.
+ *
+ * @retval true if the last wakeup was most likely caused by our RTC alarm
+ */
+bool timeout_wakeup_due(void);
+
+/**
+ * Get the timeout the RTC alarm was last armed for.
+ *
+ * @retval false if no RTC alarm is armed
+ */
+bool timeout_get_armed_wakeup(gchar **app_id, gchar **key);
+
+/**
+ * Number of wakeups the armed RTC alarm saves by also covering later
+ * tolerant timeouts (see "window_s" in timeout/set).
+ */
+int timeout_wakeup_coalesced(void);
+
 bool update_timeouts_on_resume(void);
 
+/**
+ * Checkpoint the timeout database, so that the system does not sleep with
+ * unsynced writes. Called before system suspend.
+ */
+void timeout_db_checkpoint(void);
+
 #endif
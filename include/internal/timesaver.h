@@ -21,6 +21,7 @@
 #define _TIMESAVER_H_
 
 void timesaver_save();
+void timesaver_save_unsynced(void);
 bool ConvertJsonTime(const char *time, int *hour, int *minute, int *second);
 
 #endif
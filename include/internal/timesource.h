@@ -0,0 +1,64 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2011-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+
+#ifndef _TIMESOURCE_H_
+#define _TIMESOURCE_H_
+
+#include <stdbool.h>
+#include <time.h>
+#include <glib.h>
+#include <nyx/nyx_client.h>
+
+/**
+ * @brief The clocks sleepd reads the time from.
+ */
+enum
+{
+    kTimeSourceMonotonic,    // stops while the system sleeps
+    kTimeSourceBoottime,     // keeps counting while the system sleeps
+    kTimeSourceRealtime,     // system time, may be changed by the user
+    kTimeSourceLast
+};
+typedef int TimeSourceClock;
+
+/**
+ * @brief Where the time comes from: the system clocks, or a simulated time.
+ */
+typedef struct
+{
+	const char *name;
+	int (*get_time)(TimeSourceClock clock, struct timespec *ts);
+	nyx_error_t (*get_rtc)(time_t *rtc);
+} TimeSourceBackend;
+
+void TimeSourceSetBackend(const TimeSourceBackend *backend);
+const char *TimeSourceName(void);
+
+void TimeSourceSimulate(time_t realtime);
+void TimeSourceAdvanceMs(gint64 ms);
+
+int TimeSourceGet(TimeSourceClock clock, struct timespec *ts);
+gint64 TimeSourceGetMs(TimeSourceClock clock);
+time_t TimeSourceNow(void);
+nyx_error_t TimeSourceGetRtc(time_t *rtc);
+
+void TimeSourceGetLoop(TimeSourceClock clock, struct timespec *ts);
+void TimeSourceAttach(GMainContext *context);
+
+#endif
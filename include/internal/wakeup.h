@@ -0,0 +1,45 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2011-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+
+#ifndef _WAKEUP_H_
+#define _WAKEUP_H_
+
+/**
+ * @brief What woke the system up from sleep.
+ */
+enum
+{
+    kWakeupSourceRtc,
+    kWakeupSourcePowerKey,
+    kWakeupSourceCharger,
+    kWakeupSourceNetwork,
+    kWakeupSourceBatteryCheck,
+    kWakeupSourceOther,
+    kWakeupSourceLast
+};
+typedef int WakeupSource;
+
+#define WAKEUP_SOURCE_MASK(source) (1u << (source))
+
+unsigned int PwrEventWakeupClassify(void);
+void PwrEventWakeupOnSleep(void);
+
+char *PwrEventWakeupStatsToJson(void);
+
+#endif
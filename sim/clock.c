@@ -0,0 +1,139 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2011-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+
+/**
+ * @file clock.c
+ *
+ * @brief Virtual clock, standing in for the clock of powerd. It only moves when
+ * the simulation advances it, see trace.c, and drives the simulated time source
+ * every clock of sleepd is read from.
+ */
+
+#include <stdio.h>
+#include <glib.h>
+
+#include "clock.h"
+#include "timesource.h"
+#include "sim.h"
+
+#define NSEC_PER_SEC  1000000000L
+#define NSEC_PER_MSEC 1000000L
+
+static gint64 sNowMs = 0;
+
+gint64
+SimNowMs(void)
+{
+	return sNowMs;
+}
+
+void
+SimClockSet(gint64 now_ms)
+{
+	if (now_ms > sNowMs)
+	{
+		TimeSourceAdvanceMs(now_ms - sNowMs);
+		sNowMs = now_ms;
+	}
+}
+
+void
+ClockGetTime(struct timespec *time)
+{
+	TimeSourceGet(kTimeSourceMonotonic, time);
+}
+
+bool
+ClockTimeIsGreater(struct timespec *a, struct timespec *b)
+{
+	return (a->tv_sec > b->tv_sec) ||
+	       (a->tv_sec == b->tv_sec && a->tv_nsec > b->tv_nsec);
+}
+
+void
+ClockStr(GString *str, struct timespec *time)
+{
+	g_string_append_printf(str, "%ld.%03ld", (long)time->tv_sec,
+	                       time->tv_nsec / NSEC_PER_MSEC);
+}
+
+void
+ClockPrintTime(struct timespec *time)
+{
+	printf("%ld.%03ld\n", (long)time->tv_sec, time->tv_nsec / NSEC_PER_MSEC);
+}
+
+void
+ClockPrint(void)
+{
+	struct timespec now;
+
+	ClockGetTime(&now);
+	ClockPrintTime(&now);
+}
+
+void
+ClockDiff(struct timespec *diff, struct timespec *a, struct timespec *b)
+{
+	diff->tv_sec = a->tv_sec - b->tv_sec;
+	diff->tv_nsec = a->tv_nsec - b->tv_nsec;
+
+	if (diff->tv_nsec < 0)
+	{
+		diff->tv_nsec += NSEC_PER_SEC;
+		diff->tv_sec--;
+	}
+}
+
+void
+ClockAccum(struct timespec *sum, struct timespec *b)
+{
+	sum->tv_sec += b->tv_sec;
+	sum->tv_nsec += b->tv_nsec;
+
+	if (sum->tv_nsec >= NSEC_PER_SEC)
+	{
+		sum->tv_nsec -= NSEC_PER_SEC;
+		sum->tv_sec++;
+	}
+}
+
+void
+ClockAccumMs(struct timespec *sum, int duration_ms)
+{
+	struct timespec duration;
+
+	duration.tv_sec = duration_ms / 1000;
+	duration.tv_nsec = (duration_ms % 1000) * NSEC_PER_MSEC;
+
+	ClockAccum(sum, &duration);
+}
+
+long
+ClockGetMs(struct timespec *ts)
+{
+	return ts->tv_sec * 1000 + ts->tv_nsec / NSEC_PER_MSEC;
+}
+
+void
+ClockClear(struct timespec *a)
+{
+	a->tv_sec = 0;
+	a->tv_nsec = 0;
+}
@@ -0,0 +1,48 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2011-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+
+/**
+ * @file PmLogLib.h
+ *
+ * @brief Stand-in for PmLogLib: messages are printed with the virtual time, debug
+ * messages only when the simulation runs verbose. The key-value pairs are dropped.
+ */
+
+#ifndef _SIM_PMLOGLIB_H_
+#define _SIM_PMLOGLIB_H_
+
+typedef int PmLogContext;
+
+int PmLogGetContext(const char *name, PmLogContext *context);
+
+void SimLogMsg(const char *level, const char *msgid);
+void SimLogDebug(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+#define PmLogCritical(context, msgid, kvcount, ...) SimLogMsg("critical", msgid)
+#define PmLogError(context, msgid, kvcount, ...)    SimLogMsg("error", msgid)
+#define PmLogWarning(context, msgid, kvcount, ...)  SimLogMsg("warning", msgid)
+#define PmLogInfo(context, msgid, kvcount, ...)     SimLogMsg("info", msgid)
+#define PmLogDebug(context, ...)                    SimLogDebug(__VA_ARGS__)
+
+#define PMLOGKS(key, value)             key, value
+#define PMLOGKFV(key, format, value)    key, value
+
+#define PMLOG_TRACE(...)                SimLogDebug(__VA_ARGS__)
+
+#endif
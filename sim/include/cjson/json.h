@@ -0,0 +1,62 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2011-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+
+/**
+ * @file json.h
+ *
+ * @brief Stand-in for cjson. The simulation delivers no luna message, so the
+ * handlers which parse one are never called: parsing always fails.
+ */
+
+#ifndef _SIM_JSON_H_
+#define _SIM_JSON_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct json_object;
+
+enum json_type
+{
+	json_type_null,
+	json_type_boolean,
+	json_type_double,
+	json_type_int,
+	json_type_object,
+	json_type_array,
+	json_type_string,
+};
+
+#define is_error(ptr) ((unsigned long)(ptr) > (unsigned long)-4000L)
+
+struct json_object *json_tokener_parse(const char *str);
+struct json_object *json_object_object_get(struct json_object *obj,
+                                           const char *key);
+bool json_object_object_get_ex(struct json_object *obj, const char *key,
+                               struct json_object **value);
+bool json_object_get_boolean(struct json_object *obj);
+int json_object_get_int(struct json_object *obj);
+int64_t json_object_get_int64(struct json_object *obj);
+const char *json_object_get_string(struct json_object *obj);
+bool json_object_is_type(struct json_object *obj, enum json_type type);
+int json_object_array_length(struct json_object *obj);
+struct json_object *json_object_array_get_idx(struct json_object *obj, int idx);
+void json_object_put(struct json_object *obj);
+
+#endif
@@ -0,0 +1,90 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2011-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+
+/**
+ * @file lunaservice.h
+ *
+ * @brief Stand-in for the part of luna-service2 used by the simulated sources.
+ * There is no bus: signals are delivered to the simulated clients, see
+ * sim/lunaservice.c. The calls and replies are only used by the timeout tests,
+ * which never send one, see sim/timeout/platform.c.
+ */
+
+#ifndef _SIM_LUNASERVICE_H_
+#define _SIM_LUNASERVICE_H_
+
+#include <stdbool.h>
+#include <stdio.h>
+
+typedef struct LSHandle LSHandle;
+typedef struct LSMessage LSMessage;
+typedef struct LSPalmService LSPalmService;
+
+typedef unsigned long LSMessageToken;
+
+typedef struct
+{
+	int         error_code;
+	char       *message;
+	const char *file;
+	int         line;
+	const char *func;
+} LSError;
+
+typedef bool (*LSMethodFunction)(LSHandle *sh, LSMessage *msg, void *category_context);
+
+typedef struct
+{
+	const char       *name;
+	LSMethodFunction  function;
+} LSMethod;
+
+typedef struct
+{
+	const char *name;
+} LSSignal;
+
+typedef bool (*LSFilterFunc)(LSHandle *sh, LSMessage *reply, void *ctx);
+
+bool LSErrorInit(LSError *error);
+void LSErrorFree(LSError *error);
+void LSErrorPrint(LSError *lserror, FILE *out);
+
+const char *LSMessageGetPayload(LSMessage *message);
+
+bool LSSignalSend(LSHandle *sh, const char *uri, const char *payload,
+                  LSError *lserror);
+
+const char *LSMessageGetApplicationID(LSMessage *message);
+bool LSMessageIsPublic(LSPalmService *psh, LSMessage *message);
+bool LSMessageReply(LSHandle *sh, LSMessage *message, const char *payload,
+                    LSError *lserror);
+
+bool LSCallOneReply(LSHandle *sh, const char *uri, const char *payload,
+                    LSFilterFunc callback, void *ctx, LSMessageToken *token,
+                    LSError *lserror);
+bool LSCallFromApplicationOneReply(LSHandle *sh, const char *uri,
+                                   const char *payload, const char *applicationID,
+                                   LSFilterFunc callback, void *ctx,
+                                   LSMessageToken *token, LSError *lserror);
+
+LSHandle *LSPalmServiceGetPublicConnection(LSPalmService *psh);
+LSHandle *LSPalmServiceGetPrivateConnection(LSPalmService *psh);
+
+#endif
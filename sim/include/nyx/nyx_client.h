@@ -0,0 +1,114 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2011-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+
+/**
+ * @file nyx_client.h
+ *
+ * @brief Stand-in for the nyx devices used by the simulated sources: the led
+ * controller, which tells whether the display is on, and the system device, which
+ * suspends until the next wake event of the trace. See sim/nyx.c.
+ *
+ * The RTC alarm is only used by the timeout tests, see sim/timeout/platform.c.
+ */
+
+#ifndef _SIM_NYX_CLIENT_H_
+#define _SIM_NYX_CLIENT_H_
+
+#include <stdbool.h>
+#include <time.h>
+
+typedef struct nyx_device *nyx_device_handle_t;
+
+typedef enum
+{
+	NYX_ERROR_NONE = 0,
+	NYX_ERROR_GENERIC = -1,
+	NYX_ERROR_NOT_IMPLEMENTED = -2,
+} nyx_error_t;
+
+typedef enum
+{
+	NYX_DEVICE_SYSTEM,
+	NYX_DEVICE_LED_CONTROLLER,
+} nyx_device_type_t;
+
+typedef enum
+{
+	NYX_LED_CONTROLLER_LCD,
+} nyx_led_controller_led_t;
+
+typedef enum
+{
+	NYX_LED_CONTROLLER_STATE_UNKNOWN,
+	NYX_LED_CONTROLLER_STATE_ON,
+	NYX_LED_CONTROLLER_STATE_OFF,
+} nyx_led_controller_state_t;
+
+typedef enum
+{
+	NYX_LED_CONTROLLER_EFFECT_LED_SET,
+} nyx_led_controller_effect_type_t;
+
+typedef struct
+{
+	struct
+	{
+		nyx_led_controller_effect_type_t effect;
+		nyx_led_controller_led_t         led;
+	} required;
+
+	struct
+	{
+		void *callback;
+		int   brightness_lcd;
+	} backlight;
+} nyx_led_controller_effect_t;
+
+typedef enum
+{
+	NYX_CALLBACK_STATUS_DONE,
+} nyx_callback_status_t;
+
+typedef void (*nyx_device_callback_function_t)(nyx_device_handle_t handle,
+                                               nyx_callback_status_t status, void *context);
+
+typedef enum
+{
+	NYX_SYSTEM_NORMAL_SHUTDOWN,
+	NYX_SYSTEM_EMERG_SHUTDOWN,
+} nyx_system_shutdown_type_t;
+
+nyx_error_t nyx_device_open(nyx_device_type_t type, const char *id,
+                            nyx_device_handle_t *handle);
+
+nyx_error_t nyx_led_controller_get_state(nyx_device_handle_t handle,
+                                         nyx_led_controller_led_t led, nyx_led_controller_state_t *state);
+nyx_error_t nyx_led_controller_execute_effect(nyx_device_handle_t handle,
+                                              nyx_led_controller_effect_t effect);
+
+nyx_error_t nyx_system_suspend(nyx_device_handle_t handle, bool *success);
+nyx_error_t nyx_system_query_rtc_time(nyx_device_handle_t handle, time_t *time);
+nyx_error_t nyx_system_set_alarm(nyx_device_handle_t handle, time_t time,
+                                 nyx_device_callback_function_t callback, void *context);
+nyx_error_t nyx_system_shutdown(nyx_device_handle_t handle,
+                                nyx_system_shutdown_type_t type, const char *reason);
+nyx_error_t nyx_system_reboot(nyx_device_handle_t handle,
+                              nyx_system_shutdown_type_t type, const char *reason);
+
+#endif
@@ -0,0 +1,104 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2011-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+
+/**
+ * @file loop.c
+ *
+ * @brief Run the suspend loop in virtual time.
+ *
+ * The simulation is linked with --wrap for the few calls of the simulated sources
+ * that must not reach the host:
+ * - g_main_context_new(): the suspend loop gets a poll function which, rather than
+ *   blocking until its next timeout, replays the trace up to it.
+ * - pthread_create(): the suspend thread is kept, to wait for the end of the trace.
+ * - access(): the system is booted and has a suspend action.
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <glib.h>
+
+#include "sim.h"
+
+GMainContext *__real_g_main_context_new(void);
+int __real_pthread_create(pthread_t *thread, const pthread_attr_t *attr,
+                          void *(*start)(void *), void *arg);
+int __real_access(const char *path, int mode);
+
+static pthread_t sSuspendThread;
+
+static gint
+SimPoll(GPollFD *fds, guint nfds, gint timeout_ms)
+{
+	if (timeout_ms != 0)
+	{
+		SimRunUntil(timeout_ms < 0 ? G_MAXINT64 : SimNowMs() + timeout_ms, NULL);
+	}
+
+	if (SimDone())
+	{
+		g_main_loop_quit(suspend_loop);
+	}
+
+	return 0;
+}
+
+GMainContext *
+__wrap_g_main_context_new(void)
+{
+	GMainContext *context = __real_g_main_context_new();
+
+	g_main_context_set_poll_func(context, SimPoll);
+	return context;
+}
+
+int
+__wrap_pthread_create(pthread_t *thread, const pthread_attr_t *attr,
+                      void *(*start)(void *), void *arg)
+{
+	int ret = __real_pthread_create(thread, attr, start, arg);
+
+	if (!ret && start == SuspendThread)
+	{
+		sSuspendThread = *thread;
+	}
+
+	return ret;
+}
+
+int
+__wrap_access(const char *path, int mode)
+{
+	if (!strcmp(path, "/tmp/suspend_active") || g_str_has_suffix(path, "/suspend_action"))
+	{
+		return 0;
+	}
+
+	return __real_access(path, mode);
+}
+
+/**
+ * @brief The suspend thread, once init started it.
+ */
+pthread_t
+SimSuspendThread(void)
+{
+	return sSuspendThread;
+}
@@ -0,0 +1,270 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2011-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+
+/**
+ * @file lunaservice.c
+ *
+ * @brief Stand-in for the bus, and for the signal side of suspend_ipc.c. The
+ * signals sleepd sends go to the simulated clients of the trace, which vote after
+ * their delay as they would through "suspendRequestAck" and "prepareSuspendAck".
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+
+#include <luna-service2/lunaservice.h>
+
+#include "main.h"
+#include "init.h"
+#include "client.h"
+#include "logging.h"
+#include "sim.h"
+
+typedef struct
+{
+	SimVote vote;
+	int     delay_ms;
+} SimClient;
+
+/* name -> SimClient */
+static GHashTable *sClients = NULL;
+
+static gint64 sSuspendRequestMs = 0;
+
+bool
+LSErrorInit(LSError *error)
+{
+	memset(error, 0, sizeof(LSError));
+	return true;
+}
+
+void
+LSErrorFree(LSError *error)
+{
+	g_free(error->message);
+	error->message = NULL;
+}
+
+void
+LSErrorPrint(LSError *lserror, FILE *out)
+{
+	fprintf(out, "LSError: %s\n", lserror->message ? lserror->message : "");
+}
+
+const char *
+LSMessageGetPayload(LSMessage *message)
+{
+	return "{}";
+}
+
+/**
+ * @brief Set how a client votes from now on, registering it for both votes the
+ * first time.
+ */
+void
+SimClientSet(const char *name, SimVote vote, int delay_ms)
+{
+	if (!sClients)
+	{
+		sClients = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+	}
+
+	SimClient *client = g_hash_table_lookup(sClients, name);
+
+	if (!client)
+	{
+		client = g_new0(SimClient, 1);
+		g_hash_table_insert(sClients, g_strdup(name), client);
+
+		PwrEventClientRegister(name);
+		PwrEventClientSetName(PwrEventClientLookup(name), name);
+		PwrEventClientSuspendRequestRegister(name, true);
+		PwrEventClientPrepareSuspendRegister(name, true);
+	}
+
+	client->vote = vote;
+	client->delay_ms = delay_ms;
+}
+
+/**
+ * @brief Deliver a vote, as suspendRequestAck() and prepareSuspendAck() do.
+ */
+void
+SimClientVote(const char *name, SimVote vote, SimSignal signal)
+{
+	struct PwrEventClientInfo *info = PwrEventClientLookup(name);
+	bool ack = (vote == kSimVoteAck);
+
+	if (!info)
+	{
+		return;
+	}
+
+	if (!ack)
+	{
+		gSimStats.nacks++;
+	}
+
+	if (signal == kSimSignalSuspendRequest)
+	{
+		if (!ack)
+		{
+			PwrEventClientSuspendRequestNACKIncr(info);
+		}
+
+		if (PwrEventVoteSuspendRequest(name, ack))
+		{
+			WaitObjectSignal(&gWaitSuspendResponse);
+		}
+	}
+	else
+	{
+		if (!ack)
+		{
+			PwrEventClientPrepareSuspendNACKIncr(info);
+		}
+
+		if (PwrEventVotePrepareSuspend(name, ack))
+		{
+			WaitObjectSignal(&gWaitPrepareSuspend);
+		}
+	}
+}
+
+gint64
+SimSuspendRequestMs(void)
+{
+	return sSuspendRequestMs;
+}
+
+static void
+SimClientsSignal(SimSignal signal)
+{
+	GHashTableIter iter;
+	gpointer key;
+	gpointer value;
+
+	if (!sClients)
+	{
+		return;
+	}
+
+	g_hash_table_iter_init(&iter, sClients);
+
+	while (g_hash_table_iter_next(&iter, &key, &value))
+	{
+		SimClient *client = value;
+
+		if (client->vote != kSimVoteSilent)
+		{
+			SimSchedule(SimNowMs() + client->delay_ms, kSimEventVote, key, client->vote,
+			            signal);
+		}
+	}
+}
+
+bool
+LSSignalSend(LSHandle *sh, const char *uri, const char *payload, LSError *lserror)
+{
+	const char *signal = strrchr(uri, '/') + 1;
+	int resumetype;
+
+	SLEEPDLOG_DEBUG("signal %s %s", signal, payload);
+
+	if (!strcmp(signal, "suspendRequest"))
+	{
+		gSimStats.suspend_requests++;
+		sSuspendRequestMs = SimNowMs();
+		SimClientsSignal(kSimSignalSuspendRequest);
+	}
+	else if (!strcmp(signal, "prepareSuspend"))
+	{
+		gSimStats.prepare_suspends++;
+		SimClientsSignal(kSimSignalPrepareSuspend);
+	}
+	else if (!strcmp(signal, "resume") &&
+	         sscanf(payload, "{\"resumetype\":%d}", &resumetype) == 1 &&
+	         resumetype >= 0 && resumetype < G_N_ELEMENTS(gSimStats.resumes))
+	{
+		gSimStats.resumes[resumetype]++;
+	}
+
+	return true;
+}
+
+/*
+   The signals of suspend_ipc.c, sent the same way
+   */
+
+static int
+SimSignalSend(const char *uri, const char *payload)
+{
+	LSError lserror;
+	LSErrorInit(&lserror);
+
+	return LSSignalSend(GetLunaServiceHandle(), uri, payload, &lserror);
+}
+
+int
+SendSuspendRequest(const char *message)
+{
+	return SimSignalSend("luna://com.palm.sleep/com/palm/power/suspendRequest", "{}");
+}
+
+int
+SendPrepareSuspend(const char *message)
+{
+	return SimSignalSend("luna://com.palm.sleep/com/palm/power/prepareSuspend", "{}");
+}
+
+int
+SendResume(int resumetype, char *message)
+{
+	char *payload = g_strdup_printf("{\"resumetype\":%d}", resumetype);
+	int ret = SimSignalSend("luna://com.palm.sleep/com/palm/power/resume", payload);
+
+	g_free(payload);
+	return ret;
+}
+
+int
+SendDarkResume(const char *message)
+{
+	return SimSignalSend("luna://com.palm.sleep/com/palm/power/darkResume", "{}");
+}
+
+int
+SendSuspended(const char *message)
+{
+	return SimSignalSend("luna://com.palm.sleep/com/palm/power/suspended", "{}");
+}
+
+void
+SuspendIPCInit(void)
+{
+}
+
+int
+com_palm_suspend_lunabus_init(void)
+{
+	return 0;
+}
+
+INIT_FUNC("", com_palm_suspend_lunabus_init);
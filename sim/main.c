@@ -0,0 +1,219 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2011-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+
+/**
+ * @file main.c
+ *
+ * @brief Host simulation of the suspend logic: replays a trace through the
+ * suspend state machine, the activities and the client votes of sleepd, in
+ * virtual time, and reports how well the system slept.
+ *
+ *   sleepd-sim [-v] [-s key=value]... trace
+ *
+ * See trace.c for the trace format, and platform.c for the config keys.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "config.h"
+#include "init.h"
+#include "timesource.h"
+#include "reference_time.h"
+#include "client.h"
+#include "wakeup.h"
+#include "activity_ledger.h"
+#include "sim.h"
+
+#define SIM_LEDGER_TOP_N 10
+
+static gboolean sVerbose = FALSE;
+static gchar **sSettings = NULL;
+
+static GOptionEntry sOptions[] =
+{
+	{ "verbose", 'v', 0, G_OPTION_ARG_NONE, &sVerbose, "Log what sleepd does", NULL },
+	{ "set", 's', 0, G_OPTION_ARG_STRING_ARRAY, &sSettings, "Set a config key", "key=value" },
+	{ NULL }
+};
+
+static bool
+SimApplySettings(void)
+{
+	int i;
+
+	for (i = 0; sSettings && sSettings[i]; i++)
+	{
+		gchar **pair = g_strsplit(sSettings[i], "=", 2);
+		bool ok = pair[0] && pair[1];
+
+		if (ok)
+		{
+			char *end = NULL;
+			long value;
+
+			if (!strcmp(pair[1], "true") || !strcmp(pair[1], "false"))
+			{
+				value = !strcmp(pair[1], "true");
+			}
+			else
+			{
+				value = strtol(pair[1], &end, 10);
+				ok = end != pair[1] && !*end;
+			}
+
+			ok = ok && SimConfigSet(pair[0], value);
+		}
+
+		g_strfreev(pair);
+
+		if (!ok)
+		{
+			fprintf(stderr, "Cannot set \"%s\"\n", sSettings[i]);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void
+SimRemoveDir(const char *path)
+{
+	GDir *dir = g_dir_open(path, 0, NULL);
+	const char *name;
+
+	if (!dir)
+	{
+		return;
+	}
+
+	while ((name = g_dir_read_name(dir)) != NULL)
+	{
+		gchar *file = g_build_filename(path, name, NULL);
+
+		g_remove(file);
+		g_free(file);
+	}
+
+	g_dir_close(dir);
+	g_rmdir(path);
+}
+
+static double
+SimAverage(gint64 total_ms, int count)
+{
+	return count ? total_ms / 1000.0 / count : 0;
+}
+
+static void
+SimReport(void)
+{
+	gint64 total_ms = SimNowMs();
+	gint64 awake_ms = total_ms - gSimStats.asleep_ms;
+	char *wakeups = PwrEventWakeupStatsToJson();
+	char *ledger = PwrEventLedgerToJson(SIM_LEDGER_TOP_N);
+	gchar *clients = PwrEventGetClientTable();
+
+	printf("simulated          %.3f s\n", total_ms / 1000.0);
+	printf("suspend requests   %d\n", gSimStats.suspend_requests);
+	printf("prepare suspends   %d\n", gSimStats.prepare_suspends);
+	printf("sleeps             %d\n", gSimStats.sleeps);
+	printf("resumes            kernel %d, activity %d, aborted %d, dark %d\n",
+	       gSimStats.resumes[0], gSimStats.resumes[1], gSimStats.resumes[2],
+	       gSimStats.resumes[3]);
+	printf("nacks              %d\n", gSimStats.nacks);
+	printf("ignored wakes      %d\n", gSimStats.ignored_wakes);
+	printf("asleep             %.3f s (%.1f %%)\n", gSimStats.asleep_ms / 1000.0,
+	       total_ms ? 100.0 * gSimStats.asleep_ms / total_ms : 0);
+	printf("awake              %.3f s, %.3f s of it with the display off\n",
+	       awake_ms / 1000.0, (gSimStats.display_off_ms - gSimStats.asleep_ms) / 1000.0);
+	printf("idle to sleep      avg %.3f s, max %.3f s\n",
+	       SimAverage(gSimStats.idle_latency_total_ms, gSimStats.sleeps),
+	       gSimStats.idle_latency_max_ms / 1000.0);
+	printf("request to sleep   avg %.3f s, max %.3f s\n",
+	       SimAverage(gSimStats.vote_latency_total_ms, gSimStats.sleeps),
+	       gSimStats.vote_latency_max_ms / 1000.0);
+	printf("wakeups            %s\n", wakeups);
+	printf("activities         %s\n", ledger);
+	printf("clients\n%s\n", clients);
+
+	g_free(wakeups);
+	g_free(ledger);
+	g_free(clients);
+}
+
+int
+main(int argc, char **argv)
+{
+	GError *error = NULL;
+	GOptionContext *options = g_option_context_new("trace");
+
+	g_option_context_add_main_entries(options, sOptions, NULL);
+
+	if (!g_option_context_parse(options, &argc, &argv, &error) || argc != 2)
+	{
+		fprintf(stderr, "%s\n", error ? error->message : "Expected one trace");
+		return EXIT_FAILURE;
+	}
+
+	g_option_context_free(options);
+
+	gSimVerbose = sVerbose;
+
+	if (!SimApplySettings())
+	{
+		return EXIT_FAILURE;
+	}
+
+	if (!SimTraceLoad(argv[1], &error))
+	{
+		fprintf(stderr, "%s\n", error->message);
+		return EXIT_FAILURE;
+	}
+
+	// The activity checkpoint goes there
+	gchar *preference_dir = g_dir_make_tmp("sleepd-sim-XXXXXX", &error);
+
+	if (!preference_dir)
+	{
+		fprintf(stderr, "%s\n", error->message);
+		return EXIT_FAILURE;
+	}
+
+	gSleepConfig.preference_dir = preference_dir;
+
+	TimeSourceSimulate(SIM_EPOCH);
+	update_reference_time(NULL, NULL);
+	TheOneInit();
+
+	pthread_join(SimSuspendThread(), NULL);
+
+	SimStatsFinish();
+	SimReport();
+
+	SimRemoveDir(preference_dir);
+	g_free(preference_dir);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,191 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2011-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+
+/**
+ * @file nyx.c
+ *
+ * @brief Stand-ins for the nyx devices: the display state comes from the trace,
+ * and suspending sleeps until the next wake of the trace.
+ */
+
+#include <glib.h>
+
+#include "logging.h"
+#include "sim.h"
+
+#include <nyx/nyx_client.h>
+
+struct nyx_device
+{
+	nyx_device_type_t type;
+};
+
+static struct nyx_device sDevices[] =
+{
+	[NYX_DEVICE_SYSTEM] = { NYX_DEVICE_SYSTEM },
+	[NYX_DEVICE_LED_CONTROLLER] = { NYX_DEVICE_LED_CONTROLLER },
+};
+
+static bool sDisplayOn = true;
+static gint64 sDisplayOffMs = 0;
+
+SimStats gSimStats;
+
+/**
+ * @brief Turn the display on or off, keeping the time it spent off.
+ */
+void
+SimDisplaySet(bool on)
+{
+	if (on == sDisplayOn)
+	{
+		return;
+	}
+
+	SLEEPDLOG_DEBUG("display %s", on ? "on" : "off");
+
+	if (on)
+	{
+		gSimStats.display_off_ms += SimNowMs() - sDisplayOffMs;
+	}
+	else
+	{
+		sDisplayOffMs = SimNowMs();
+		SimNoteIdle();
+	}
+
+	sDisplayOn = on;
+}
+
+/**
+ * @brief Account the display still off at the end of the trace.
+ */
+void
+SimStatsFinish(void)
+{
+	if (!sDisplayOn)
+	{
+		gSimStats.display_off_ms += SimNowMs() - sDisplayOffMs;
+		sDisplayOffMs = SimNowMs();
+	}
+}
+
+nyx_error_t
+nyx_device_open(nyx_device_type_t type, const char *id, nyx_device_handle_t *handle)
+{
+	*handle = &sDevices[type];
+	return NYX_ERROR_NONE;
+}
+
+nyx_error_t
+nyx_led_controller_get_state(nyx_device_handle_t handle,
+                             nyx_led_controller_led_t led, nyx_led_controller_state_t *state)
+{
+	*state = sDisplayOn ? NYX_LED_CONTROLLER_STATE_ON : NYX_LED_CONTROLLER_STATE_OFF;
+	return NYX_ERROR_NONE;
+}
+
+nyx_error_t
+nyx_led_controller_execute_effect(nyx_device_handle_t handle,
+                                  nyx_led_controller_effect_t effect)
+{
+	if (effect.required.effect == NYX_LED_CONTROLLER_EFFECT_LED_SET &&
+	        effect.required.led == NYX_LED_CONTROLLER_LCD)
+	{
+		SimDisplaySet(effect.backlight.brightness_lcd != -1 &&
+		              effect.backlight.brightness_lcd != 0);
+	}
+
+	return NYX_ERROR_NONE;
+}
+
+static void
+SimLatency(gint64 since_ms, gint64 *total_ms, gint64 *max_ms)
+{
+	gint64 latency_ms = SimNowMs() - since_ms;
+
+	*total_ms += latency_ms;
+
+	if (latency_ms > *max_ms)
+	{
+		*max_ms = latency_ms;
+	}
+}
+
+/**
+ * @brief Sleep until the next wake of the trace, and tell wakeup.c what woke us.
+ */
+nyx_error_t
+nyx_system_suspend(nyx_device_handle_t handle, bool *success)
+{
+	gchar *sources = NULL;
+
+	*success = false;
+
+	if (SimDone())
+	{
+		return NYX_ERROR_NONE;
+	}
+
+	gint64 start_ms = SimNowMs();
+
+	gSimStats.sleeps++;
+	SimLatency(SimIdleSinceMs(), &gSimStats.idle_latency_total_ms,
+	           &gSimStats.idle_latency_max_ms);
+	SimLatency(SimSuspendRequestMs(), &gSimStats.vote_latency_total_ms,
+	           &gSimStats.vote_latency_max_ms);
+
+	SLEEPDLOG_DEBUG("suspending");
+
+	*success = SimSleepUntilWake(&sources);
+
+	gSimStats.asleep_ms += SimNowMs() - start_ms;
+
+	SLEEPDLOG_DEBUG("woken up by %s after %lld ms", sources ? sources : "the end of the trace",
+	                (long long)(SimNowMs() - start_ms));
+
+	SimSetWakeSources(sources ? sources : "");
+	SimNoteIdle();
+
+	g_free(sources);
+	return NYX_ERROR_NONE;
+}
+
+/* The simulated time source serves the RTC */
+nyx_error_t
+nyx_system_query_rtc_time(nyx_device_handle_t handle, time_t *time)
+{
+	return NYX_ERROR_NOT_IMPLEMENTED;
+}
+
+nyx_error_t
+nyx_system_shutdown(nyx_device_handle_t handle, nyx_system_shutdown_type_t type,
+                    const char *reason)
+{
+	SLEEPDLOG_DEBUG("shutdown: %s", reason);
+	return NYX_ERROR_NONE;
+}
+
+nyx_error_t
+nyx_system_reboot(nyx_device_handle_t handle, nyx_system_shutdown_type_t type,
+                  const char *reason)
+{
+	SLEEPDLOG_DEBUG("reboot: %s", reason);
+	return NYX_ERROR_NONE;
+}
@@ -0,0 +1,359 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2011-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+
+/**
+ * @file platform.c
+ *
+ * @brief Stand-ins for the sleepd modules the simulation does not link: the config,
+ * the main loop handles, timeouts and reference time, sysfs and logging.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <string.h>
+#include <glib.h>
+
+#include <cjson/json.h>
+
+#include "config.h"
+#include "main.h"
+#include "init.h"
+#include "sysfs.h"
+#include "logging.h"
+#include "timesaver.h"
+#include "timeout_alarm.h"
+#include "sawmill_logger.h"
+#include "timesource.h"
+#include "sim.h"
+
+#define kPowerWakeupSourcesSysfs "/sys/power/wakeup_event_list"
+
+/**
+ * default sleepd config, as config.c
+ */
+SleepConfiguration gSleepConfig =
+{
+	.wait_idle_ms = 500,
+	.wait_idle_granularity_ms = 100,
+
+	.wait_suspend_response_ms = 30000,
+	.wait_prepare_suspend_ms = 5000,
+	.after_resume_idle_ms = 1000,
+	.wait_alarms_s  = 5,
+
+	.is_running = 1,
+};
+
+/* The config keys a trace or the command line may set */
+static const struct
+{
+	const char *name;
+	size_t      offset;
+} sConfigKeys[] =
+{
+	{ "wait_idle_ms", offsetof(SleepConfiguration, wait_idle_ms) },
+	{ "wait_idle_granularity_ms", offsetof(SleepConfiguration, wait_idle_granularity_ms) },
+	{ "after_resume_idle_ms", offsetof(SleepConfiguration, after_resume_idle_ms) },
+	{ "wait_suspend_response_ms", offsetof(SleepConfiguration, wait_suspend_response_ms) },
+	{ "wait_prepare_suspend_ms", offsetof(SleepConfiguration, wait_prepare_suspend_ms) },
+};
+
+static int sConfigGeneration = 0;
+
+bool gSimVerbose = false;
+
+static gchar *sWakeSources = NULL;
+static gint64 sIdleSinceMs = 0;
+
+int
+ConfigGeneration(void)
+{
+	return sConfigGeneration;
+}
+
+int
+ConfigSnapshot(SleepConfiguration *config)
+{
+	*config = gSleepConfig;
+	return sConfigGeneration;
+}
+
+void
+ConfigPublish(const SleepConfiguration *config)
+{
+	gSleepConfig = *config;
+	sConfigGeneration++;
+}
+
+/**
+ * @brief Set a config key, and publish the change to the suspend thread.
+ */
+bool
+SimConfigSet(const char *key, int value)
+{
+	int i;
+
+	for (i = 0; i < G_N_ELEMENTS(sConfigKeys); i++)
+	{
+		if (!strcmp(sConfigKeys[i].name, key))
+		{
+			SleepConfiguration config = gSleepConfig;
+
+			*(int *)((char *)&config + sConfigKeys[i].offset) = value;
+			ConfigPublish(&config);
+
+			SLEEPDLOG_DEBUG("%s = %d", key, value);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static int
+config_init(void)
+{
+	return 0;
+}
+
+INIT_FUNC("", config_init);
+
+static int
+_timeout_db_init(void)
+{
+	return 0;
+}
+
+INIT_FUNC("config_init", _timeout_db_init);
+
+GMainContext *
+GetMainLoopContext(void)
+{
+	return g_main_context_default();
+}
+
+LSHandle *
+GetLunaServiceHandle(void)
+{
+	return NULL;
+}
+
+LSPalmService *
+GetPalmService(void)
+{
+	return NULL;
+}
+
+nyx_device_handle_t
+GetNyxSystemDevice(void)
+{
+	static nyx_device_handle_t device = NULL;
+
+	if (!device)
+	{
+		nyx_device_open(NYX_DEVICE_SYSTEM, "Main", &device);
+	}
+
+	return device;
+}
+
+/**
+ * @brief Note that the last reason to stay awake just ended, to measure how long
+ * sleepd then takes to suspend.
+ */
+void
+SimNoteIdle(void)
+{
+	sIdleSinceMs = SimNowMs();
+}
+
+gint64
+SimIdleSinceMs(void)
+{
+	return sIdleSinceMs;
+}
+
+/*
+   No timeouts are simulated: the RTC is never armed.
+   */
+
+bool
+queue_next_wakeup()
+{
+	return true;
+}
+
+bool
+timeout_get_next_wakeup(time_t *expiry, gchar **app_id, gchar **key)
+{
+	return false;
+}
+
+bool
+timeout_wakeup_due(void)
+{
+	return false;
+}
+
+bool
+timeout_get_armed_wakeup(gchar **app_id, gchar **key)
+{
+	return false;
+}
+
+int
+timeout_wakeup_coalesced(void)
+{
+	return 0;
+}
+
+bool
+update_timeouts_on_resume(void)
+{
+	return true;
+}
+
+void
+timeout_db_checkpoint(void)
+{
+}
+
+void
+timesaver_save()
+{
+}
+
+void
+sawmill_logger_record_sleep(struct timespec time_awake)
+{
+}
+
+void
+sawmill_logger_record_wake(struct timespec time_asleep)
+{
+}
+
+void
+get_time_now(struct timespec *time_now)
+{
+	TimeSourceGet(kTimeSourceRealtime, time_now);
+}
+
+/**
+ * @brief Set what the kernel reports as the sources of the last wakeup.
+ */
+void
+SimSetWakeSources(const char *sources)
+{
+	g_free(sWakeSources);
+	sWakeSources = g_strdup(sources);
+}
+
+int
+SysfsGetString(const char *path, char *ret_string, size_t maxlen)
+{
+	if (strcmp(path, kPowerWakeupSourcesSysfs) || !sWakeSources)
+	{
+		return -1;
+	}
+
+	g_strlcpy(ret_string, sWakeSources, maxlen);
+	return 0;
+}
+
+int
+SysfsGetInt(const char *path, int *ret_data)
+{
+	return -1;
+}
+
+int
+SysfsGetDouble(const char *path, double *ret_data)
+{
+	return -1;
+}
+
+int
+SysfsWriteString(const char *path, const char *string)
+{
+	return 0;
+}
+
+int
+PmLogGetContext(const char *name, PmLogContext *context)
+{
+	*context = 1;
+	return 0;
+}
+
+void
+SimLogMsg(const char *level, const char *msgid)
+{
+	printf("[%10.3f] %s %s\n", SimNowMs() / 1000.0, level, msgid);
+}
+
+void
+SimLogDebug(const char *fmt, ...)
+{
+	va_list args;
+
+	if (!gSimVerbose)
+	{
+		return;
+	}
+
+	printf("[%10.3f] ", SimNowMs() / 1000.0);
+
+	va_start(args, fmt);
+	vprintf(fmt, args);
+	va_end(args);
+
+	if (!g_str_has_suffix(fmt, "\n"))
+	{
+		printf("\n");
+	}
+}
+
+/*
+   cjson, for the luna handlers of machine.c, which are never called
+   */
+
+struct json_object *
+json_tokener_parse(const char *str)
+{
+	return (struct json_object *)-1;
+}
+
+struct json_object *
+json_object_object_get(struct json_object *obj, const char *key)
+{
+	return NULL;
+}
+
+bool
+json_object_get_boolean(struct json_object *obj)
+{
+	return false;
+}
+
+void
+json_object_put(struct json_object *obj)
+{
+}
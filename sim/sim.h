@@ -0,0 +1,138 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2011-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+
+/**
+ * @file sim.h
+ *
+ * @brief Host simulation of the suspend logic.
+ *
+ * suspend.c, activity.c, client.c and the modules they need run unchanged on top
+ * of stand-ins for luna-service2, nyx and powerd. Time is virtual: the suspend
+ * loop never blocks, it advances the clock to its next timeout or to the next
+ * event of the trace, whichever comes first.
+ */
+
+#ifndef _SIM_H_
+#define _SIM_H_
+
+#include <stdbool.h>
+#include <pthread.h>
+#include <glib.h>
+
+#include "wait.h"
+
+/**
+ * Events of a trace, and the ones the simulation schedules itself.
+ */
+enum
+{
+	kSimEventDisplay,        // arg: display on
+	kSimEventActivityStart,  // name: activity id, arg: duration ms
+	kSimEventActivityStop,   // name: activity id
+	kSimEventClient,         // name: client, arg: vote, arg2: response delay ms
+	kSimEventVote,           // name: client, arg: vote, arg2: signal
+	kSimEventWake,           // name: kernel wakeup sources
+	kSimEventSet,            // name: config key, arg: value
+	kSimEventEnd,
+};
+typedef int SimEventType;
+
+/**
+ * How a client answers "suspendRequest" and "prepareSuspend".
+ */
+enum
+{
+	kSimVoteAck,
+	kSimVoteNack,
+	kSimVoteSilent,
+};
+typedef int SimVote;
+
+enum
+{
+	kSimSignalSuspendRequest,
+	kSimSignalPrepareSuspend,
+};
+typedef int SimSignal;
+
+/**
+ * What the report is made of.
+ */
+typedef struct
+{
+	int suspend_requests;
+	int prepare_suspends;
+	int sleeps;
+	int resumes[4];          // by resume type, as in the "resume" signal
+	int nacks;
+	int ignored_wakes;       // wake events of the trace while already awake
+
+	gint64 asleep_ms;
+	gint64 display_off_ms;
+
+	gint64 idle_latency_total_ms;  // from going idle to sleep
+	gint64 idle_latency_max_ms;
+	gint64 vote_latency_total_ms;  // from "suspendRequest" to sleep
+	gint64 vote_latency_max_ms;
+} SimStats;
+
+extern SimStats gSimStats;
+
+/* suspend.c */
+extern GMainLoop *suspend_loop;
+extern WaitObj gWaitSuspendResponse;
+extern WaitObj gWaitPrepareSuspend;
+void *SuspendThread(void *ctx);
+
+/* clock.c */
+
+/* System time at the start of the trace */
+#define SIM_EPOCH 1400000000
+
+gint64 SimNowMs(void);
+void SimClockSet(gint64 now_ms);
+
+/* trace.c */
+bool SimTraceLoad(const char *path, GError **error);
+void SimSchedule(gint64 at_ms, SimEventType type, const char *name, int arg,
+                 int arg2);
+void SimRunUntil(gint64 until_ms, bool *stop);
+bool SimSleepUntilWake(gchar **sources);
+bool SimDone(void);
+
+/* nyx.c */
+void SimDisplaySet(bool on);
+void SimStatsFinish(void);
+
+/* lunaservice.c */
+void SimClientSet(const char *name, SimVote vote, int delay_ms);
+void SimClientVote(const char *name, SimVote vote, SimSignal signal);
+gint64 SimSuspendRequestMs(void);
+
+/* platform.c */
+extern bool gSimVerbose;
+bool SimConfigSet(const char *key, int value);
+void SimSetWakeSources(const char *sources);
+void SimNoteIdle(void);
+gint64 SimIdleSinceMs(void);
+
+/* loop.c */
+pthread_t SimSuspendThread(void);
+
+#endif
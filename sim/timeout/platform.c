@@ -0,0 +1,319 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2011-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+
+/**
+ * @file platform.c
+ *
+ * @brief Stand-ins for what the timeout database code needs from the rest of
+ * sleepd and from the webOS libraries. The tests call the timeout functions
+ * directly: no luna message is ever delivered or sent, and no timeout expires
+ * while they run, so the bus and cjson are never really used.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <glib.h>
+
+#include <cjson/json.h>
+#include <PmLogLib.h>
+#include <luna-service2/lunaservice.h>
+
+#include "config.h"
+#include "main.h"
+#include "init.h"
+#include "lunaservice_utils.h"
+#include "timesaver.h"
+#include "timesource.h"
+
+SleepConfiguration gSleepConfig =
+{
+	.is_running = 1,
+};
+
+static int
+config_init(void)
+{
+	return 0;
+}
+
+INIT_FUNC("", config_init);
+
+GMainContext *
+GetMainLoopContext(void)
+{
+	return g_main_context_default();
+}
+
+LSHandle *
+GetLunaServiceHandle(void)
+{
+	return NULL;
+}
+
+LSPalmService *
+GetPalmService(void)
+{
+	return NULL;
+}
+
+nyx_device_handle_t
+GetNyxSystemDevice(void)
+{
+	return NULL;
+}
+
+nyx_error_t
+nyx_system_query_rtc_time(nyx_device_handle_t handle, time_t *time)
+{
+	*time = TimeSourceNow();
+	return NYX_ERROR_NONE;
+}
+
+nyx_error_t
+nyx_system_set_alarm(nyx_device_handle_t handle, time_t time,
+                     nyx_device_callback_function_t callback, void *context)
+{
+	return NYX_ERROR_NONE;
+}
+
+/*
+   The legacy alarms of alarm.c, which the tests do not load
+   */
+
+int
+alarm_init(void)
+{
+	return 0;
+}
+
+void
+alarm_db_unload(void)
+{
+}
+
+void
+update_alarms_delta(time_t delta)
+{
+}
+
+bool
+ConvertJsonTime(const char *time, int *hour, int *minute, int *second)
+{
+	return false;
+}
+
+/*
+   Logging: only the errors are printed, the tests print their own results
+   */
+
+int
+PmLogGetContext(const char *name, PmLogContext *context)
+{
+	*context = 1;
+	return 0;
+}
+
+void
+SimLogMsg(const char *level, const char *msgid)
+{
+	if (!strcmp(level, "error") || !strcmp(level, "critical"))
+	{
+		fprintf(stderr, "%s %s\n", level, msgid);
+	}
+}
+
+void
+SimLogDebug(const char *fmt, ...)
+{
+}
+
+/*
+   luna-service2
+   */
+
+bool
+LSErrorInit(LSError *error)
+{
+	error->error_code = 0;
+	error->message = NULL;
+	return true;
+}
+
+void
+LSErrorFree(LSError *error)
+{
+}
+
+void
+LSErrorPrint(LSError *lserror, FILE *out)
+{
+}
+
+const char *
+LSMessageGetPayload(LSMessage *message)
+{
+	return "{}";
+}
+
+const char *
+LSMessageGetApplicationID(LSMessage *message)
+{
+	return NULL;
+}
+
+bool
+LSMessageIsPublic(LSPalmService *psh, LSMessage *message)
+{
+	return false;
+}
+
+bool
+LSMessageReply(LSHandle *sh, LSMessage *message, const char *payload,
+               LSError *lserror)
+{
+	return true;
+}
+
+bool
+LSCallOneReply(LSHandle *sh, const char *uri, const char *payload,
+               LSFilterFunc callback, void *ctx, LSMessageToken *token,
+               LSError *lserror)
+{
+	return true;
+}
+
+bool
+LSCallFromApplicationOneReply(LSHandle *sh, const char *uri,
+                              const char *payload, const char *applicationID,
+                              LSFilterFunc callback, void *ctx,
+                              LSMessageToken *token, LSError *lserror)
+{
+	return true;
+}
+
+LSHandle *
+LSPalmServiceGetPublicConnection(LSPalmService *psh)
+{
+	return NULL;
+}
+
+LSHandle *
+LSPalmServiceGetPrivateConnection(LSPalmService *psh)
+{
+	return NULL;
+}
+
+bool
+LSPalmServiceRegisterCategoryNoted(LSPalmService *psh, const char *category,
+                                   LSMethod *public_methods, LSMethod *private_methods,
+                                   LSSignal *signals, LSError *lserror)
+{
+	return true;
+}
+
+void
+LSMessageReplyErrorUnknown(LSHandle *sh, LSMessage *message)
+{
+}
+
+void
+LSMessageReplyErrorInvalidParams(LSHandle *sh, LSMessage *message)
+{
+}
+
+void
+LSMessageReplyErrorBadJSON(LSHandle *sh, LSMessage *message)
+{
+}
+
+void
+LSMessageReplySuccess(LSHandle *sh, LSMessage *message)
+{
+}
+
+/*
+   cjson, for the luna handlers, which are never called
+   */
+
+struct json_object *
+json_tokener_parse(const char *str)
+{
+	return (struct json_object *)-1;
+}
+
+struct json_object *
+json_object_object_get(struct json_object *obj, const char *key)
+{
+	return NULL;
+}
+
+bool
+json_object_object_get_ex(struct json_object *obj, const char *key,
+                          struct json_object **value)
+{
+	return false;
+}
+
+bool
+json_object_get_boolean(struct json_object *obj)
+{
+	return false;
+}
+
+int
+json_object_get_int(struct json_object *obj)
+{
+	return 0;
+}
+
+int64_t
+json_object_get_int64(struct json_object *obj)
+{
+	return 0;
+}
+
+const char *
+json_object_get_string(struct json_object *obj)
+{
+	return NULL;
+}
+
+bool
+json_object_is_type(struct json_object *obj, enum json_type type)
+{
+	return false;
+}
+
+int
+json_object_array_length(struct json_object *obj)
+{
+	return 0;
+}
+
+struct json_object *
+json_object_array_get_idx(struct json_object *obj, int idx)
+{
+	return NULL;
+}
+
+void
+json_object_put(struct json_object *obj)
+{
+}
@@ -0,0 +1,523 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2011-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+
+/**
+ * @file timeout_test.c
+ *
+ * @brief Tests of the timeout database: set, read and clear round-trips of
+ * timeouts whose app id, key, uri and params contain quotes, SQL and unicode,
+ * which all go through bound statements, and the calls per second of each.
+ *
+ *   sleepd-timeout-test [-n calls] [-b rows]
+ *
+ * The database is first created with the version 0 schema, holding duplicate
+ * timeouts, to check that init migrates it to the latest version.
+ *
+ * With -b, also time sets and clears against a table already holding "rows"
+ * timeouts, which is how the owner index was measured.
+ *
+ * The database is created in a temporary directory, through the same init
+ * funcs as sleepd.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <sqlite3.h>
+
+#include "config.h"
+#include "init.h"
+#include "timesource.h"
+#include "timeout_alarm.h"
+
+#define TEST_DEFAULT_CALLS 1000
+
+// Sets and clears averaged by the benchmark
+#define TEST_BENCHMARK_OPS 500
+
+// Far enough for no timeout to expire while the tests run
+#define TEST_EXPIRY_SECS (24*60*60)
+
+// Last entry of kTimeoutMigrations
+#define TEST_SCHEMA_VERSION 5
+
+static int sFailures = 0;
+
+#define CHECK(cond, ...)                                        \
+do {                                                            \
+    if (!(cond))                                                \
+    {                                                           \
+        printf("FAIL %s:%d: ", __func__, __LINE__);             \
+        printf(__VA_ARGS__);                                    \
+        printf("\n");                                           \
+        sFailures++;                                            \
+    }                                                           \
+} while (0)
+
+/* Strings which broke, or could break, a query built with printf */
+static const char *sAwkwardStrings[] =
+{
+	"plain",
+	"",
+	"with \"double\" quotes",
+	"with 'single' quotes",
+	"'); DROP TABLE AlarmTimeout; --",
+	"percent %s %d %n",
+	"back\\slash",
+	"caf\xc3\xa9 \xe2\x98\x95 \xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e \xf0\x9f\x98\x80",
+};
+
+static void
+TestFreeRead(_AlarmTimeoutNonConst *timeout)
+{
+	g_free(timeout->table_id);
+	g_free(timeout->app_id);
+	g_free(timeout->key);
+	g_free(timeout->uri);
+	g_free(timeout->params);
+	g_free(timeout->activity_id);
+	memset(timeout, 0, sizeof(*timeout));
+}
+
+static bool
+TestSet(const char *app_id, const char *key, const char *uri,
+        const char *params, bool public_bus, time_t expiry)
+{
+	_AlarmTimeout timeout;
+
+	_timeout_create(&timeout, app_id, key, uri, params, public_bus, false,
+	                "com.palm.sleepd.test", 5000, false, expiry);
+
+	return _timeout_set(&timeout);
+}
+
+/**
+ * @brief Set, read back, replace and clear a timeout with the given app id and
+ * key, on both buses.
+ */
+static void
+TestRoundTrip(const char *app_id, const char *key)
+{
+	_AlarmTimeoutNonConst read;
+	time_t expiry = TimeSourceNow() + TEST_EXPIRY_SECS;
+	gchar *params = g_strdup_printf("{\"key\":\"%s\"}", key);
+
+	memset(&read, 0, sizeof(read));
+
+	CHECK(TestSet(app_id, key, key, params, true, expiry),
+	      "set (\"%s\", \"%s\")", app_id, key);
+	CHECK(TestSet(app_id, key, key, params, false, expiry + 1),
+	      "set private (\"%s\", \"%s\")", app_id, key);
+
+	if (_timeout_read(&read, app_id, key, true))
+	{
+		CHECK(!strcmp(read.app_id, app_id), "app_id \"%s\" read as \"%s\"", app_id,
+		      read.app_id);
+		CHECK(!strcmp(read.key, key), "key \"%s\" read as \"%s\"", key, read.key);
+		CHECK(!strcmp(read.uri, key), "uri \"%s\" read as \"%s\"", key, read.uri);
+		CHECK(!strcmp(read.params, params), "params \"%s\" read as \"%s\"", params,
+		      read.params);
+		CHECK(read.public_bus, "(\"%s\", \"%s\") read from the private bus", app_id,
+		      key);
+		CHECK(read.expiry == expiry, "expiry %ld read as %ld", (long)expiry,
+		      (long)read.expiry);
+		TestFreeRead(&read);
+	}
+	else
+	{
+		CHECK(false, "read (\"%s\", \"%s\")", app_id, key);
+	}
+
+	// Setting it again replaces it
+	CHECK(TestSet(app_id, key, key, params, true, expiry + 60),
+	      "replace (\"%s\", \"%s\")", app_id, key);
+
+	if (_timeout_read(&read, app_id, key, true))
+	{
+		CHECK(read.expiry == expiry + 60, "replaced expiry %ld read as %ld",
+		      (long)(expiry + 60), (long)read.expiry);
+		TestFreeRead(&read);
+	}
+	else
+	{
+		CHECK(false, "read replaced (\"%s\", \"%s\")", app_id, key);
+	}
+
+	CHECK(_timeout_clear(app_id, key, true), "clear (\"%s\", \"%s\")", app_id, key);
+	CHECK(!_timeout_read(&read, app_id, key, true),
+	      "(\"%s\", \"%s\") still there after clear", app_id, key);
+
+	// The timeout on the other bus is left alone
+	if (_timeout_read(&read, app_id, key, false))
+	{
+		CHECK(read.expiry == expiry + 1, "private expiry %ld read as %ld",
+		      (long)(expiry + 1), (long)read.expiry);
+		TestFreeRead(&read);
+	}
+	else
+	{
+		CHECK(false, "private (\"%s\", \"%s\") cleared with the public one", app_id,
+		      key);
+	}
+
+	CHECK(_timeout_clear(app_id, key, false), "clear private (\"%s\", \"%s\")",
+	      app_id, key);
+	CHECK(!_timeout_read(&read, app_id, key, false),
+	      "private (\"%s\", \"%s\") still there after clear", app_id, key);
+
+	g_free(params);
+}
+
+static void
+TestRoundTrips(void)
+{
+	int i, j;
+
+	for (i = 0; i < G_N_ELEMENTS(sAwkwardStrings); i++)
+	{
+		for (j = 0; j < G_N_ELEMENTS(sAwkwardStrings); j++)
+		{
+			TestRoundTrip(sAwkwardStrings[i], sAwkwardStrings[j]);
+		}
+	}
+
+	// A key must only match itself, not a key it is a prefix or a pattern of
+	CHECK(TestSet("com.test", "key", "uri", "{}", true,
+	              TimeSourceNow() + TEST_EXPIRY_SECS), "set \"key\"");
+	CHECK(_timeout_clear("com.test", "key%", true), "clear \"key%%\"");
+	CHECK(_timeout_clear("com.test", "k_y", true), "clear \"k_y\"");
+
+	_AlarmTimeoutNonConst read;
+	memset(&read, 0, sizeof(read));
+
+	if (_timeout_read(&read, "com.test", "key", true))
+	{
+		TestFreeRead(&read);
+	}
+	else
+	{
+		CHECK(false, "\"key\" cleared by a pattern");
+	}
+
+	CHECK(_timeout_clear("com.test", "key", true), "clear \"key\"");
+}
+
+/* A version 0 database: no activity, window or deadline columns, no owner
+   uniqueness, and the app_key_index of timeout/query's first version. The
+   timeouts expire a day after the test starts, like TEST_EXPIRY_SECS. */
+static const char *kTestVersion0Sql = "\
+CREATE TABLE AlarmTimeout (t1key INTEGER PRIMARY KEY, app_id TEXT, key TEXT,\
+                           uri TEXT, params TEXT, public_bus INTEGER,\
+                           wakeup INTEGER, calendar INTEGER, expiry DATE);\
+CREATE INDEX expiry_index on AlarmTimeout (expiry);\
+CREATE INDEX app_key_index on AlarmTimeout (app_id, key);\
+INSERT INTO AlarmTimeout VALUES (1, 'com.test.migrate', 'dup', 'u', '{}', 1, 0, 0, strftime('%s','now')+86400);\
+INSERT INTO AlarmTimeout VALUES (2, 'com.test.migrate', 'dup', 'u', '{}', 1, 0, 0, strftime('%s','now')+86400);\
+INSERT INTO AlarmTimeout VALUES (3, 'com.test.migrate', 'dup', 'u', '{}', 0, 0, 0, strftime('%s','now')+86400);\
+INSERT INTO AlarmTimeout VALUES (4, 'com.test.other', 'dup', 'u', '{}', 1, 0, 0, strftime('%s','now')+86400);\
+INSERT INTO AlarmTimeout VALUES (5, 'com.test.migrate', 'other', 'u', '{}', 1, 0, 0, strftime('%s','now')+86400);\
+INSERT INTO AlarmTimeout VALUES (6, 'com.test.migrate', 'other', 'u', '{}', 1, 0, 0, strftime('%s','now')+86400);";
+
+// What the owner index migration keeps: the latest of each duplicate
+static const int kTestMigratedKeys[] = { 2, 3, 4, 6 };
+
+/**
+ * @brief Create the timeout database with the version 0 schema, before init.
+ */
+static void
+TestMigrationCreate(const char *preference_dir)
+{
+	gchar *path = g_build_filename(preference_dir, "SysTimeouts.db", NULL);
+	sqlite3 *db = NULL;
+
+	CHECK(sqlite3_open(path, &db) == SQLITE_OK, "open %s", path);
+	CHECK(sqlite3_exec(db, kTestVersion0Sql, NULL, NULL, NULL) == SQLITE_OK,
+	      "create version 0 database: %s", sqlite3_errmsg(db));
+	sqlite3_close(db);
+
+	g_free(path);
+}
+
+static int
+TestMigrationInt(sqlite3 *db, const char *sql)
+{
+	sqlite3_stmt *st = NULL;
+	int value = -1;
+
+	if (sqlite3_prepare_v2(db, sql, -1, &st, NULL) == SQLITE_OK &&
+	        sqlite3_step(st) == SQLITE_ROW)
+	{
+		value = sqlite3_column_int(st, 0);
+	}
+
+	sqlite3_finalize(st);
+	return value;
+}
+
+/**
+ * @brief Check, after init, that the version 0 database was brought up to
+ * date: duplicates dropped, owner_index in place of app_key_index, and
+ * user_version at the last migration.
+ */
+static void
+TestMigrationCheck(const char *preference_dir)
+{
+	gchar *path = g_build_filename(preference_dir, "SysTimeouts.db", NULL);
+	sqlite3 *db = NULL;
+	sqlite3_stmt *st = NULL;
+	int i = 0;
+
+	if (sqlite3_open(path, &db) != SQLITE_OK)
+	{
+		CHECK(false, "reopen %s", path);
+		sqlite3_close(db);
+		g_free(path);
+		return;
+	}
+
+	CHECK(TestMigrationInt(db, "PRAGMA user_version") == TEST_SCHEMA_VERSION,
+	      "user_version %d, expected %d", TestMigrationInt(db, "PRAGMA user_version"),
+	      TEST_SCHEMA_VERSION);
+	CHECK(TestMigrationInt(db, "SELECT COUNT(*) FROM sqlite_master "
+	                       "WHERE type='index' AND name='owner_index'") == 1,
+	      "owner_index missing");
+	CHECK(TestMigrationInt(db, "SELECT COUNT(*) FROM sqlite_master "
+	                       "WHERE type='index' AND name='app_key_index'") == 0,
+	      "app_key_index left behind");
+
+	if (sqlite3_prepare_v2(db, "SELECT t1key FROM AlarmTimeout ORDER BY t1key",
+	                       -1, &st, NULL) == SQLITE_OK)
+	{
+		while (sqlite3_step(st) == SQLITE_ROW)
+		{
+			int t1key = sqlite3_column_int(st, 0);
+
+			CHECK(i < G_N_ELEMENTS(kTestMigratedKeys) && t1key == kTestMigratedKeys[i],
+			      "row %d has t1key %d", i, t1key);
+			i++;
+		}
+	}
+
+	CHECK(i == G_N_ELEMENTS(kTestMigratedKeys), "%d rows left, expected %d", i,
+	      (int)G_N_ELEMENTS(kTestMigratedKeys));
+
+	sqlite3_finalize(st);
+	sqlite3_close(db);
+	g_free(path);
+
+	// Out of the way of the other tests
+	CHECK(_timeout_clear("com.test.migrate", "dup", true), "clear migrated dup");
+	CHECK(_timeout_clear("com.test.migrate", "dup", false),
+	      "clear migrated private dup");
+	CHECK(_timeout_clear("com.test.other", "dup", true), "clear migrated other");
+	CHECK(_timeout_clear("com.test.migrate", "other", true),
+	      "clear migrated other key");
+}
+
+static void
+TestReportRate(const char *what, int calls, gint64 elapsed_us)
+{
+	printf("%-6s %8d calls  %10.0f calls/s\n", what, calls,
+	       elapsed_us ? calls * 1000000.0 / elapsed_us : 0);
+}
+
+/**
+ * @brief Time "calls" sets, reads and clears of distinct timeouts.
+ */
+static void
+TestThroughput(int calls)
+{
+	_AlarmTimeoutNonConst read;
+	time_t expiry = TimeSourceNow() + TEST_EXPIRY_SECS;
+	gchar **keys = g_new0(gchar *, calls + 1);
+	gint64 start;
+	int i;
+
+	memset(&read, 0, sizeof(read));
+
+	for (i = 0; i < calls; i++)
+	{
+		keys[i] = g_strdup_printf("key \"%d\" \xe2\x98\x95", i);
+	}
+
+	start = g_get_monotonic_time();
+
+	for (i = 0; i < calls; i++)
+	{
+		CHECK(TestSet("com.test.rate", keys[i], "uri", "{}", true, expiry + i),
+		      "set %d", i);
+	}
+
+	TestReportRate("set", calls, g_get_monotonic_time() - start);
+
+	start = g_get_monotonic_time();
+
+	for (i = 0; i < calls; i++)
+	{
+		bool found = _timeout_read(&read, "com.test.rate", keys[i], true);
+
+		CHECK(found && read.expiry == expiry + i, "read %d", i);
+		TestFreeRead(&read);
+	}
+
+	TestReportRate("read", calls, g_get_monotonic_time() - start);
+
+	start = g_get_monotonic_time();
+
+	for (i = 0; i < calls; i++)
+	{
+		CHECK(_timeout_clear("com.test.rate", keys[i], true), "clear %d", i);
+	}
+
+	TestReportRate("clear", calls, g_get_monotonic_time() - start);
+
+	g_strfreev(keys);
+}
+
+/**
+ * @brief Average time of a set and of a clear with "rows" other timeouts in the
+ * table.
+ */
+static void
+TestBenchmark(int rows)
+{
+	time_t expiry = TimeSourceNow() + TEST_EXPIRY_SECS;
+	gint64 start;
+	int i;
+
+	for (i = 0; i < rows; i++)
+	{
+		gchar *key = g_strdup_printf("fill.%d", i);
+
+		CHECK(TestSet("com.test.fill", key, "uri", "{}", true, expiry + i),
+		      "fill %d", i);
+		g_free(key);
+	}
+
+	gchar **keys = g_new0(gchar *, TEST_BENCHMARK_OPS + 1);
+
+	for (i = 0; i < TEST_BENCHMARK_OPS; i++)
+	{
+		keys[i] = g_strdup_printf("bench.%d", i);
+	}
+
+	start = g_get_monotonic_time();
+
+	for (i = 0; i < TEST_BENCHMARK_OPS; i++)
+	{
+		CHECK(TestSet("com.test.bench", keys[i], "uri", "{}", true, expiry + i),
+		      "set %d", i);
+	}
+
+	printf("set    %8d rows   %10.1f us\n", rows,
+	       (g_get_monotonic_time() - start) / (double)TEST_BENCHMARK_OPS);
+
+	start = g_get_monotonic_time();
+
+	for (i = 0; i < TEST_BENCHMARK_OPS; i++)
+	{
+		CHECK(_timeout_clear("com.test.bench", keys[i], true), "clear %d", i);
+	}
+
+	printf("clear  %8d rows   %10.1f us\n", rows,
+	       (g_get_monotonic_time() - start) / (double)TEST_BENCHMARK_OPS);
+
+	g_strfreev(keys);
+}
+
+static void
+TestRemoveDir(const char *path)
+{
+	GDir *dir = g_dir_open(path, 0, NULL);
+	const char *name;
+
+	if (!dir)
+	{
+		return;
+	}
+
+	while ((name = g_dir_read_name(dir)) != NULL)
+	{
+		gchar *file = g_build_filename(path, name, NULL);
+
+		g_remove(file);
+		g_free(file);
+	}
+
+	g_dir_close(dir);
+	g_rmdir(path);
+}
+
+int
+main(int argc, char **argv)
+{
+	GError *error = NULL;
+	int calls = TEST_DEFAULT_CALLS;
+	int rows = 0;
+	int i;
+
+	for (i = 1; i < argc; i += 2)
+	{
+		if (i + 1 < argc && !strcmp(argv[i], "-n"))
+		{
+			calls = atoi(argv[i + 1]);
+		}
+		else if (i + 1 < argc && !strcmp(argv[i], "-b"))
+		{
+			rows = atoi(argv[i + 1]);
+		}
+		else
+		{
+			fprintf(stderr, "usage: %s [-n calls] [-b rows]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	gchar *preference_dir = g_dir_make_tmp("sleepd-timeout-XXXXXX", &error);
+
+	if (!preference_dir)
+	{
+		fprintf(stderr, "%s\n", error->message);
+		return EXIT_FAILURE;
+	}
+
+	gSleepConfig.preference_dir = preference_dir;
+
+	TestMigrationCreate(preference_dir);
+
+	TheOneInit();
+
+	TestMigrationCheck(preference_dir);
+	TestRoundTrips();
+	TestThroughput(calls);
+
+	if (rows > 0)
+	{
+		TestBenchmark(rows);
+	}
+
+	TestRemoveDir(preference_dir);
+	g_free(preference_dir);
+
+	printf("%s: %d failures\n", sFailures ? "FAILED" : "PASSED", sFailures);
+
+	return sFailures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,420 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2011-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+
+/**
+ * @file trace.c
+ *
+ * @brief Scripted traces, and the queue of events the simulation replays in
+ * virtual time.
+ *
+ * A trace has one event per line, "<time> <event> [args]", where time is from the
+ * start of the trace, or from the previous event with a leading '+', in ms or with
+ * a unit: "250ms", "30s", "5m", "8h". '#' starts a comment. The events are:
+ *
+ *   display on|off
+ *   activity start <id> <duration>
+ *   activity stop <id>
+ *   client <name> ack|nack|silent [<delay>]   how it votes from now on (delay 100ms)
+ *   wake <source>[,<source>...]               kernel wakeup sources, ends a sleep
+ *   set <key> <value>                         tune a config key, see platform.c
+ *   end
+ *
+ * The system can only see a wake while it sleeps: any other event due during a
+ * sleep is delivered when the system wakes up. A trace without "end" ends at its
+ * last event.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <glib.h>
+
+#include "activity.h"
+#include "logging.h"
+#include "sim.h"
+
+typedef struct
+{
+	gint64       at_ms;
+	SimEventType type;
+	gchar       *name;
+	int          arg;
+	int          arg2;
+} SimEvent;
+
+/* Sorted by time, in the order they were scheduled */
+static GQueue sEvents = G_QUEUE_INIT;
+
+static bool sDone = false;
+
+#define SIM_TRACE_ERROR g_quark_from_static_string("sim-trace")
+
+#define SIM_VOTE_DELAY_MS 100
+
+static void
+SimEventFree(SimEvent *event)
+{
+	g_free(event->name);
+	g_free(event);
+}
+
+static gint
+SimEventCompare(gconstpointer a, gconstpointer b, gpointer data)
+{
+	const SimEvent *event_a = a;
+	const SimEvent *event_b = b;
+
+	// Never 0, so that events at the same time stay in order
+	return event_a->at_ms < event_b->at_ms ? -1 : 1;
+}
+
+void
+SimSchedule(gint64 at_ms, SimEventType type, const char *name, int arg, int arg2)
+{
+	SimEvent *event = g_new0(SimEvent, 1);
+
+	event->at_ms = at_ms;
+	event->type = type;
+	event->name = g_strdup(name);
+	event->arg = arg;
+	event->arg2 = arg2;
+
+	g_queue_insert_sorted(&sEvents, event, SimEventCompare, NULL);
+}
+
+static void
+SimApply(SimEvent *event)
+{
+	switch (event->type)
+	{
+		case kSimEventDisplay:
+			SimDisplaySet(event->arg);
+			break;
+
+		case kSimEventActivityStart:
+			PwrEventActivityStart(event->name, event->arg);
+			break;
+
+		case kSimEventActivityStop:
+			PwrEventActivityStop(event->name);
+			SimNoteIdle();
+			break;
+
+		case kSimEventClient:
+			SimClientSet(event->name, event->arg, event->arg2);
+			break;
+
+		case kSimEventVote:
+			SimClientVote(event->name, event->arg, event->arg2);
+			break;
+
+		case kSimEventWake:
+			SLEEPDLOG_DEBUG("ignoring wake by %s, the system is awake", event->name);
+			gSimStats.ignored_wakes++;
+			break;
+
+		case kSimEventSet:
+			SimConfigSet(event->name, event->arg);
+			break;
+
+		case kSimEventEnd:
+			sDone = true;
+			break;
+	}
+}
+
+/**
+ * @brief Replay the events due by until_ms. Stops early once *stop is set by an
+ * event or, without stop, once an event was replayed: the caller may have to look
+ * at its own timeouts again. Otherwise the clock ends at until_ms.
+ */
+void
+SimRunUntil(gint64 until_ms, bool *stop)
+{
+	SimEvent *event;
+
+	while (!sDone && (event = g_queue_peek_head(&sEvents)) && event->at_ms <= until_ms)
+	{
+		g_queue_pop_head(&sEvents);
+
+		SimClockSet(event->at_ms);
+		SimApply(event);
+		SimEventFree(event);
+
+		if (!stop || *stop)
+		{
+			return;
+		}
+	}
+
+	if (!sDone && until_ms != G_MAXINT64)
+	{
+		SimClockSet(until_ms);
+	}
+}
+
+/**
+ * @brief Sleep until the next wake of the trace. The events due meanwhile stay
+ * queued, and are replayed once awake.
+ *
+ * @retval false if the trace ended first
+ */
+bool
+SimSleepUntilWake(gchar **sources)
+{
+	GList *iter;
+
+	for (iter = sEvents.head; iter != NULL; iter = iter->next)
+	{
+		SimEvent *event = iter->data;
+
+		if (event->type == kSimEventEnd)
+		{
+			SimClockSet(event->at_ms);
+			sDone = true;
+			return false;
+		}
+
+		if (event->type == kSimEventWake)
+		{
+			g_queue_delete_link(&sEvents, iter);
+
+			SimClockSet(event->at_ms);
+			*sources = event->name;
+			event->name = NULL;
+			SimEventFree(event);
+			return true;
+		}
+	}
+
+	sDone = true;
+	return false;
+}
+
+bool
+SimDone(void)
+{
+	return sDone;
+}
+
+static bool
+SimParseTime(const char *str, gint64 *ms)
+{
+	char *end = NULL;
+	gint64 value = g_ascii_strtoll(str, &end, 10);
+
+	if (end == str || value < 0)
+	{
+		return false;
+	}
+
+	if (!*end || !strcmp(end, "ms"))
+	{
+		*ms = value;
+	}
+	else if (!strcmp(end, "s"))
+	{
+		*ms = value * 1000;
+	}
+	else if (!strcmp(end, "m"))
+	{
+		*ms = value * 60 * 1000;
+	}
+	else if (!strcmp(end, "h"))
+	{
+		*ms = value * 60 * 60 * 1000;
+	}
+	else
+	{
+		return false;
+	}
+
+	return true;
+}
+
+static bool
+SimParseVote(const char *str, SimVote *vote)
+{
+	if (!strcmp(str, "ack"))
+	{
+		*vote = kSimVoteAck;
+	}
+	else if (!strcmp(str, "nack"))
+	{
+		*vote = kSimVoteNack;
+	}
+	else if (!strcmp(str, "silent"))
+	{
+		*vote = kSimVoteSilent;
+	}
+	else
+	{
+		return false;
+	}
+
+	return true;
+}
+
+static bool
+SimParseLine(gchar **words, gint64 at_ms)
+{
+	int count = g_strv_length(words);
+	const char *event = words[1];
+	gint64 ms = 0;
+	SimVote vote;
+
+	if (count == 3 && !strcmp(event, "display") &&
+	        (!strcmp(words[2], "on") || !strcmp(words[2], "off")))
+	{
+		SimSchedule(at_ms, kSimEventDisplay, NULL, !strcmp(words[2], "on"), 0);
+	}
+	else if (count == 5 && !strcmp(event, "activity") && !strcmp(words[2], "start") &&
+	         SimParseTime(words[4], &ms))
+	{
+		SimSchedule(at_ms, kSimEventActivityStart, words[3], ms, 0);
+	}
+	else if (count == 4 && !strcmp(event, "activity") && !strcmp(words[2], "stop"))
+	{
+		SimSchedule(at_ms, kSimEventActivityStop, words[3], 0, 0);
+	}
+	else if ((count == 4 || count == 5) && !strcmp(event, "client") &&
+	         SimParseVote(words[3], &vote))
+	{
+		ms = SIM_VOTE_DELAY_MS;
+
+		if (count == 5 && !SimParseTime(words[4], &ms))
+		{
+			return false;
+		}
+
+		SimSchedule(at_ms, kSimEventClient, words[2], vote, ms);
+	}
+	else if (count == 3 && !strcmp(event, "wake"))
+	{
+		SimSchedule(at_ms, kSimEventWake, words[2], 0, 0);
+	}
+	else if (count == 4 && !strcmp(event, "set"))
+	{
+		char *end = NULL;
+		int value = strtol(words[3], &end, 10);
+
+		if (!strcmp(words[3], "true") || !strcmp(words[3], "false"))
+		{
+			value = !strcmp(words[3], "true");
+		}
+		else if (end == words[3] || *end)
+		{
+			return false;
+		}
+
+		SimSchedule(at_ms, kSimEventSet, words[2], value, 0);
+	}
+	else if (count == 2 && !strcmp(event, "end"))
+	{
+		SimSchedule(at_ms, kSimEventEnd, NULL, 0, 0);
+	}
+	else
+	{
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * @brief Queue the events of a trace file.
+ */
+bool
+SimTraceLoad(const char *path, GError **error)
+{
+	gchar *contents = NULL;
+	gint64 at_ms = 0;
+	bool ended = false;
+	int i;
+
+	if (!g_file_get_contents(path, &contents, NULL, error))
+	{
+		return false;
+	}
+
+	gchar **lines = g_strsplit(contents, "\n", -1);
+
+	g_free(contents);
+
+	for (i = 0; lines[i] != NULL; i++)
+	{
+		gchar *comment = strchr(lines[i], '#');
+
+		if (comment)
+		{
+			*comment = '\0';
+		}
+
+		gchar **words = g_strsplit_set(g_strstrip(lines[i]), " \t", -1);
+		gchar **word = words;
+		gchar **kept = words;
+
+		// drop the empty words between repeated separators
+		for (; *word != NULL; word++)
+		{
+			if (**word)
+			{
+				*kept++ = *word;
+			}
+			else
+			{
+				g_free(*word);
+			}
+		}
+
+		*kept = NULL;
+
+		if (!words[0])
+		{
+			g_strfreev(words);
+			continue;
+		}
+
+		gint64 ms = 0;
+		bool relative = (words[0][0] == '+');
+
+		if (!words[1] || !SimParseTime(words[0] + relative, &ms) ||
+		        !SimParseLine(words, relative ? at_ms + ms : ms))
+		{
+			g_set_error(error, SIM_TRACE_ERROR, 0, "%s:%d: cannot parse \"%s\"", path,
+			            i + 1, lines[i]);
+			g_strfreev(words);
+			g_strfreev(lines);
+			return false;
+		}
+
+		at_ms = relative ? at_ms + ms : MAX(at_ms, ms);
+		ended = ended || !strcmp(words[1], "end");
+
+		g_strfreev(words);
+	}
+
+	g_strfreev(lines);
+
+	if (!ended)
+	{
+		SimSchedule(at_ms, kSimEventEnd, NULL, 0, 0);
+	}
+
+	return true;
+}
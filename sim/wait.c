@@ -0,0 +1,125 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2011-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+
+/**
+ * @file wait.c
+ *
+ * @brief Wait objects of powerd, for the single simulated thread. Waiting replays
+ * the trace until the object is signalled, by a client vote for instance, or the
+ * timeout expires in virtual time.
+ */
+
+#include <errno.h>
+
+#include "clock.h"
+#include "wait.h"
+#include "sim.h"
+
+static WaitObj *sWaiting = NULL;
+static bool sSignalled = false;
+
+void
+WaitObjectInit(WaitObj *obj)
+{
+	obj->locked = false;
+}
+
+void
+WaitObjectLock(WaitObj *obj)
+{
+	obj->locked = true;
+}
+
+void
+WaitObjectUnlock(WaitObj *obj)
+{
+	obj->locked = false;
+}
+
+bool
+WaitObjectIsLocked(WaitObj *obj)
+{
+	return obj->locked;
+}
+
+/**
+ * @retval 0 if signalled, ETIMEDOUT otherwise
+ */
+int
+WaitObjectWait(WaitObj *obj, int ms)
+{
+	sWaiting = obj;
+	sSignalled = false;
+
+	SimRunUntil(SimNowMs() + ms, &sSignalled);
+
+	sWaiting = NULL;
+
+	return sSignalled ? 0 : ETIMEDOUT;
+}
+
+int
+WaitObjectWaitTimeSpec(WaitObj *obj, struct timespec *delta)
+{
+	return WaitObjectWait(obj, ClockGetMs(delta));
+}
+
+int
+WaitObjectWaitAbsTime(WaitObj *obj, struct timespec *abstime)
+{
+	struct timespec now;
+	struct timespec delta;
+
+	ClockGetTime(&now);
+
+	if (!ClockTimeIsGreater(abstime, &now))
+	{
+		return ETIMEDOUT;
+	}
+
+	ClockDiff(&delta, abstime, &now);
+	return WaitObjectWaitTimeSpec(obj, &delta);
+}
+
+void
+WaitObjectSignalUnlocked(WaitObj *obj)
+{
+	if (obj == sWaiting)
+	{
+		sSignalled = true;
+	}
+}
+
+void
+WaitObjectSignal(WaitObj *obj)
+{
+	WaitObjectSignalUnlocked(obj);
+}
+
+void
+WaitObjectBroadcastUnlocked(WaitObj *obj)
+{
+	WaitObjectSignalUnlocked(obj);
+}
+
+void
+WaitObjectBroadcast(WaitObj *obj)
+{
+	WaitObjectSignalUnlocked(obj);
+}
@@ -28,6 +28,8 @@
 #include <stdbool.h>
 #include <time.h>
 #include <string.h>
+#include <stdio.h>
+#include <unistd.h>
 #include <luna-service2/lunaservice.h>
 
 #include <cjson/json.h>
@@ -44,6 +46,8 @@
 #include "timeout_alarm.h"
 #include "reference_time.h"
 #include "timesaver.h"
+#include "timesource.h"
+#include "init.h"
 
 #define LOG_DOMAIN "ALARM: "
 
@@ -113,6 +117,7 @@ bool alarm_queue_new(const char *key, bool calendar, time_t expiry,
 static bool alarm_write_db(void);
 static void notify_alarms(void);
 static void update_alarms(void);
+static void alarm_load(void);
 
 
 /**
@@ -165,6 +170,8 @@ alarmAdd(LSHandle *sh, LSMessage *message, void *ctx)
 	LSErrorInit(&lserror);
 	time_t rtctime = 0;
 
+	alarm_load();
+
 	object = json_tokener_parse(LSMessageGetPayload(message));
 
 	if (is_error(object))
@@ -196,7 +203,7 @@ alarmAdd(LSHandle *sh, LSMessage *message, void *ctx)
 		goto invalid_format;
 	}
 
-	nyx_system_query_rtc_time(GetNyxSystemDevice(), &rtctime);
+	TimeSourceGetRtc(&rtctime);
 
 	SLEEPDLOG_DEBUG("alarmAdd(): (%s %s %s) in %s (rtc %ld)", serviceName,
 	                applicationName, key, rel_time, rtctime);
@@ -344,6 +351,8 @@ alarmAddCalendar(LSHandle *sh, LSMessage *message, void *ctx)
 	LSError lserror;
 	LSErrorInit(&lserror);
 
+	alarm_load();
+
 	object = json_tokener_parse(LSMessageGetPayload(message));
 
 	if (is_error(object))
@@ -530,6 +539,8 @@ alarmQuery(LSHandle *sh, LSMessage *message, void *ctx)
 	GString *alarm_str = NULL;
 	GString *buf = NULL;
 
+	alarm_load();
+
 	object = json_tokener_parse(LSMessageGetPayload(message));
 
 	if (is_error(object))
@@ -642,6 +653,8 @@ alarmRemove(LSHandle *sh, LSMessage *message, void *ctx)
 	bool found = false;
 	bool retVal;
 
+	alarm_load();
+
 	const char *payload = LSMessageGetPayload(message);
 	struct json_object *object = json_tokener_parse(payload);
 
@@ -722,6 +735,7 @@ cleanup:
 static bool
 internalAlarmFired(LSHandle *sh, LSMessage *message, void *ctx)
 {
+	alarm_load();
 	update_alarms();
 	return true;
 }
@@ -790,12 +804,24 @@ alarm_print(_Alarm *a)
 	                a->id, buf);
 }
 
+/* alarms.xml, parsed ahead of alarm_init() by _alarm_db_load() */
+static xmlDocPtr sAlarmDbDoc = NULL;
+
+void alarm_db_unload(void);
+
 static void
 alarm_read_db(void)
 {
 	bool retVal;
 
-	xmlDocPtr db = xmlReadFile(gAlarmQueue->alarm_db, NULL, 0);
+	xmlDocPtr db = sAlarmDbDoc;
+
+	sAlarmDbDoc = NULL;
+
+	if (!db && g_file_test(gAlarmQueue->alarm_db, G_FILE_TEST_EXISTS))
+	{
+		db = xmlReadFile(gAlarmQueue->alarm_db, NULL, 0);
+	}
 
 	if (!db)
 	{
@@ -807,6 +833,7 @@ alarm_read_db(void)
 
 	if (!cur)
 	{
+		xmlFreeDoc(db);
 		return;
 	}
 
@@ -1015,6 +1042,12 @@ recalculate_alarms(time_t delta)
 void
 update_alarms_delta(time_t delta)
 {
+	/* Nothing to adjust until the legacy alarms are loaded */
+	if (!gAlarmQueue)
+	{
+		return;
+	}
+
 	/* If the time changed, we need to readjust alarms,
 	 * and persist the changes.
 	 */
@@ -1117,7 +1150,7 @@ fire_alarm(_Alarm *alarm)
 	gmtime_r(&alarm->expiry, &tm_alarm);
 	asctime_r(&tm_alarm, buf_alarm);
 
-	nyx_system_query_rtc_time(GetNyxSystemDevice(), &rtctime);
+	TimeSourceGetRtc(&rtctime);
 
 	SLEEPDLOG_DEBUG("fire_alarm() : Alarm (%s %s %s) fired at %s (rtc %ld)",
 	                alarm->serviceName,
@@ -1207,8 +1240,52 @@ notify_alarms(void)
 	}
 }
 
+static long
+alarm_resident_kb(void)
+{
+	gchar *statm = NULL;
+	long size = 0;
+	long resident = 0;
+
+	if (!g_file_get_contents("/proc/self/statm", &statm, NULL, NULL))
+	{
+		return 0;
+	}
+
+	sscanf(statm, "%ld %ld", &size, &resident);
+	g_free(statm);
+
+	return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+/**
+* @brief Create the alarm queue and load alarms.xml into it, the first time the
+* legacy alarms are needed. Logs the resident memory this takes, which is what
+* the builds without legacy alarms save.
+*/
+static void
+alarm_load(void)
+{
+	if (gAlarmQueue)
+	{
+		return;
+	}
+
+	long resident_kb = alarm_resident_kb();
+
+	alarm_queue_create();
+	alarm_read_db();
+
+	SLEEPDLOG_DEBUG("Loaded %d legacy alarms, resident memory +%ld kB",
+	                g_sequence_get_length(gAlarmQueue->alarms),
+	                alarm_resident_kb() - resident_kb);
+
+	update_alarms();
+}
+
 /**
-* @brief Init registers with bus and udev.
+* @brief Init registers with bus and udev. The alarms are only loaded now if some
+* were persisted, otherwise on the first /time call.
 *
 */
 int
@@ -1217,20 +1294,67 @@ alarm_init(void)
 	LSError lserror;
 	LSErrorInit(&lserror);
 
-	if (!LSRegisterCategory(GetLunaServiceHandle(),
-	                        "/time", time_methods, NULL, NULL, &lserror))
+	if (!LSRegisterCategoryNoted(GetLunaServiceHandle(),
+	                             "/time", time_methods, NULL, &lserror))
 	{
 		goto error;
 	}
 
-	alarm_queue_create();
-	alarm_read_db();
+	gchar *alarm_db = g_build_filename(gSleepConfig.preference_dir, "alarms.xml",
+	                                   NULL);
+
+	if (sAlarmDbDoc || g_file_test(alarm_db, G_FILE_TEST_EXISTS))
+	{
+		alarm_load();
+	}
+
+	g_free(alarm_db);
 
-	update_alarms();
 	return 0;
 error:
+	alarm_db_unload();
 	return -1;
 }
 
+/**
+* @brief Parse alarms.xml if there is one, off the main thread. The alarms are then
+* queued by alarm_init().
+*/
+static int
+_alarm_db_load(void)
+{
+	if (gSleepConfig.disable_rtc_alarms)
+	{
+		return 0;
+	}
+
+	gchar *alarm_db = g_build_filename(gSleepConfig.preference_dir, "alarms.xml",
+	                                   NULL);
+
+	if (g_file_test(alarm_db, G_FILE_TEST_EXISTS))
+	{
+		sAlarmDbDoc = xmlReadFile(alarm_db, NULL, 0);
+	}
+
+	g_free(alarm_db);
+	return 0;
+}
+
+/**
+* @brief Drop the alarms.xml parsed by _alarm_db_load() when alarm_init() is
+* not going to run, or failed before queueing it.
+*/
+void
+alarm_db_unload(void)
+{
+	if (sAlarmDbDoc)
+	{
+		xmlFreeDoc(sAlarmDbDoc);
+		sAlarmDbDoc = NULL;
+	}
+}
+
+INIT_FUNC_ASYNC("config_init", _alarm_db_load);
+
 /* @} END OF OldInterface */
 
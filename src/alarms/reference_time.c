@@ -25,6 +25,7 @@
  */
 
 #include "reference_time.h"
+#include "timesource.h"
 
 static time_t clock_to_reference = 0;
 static const time_t invalid_time = ((time_t) - 1);
@@ -41,7 +42,7 @@ static bool reference_gettime(time_t *ret_time)
 	 */
 	struct timespec ts;
 
-	if (clock_gettime(CLOCK_BOOTTIME, &ts) == -1)
+	if (TimeSourceGet(kTimeSourceBoottime, &ts) == -1)
 	{
 		return false;
 	}
@@ -55,7 +56,7 @@ time_t reference_time(void)
 {
 	time_t reftime;
 	return reference_gettime(&reftime) ? reftime
-	       : time(NULL);
+	       : TimeSourceNow();
 }
 
 time_t update_reference_time(bool (*callback)(time_t delta, void *user_data),
@@ -63,7 +64,7 @@ time_t update_reference_time(bool (*callback)(time_t delta, void *user_data),
 {
 	time_t systime, reftime, delta;
 
-	if (time(&systime) == invalid_time)
+	if ((systime = TimeSourceNow()) == invalid_time)
 	{
 		return invalid_time;
 	}
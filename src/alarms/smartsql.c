@@ -26,6 +26,7 @@
 
 #include <sqlite3.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <string.h>
 
 #include <glib.h>
@@ -33,18 +34,39 @@
 #include <luna-service2/lunaservice.h>
 
 #include "logging.h"
+#include "smartsql.h"
 
 #define LOG_DOMAIN "POWERD-SMARTSQL: "
 
+/*
+   Databases use write-ahead logging where sqlite supports it (3.7.0). Commits
+   then append to the log, synced only at checkpoints, which we run ourselves at
+   quiet moments (see smart_sql_checkpoint()) rather than sqlite automatically
+   in the middle of a commit.
+   */
+#define SMART_SQL_HAVE_WAL (SQLITE_VERSION_NUMBER >= 3007000)
+
+/* Salvage: give up on a table after this many damaged stretches */
+#define SMART_SQL_SALVAGE_MAX_SKIPS 32
+
+/* Background check: time spent per main loop slice, rows read per step */
+#define SMART_SQL_CHECK_SLICE_MS 10
+#define SMART_SQL_CHECK_ROWS 64
+
+/* Write accounting, reported at every checkpoint */
+static int sCommits = 0;
+static int sCheckpoints = 0;
+static int sFramesCheckpointed = 0;
+static int sWalPending = 0;
+
 /**
  * @addtogroup NewInterface
  * @{
  */
 
 static bool
-_check_integrity(sqlite3 *db)
+_check_integrity(sqlite3 *db, const char *cmd)
 {
-	const char *cmd = "PRAGMA integrity_check;";
 	int rc;
 
 	sqlite3_stmt *stmt;
@@ -105,6 +127,11 @@ smart_sql_exec(sqlite3 *db, const char *cmd)
 	sqlite3_stmt *stmt;
 	const char *tail;
 
+	if (!db)
+	{
+		return false;
+	}
+
 	rc = sqlite3_prepare_v2(db, cmd, -1, &stmt, &tail);
 
 	if (!stmt)
@@ -129,6 +156,134 @@ smart_sql_exec(sqlite3 *db, const char *cmd)
 }
 
 
+static int
+_commit_hook(void *data)
+{
+	g_atomic_int_inc(&sCommits);
+	return 0;
+}
+
+#if SMART_SQL_HAVE_WAL
+/* Replaces the automatic checkpoints sqlite would run from the commit */
+static int
+_wal_hook(void *data, sqlite3 *db, const char *name, int frames)
+{
+	g_atomic_int_set(&sWalPending, frames);
+	return SQLITE_OK;
+}
+#endif
+
+/**
+ * @brief Switch the database to write-ahead logging.
+ *
+ * @retval false if sqlite or the file system do not support it
+ */
+static bool
+_set_wal(sqlite3 *db)
+{
+#if SMART_SQL_HAVE_WAL
+	sqlite3_stmt *stmt = NULL;
+	bool wal = false;
+
+	if (sqlite3_prepare_v2(db, "PRAGMA journal_mode = WAL", -1, &stmt,
+	                       NULL) == SQLITE_OK &&
+	        sqlite3_step(stmt) == SQLITE_ROW)
+	{
+		const char *mode = (const char *)sqlite3_column_text(stmt, 0);
+		wal = (mode && g_ascii_strcasecmp(mode, "wal") == 0);
+	}
+
+	sqlite3_finalize(stmt);
+
+	if (wal)
+	{
+		sqlite3_wal_hook(db, _wal_hook, NULL);
+	}
+
+	return wal;
+#else
+	return false;
+#endif
+}
+
+/**
+ * @brief Bytes the process wrote to storage so far, or -1 if unknown.
+ */
+static long long
+_process_write_bytes(void)
+{
+	long long write_bytes = -1;
+	char line[64];
+	FILE *io = fopen("/proc/self/io", "r");
+
+	if (!io)
+	{
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), io))
+	{
+		if (sscanf(line, "write_bytes: %lld", &write_bytes) == 1)
+		{
+			break;
+		}
+	}
+
+	fclose(io);
+	return write_bytes;
+}
+
+/**
+ * @brief Number of WAL frames written since the last checkpoint.
+ */
+int
+smart_sql_wal_pending(void)
+{
+	return g_atomic_int_get(&sWalPending);
+}
+
+/**
+ * @brief Copy the WAL back into the database, if anything was written since the
+ * last checkpoint. Passive: never waits for readers or writers.
+ *
+ * @retval Number of frames checkpointed, or -1 on error
+ */
+int
+smart_sql_checkpoint(sqlite3 *db)
+{
+#if SMART_SQL_HAVE_WAL
+	int frames = g_atomic_int_get(&sWalPending);
+	int rc;
+
+	if (!db || !frames)
+	{
+		return 0;
+	}
+
+	rc = sqlite3_wal_checkpoint(db, NULL);
+
+	if (rc != SQLITE_OK)
+	{
+		SLEEPDLOG_WARNING(MSGID_WAL_CHECKPOINT_ERR, 1, PMLOGKFV(ERRCODE, "%d", rc),
+		                  "%s", sqlite3_errmsg(db));
+		return -1;
+	}
+
+	g_atomic_int_set(&sWalPending, 0);
+	g_atomic_int_inc(&sCheckpoints);
+	sFramesCheckpointed += frames;
+
+	SLEEPDLOG_DEBUG("checkpointed %d frames: %d commits, %d checkpoints, "
+	                "%d frames since start, %lld bytes written by the process",
+	                frames, g_atomic_int_get(&sCommits), g_atomic_int_get(&sCheckpoints),
+	                sFramesCheckpointed, _process_write_bytes());
+
+	return frames;
+#else
+	return 0;
+#endif
+}
+
 static sqlite3 *
 _open(const char *path)
 {
@@ -153,13 +308,26 @@ _open(const char *path)
 	// TODO might want to enable sqlite3_palm_extension.so for
 	// perf reasons.
 
-	// SyncOff
-	retVal = smart_sql_exec(db, "PRAGMA synchronous = 0");
+	sqlite3_commit_hook(db, _commit_hook, NULL);
+
+	if (_set_wal(db))
+	{
+		// With WAL, NORMAL only syncs at checkpoints and stays consistent on power loss
+		retVal = smart_sql_exec(db, "PRAGMA synchronous = NORMAL");
+	}
+	else
+	{
+		SLEEPDLOG_WARNING(MSGID_SET_WAL_ERR, 1, PMLOGKS(PATH, path),
+		                  "Keeping rollback journal");
+
+		// SyncOff
+		retVal = smart_sql_exec(db, "PRAGMA synchronous = 0");
+	}
 
 	if (!retVal)
 	{
 		SLEEPDLOG_WARNING(MSGID_SET_SYNCOFF_ERR, 2, PMLOGKS(CAUSE,
-		                  "Could not set syncoff on path"), PMLOGKS(PATH, path), "");
+		                  "Could not set synchronous mode on path"), PMLOGKS(PATH, path), "");
 	}
 
 	return db;
@@ -171,6 +339,513 @@ _close(sqlite3 *db)
 	sqlite3_close(db);
 }
 
+/**
+ * @brief Remove the rollback journal, or the write-ahead log and its index, of
+ * a database.
+ */
+static void
+_remove_journals(const char *path)
+{
+	static const char *journal_suffixes[] = { "-journal", "-wal", "-shm" };
+	int i;
+
+	for (i = 0; i < G_N_ELEMENTS(journal_suffixes); i++)
+	{
+		char *journal = g_strdup_printf("%s%s", path, journal_suffixes[i]);
+
+		if (remove(journal) != 0 && g_file_test(journal, G_FILE_TEST_EXISTS))
+		{
+			SLEEPDLOG_WARNING(MSGID_JOURNAL_REMOVE_ERR, 1, PMLOGKS("FileName", journal),
+			                  "Failed to remove corrupted db journal");
+		}
+
+		g_free(journal);
+	}
+}
+
+static bool
+_is_corruption(int rc)
+{
+	return rc == SQLITE_CORRUPT || rc == SQLITE_NOTADB;
+}
+
+/**
+ * @brief Row before which to start salvaging a table: just before its smallest
+ * rowid, or 0 if even that cannot be read, as rowids are positive unless given.
+ */
+static sqlite3_int64
+_salvage_table_start(sqlite3 *old, const char *table)
+{
+	sqlite3_stmt *st = NULL;
+	sqlite3_int64 start = 0;
+
+	char *sql = g_strdup_printf("SELECT min(rowid) FROM \"%s\"", table);
+
+	if (sqlite3_prepare_v2(old, sql, -1, &st, NULL) == SQLITE_OK &&
+	        sqlite3_step(st) == SQLITE_ROW &&
+	        sqlite3_column_type(st, 0) == SQLITE_INTEGER)
+	{
+		sqlite3_int64 min = sqlite3_column_int64(st, 0);
+
+		start = (min > G_MININT64) ? min - 1 : min;
+	}
+
+	sqlite3_finalize(st);
+	g_free(sql);
+
+	return start;
+}
+
+/**
+ * @brief Copy the readable rows of a table, one by one. When a read fails, resume
+ * further and further past the last good row, to skip the damaged pages.
+ *
+ * @retval Number of rows copied, or -1 if the table cannot be read at all
+ */
+static int
+_salvage_table(sqlite3 *old, sqlite3 *db, const char *table)
+{
+	sqlite3_stmt *select = NULL;
+	sqlite3_stmt *insert = NULL;
+	sqlite3_int64 last = _salvage_table_start(old, table);
+	sqlite3_int64 skip = 1;
+	int skips = 0;
+	int copied = 0;
+	int rc;
+	int i;
+
+	char *sql = g_strdup_printf("SELECT rowid,* FROM \"%s\" WHERE rowid>? ORDER BY rowid",
+	                            table);
+	rc = sqlite3_prepare_v2(old, sql, -1, &select, NULL);
+	g_free(sql);
+
+	if (rc != SQLITE_OK)
+	{
+		return -1;
+	}
+
+	int columns = sqlite3_column_count(select) - 1;
+	GString *insert_sql = g_string_new("");
+
+	g_string_printf(insert_sql, "INSERT INTO \"%s\" VALUES (", table);
+
+	for (i = 0; i < columns; i++)
+	{
+		g_string_append(insert_sql, i ? ",?" : "?");
+	}
+
+	g_string_append(insert_sql, ")");
+	rc = sqlite3_prepare_v2(db, insert_sql->str, -1, &insert, NULL);
+	g_string_free(insert_sql, TRUE);
+
+	if (rc != SQLITE_OK)
+	{
+		sqlite3_finalize(select);
+		return -1;
+	}
+
+	while (skips <= SMART_SQL_SALVAGE_MAX_SKIPS)
+	{
+		sqlite3_bind_int64(select, 1, last);
+
+		while ((rc = sqlite3_step(select)) == SQLITE_ROW)
+		{
+			last = sqlite3_column_int64(select, 0);
+
+			for (i = 0; i < columns; i++)
+			{
+				sqlite3_bind_value(insert, i + 1, sqlite3_column_value(select, i + 1));
+			}
+
+			if (sqlite3_step(insert) == SQLITE_DONE)
+			{
+				copied++;
+			}
+
+			sqlite3_reset(insert);
+		}
+
+		sqlite3_reset(select);
+
+		if (rc == SQLITE_DONE)
+		{
+			break;
+		}
+
+		// a damaged page: try again past it
+		last = (last > G_MAXINT64 - skip) ? G_MAXINT64 : last + skip;
+		skip *= 2;
+		skips++;
+	}
+
+	sqlite3_finalize(select);
+	sqlite3_finalize(insert);
+
+	return copied;
+}
+
+/**
+ * @brief Rebuild a corrupted database into a fresh file, keeping its schema,
+ * its user_version and every row that can still be read, and replace it.
+ * The database must be closed.
+ *
+ * @retval false if nothing could be salvaged; the database is left as is
+ */
+bool
+smart_sql_salvage(const char *path)
+{
+	sqlite3 *old = NULL;
+	sqlite3 *db = NULL;
+	sqlite3_stmt *st = NULL;
+	GPtrArray *indexes = g_ptr_array_new_with_free_func(g_free);
+	bool retVal = false;
+	int tables = 0;
+	int rows = 0;
+	int i;
+
+	char *salvage_path = g_strdup_printf("%s.salvage", path);
+
+	remove(salvage_path);
+
+	if (sqlite3_open_v2(path, &old, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK ||
+	        sqlite3_open(salvage_path, &db) != SQLITE_OK ||
+	        !smart_sql_exec(db, "BEGIN TRANSACTION"))
+	{
+		goto end;
+	}
+
+	/* Tables first, indexes once the rows are in */
+	if (sqlite3_prepare_v2(old,
+	                       "SELECT type,name,sql FROM sqlite_master "
+	                       "WHERE sql NOT NULL AND name NOT LIKE 'sqlite_%' "
+	                       "ORDER BY type='index'", -1, &st, NULL) != SQLITE_OK)
+	{
+		goto end;
+	}
+
+	while (sqlite3_step(st) == SQLITE_ROW)
+	{
+		const char *type = (const char *)sqlite3_column_text(st, 0);
+		const char *name = (const char *)sqlite3_column_text(st, 1);
+		const char *sql = (const char *)sqlite3_column_text(st, 2);
+
+		if (g_strcmp0(type, "table") == 0)
+		{
+			if (!smart_sql_exec(db, sql))
+			{
+				continue;
+			}
+
+			int copied = _salvage_table(old, db, name);
+
+			SLEEPDLOG_DEBUG("salvaged %d rows of %s", copied, name);
+
+			tables++;
+			rows += copied > 0 ? copied : 0;
+		}
+		else
+		{
+			g_ptr_array_add(indexes, g_strdup(sql));
+		}
+	}
+
+	sqlite3_finalize(st);
+	st = NULL;
+
+	if (!tables)
+	{
+		goto end;
+	}
+
+	for (i = 0; i < indexes->len; i++)
+	{
+		smart_sql_exec(db, g_ptr_array_index(indexes, i));
+	}
+
+	if (sqlite3_prepare_v2(old, "PRAGMA user_version", -1, &st,
+	                       NULL) == SQLITE_OK &&
+	        sqlite3_step(st) == SQLITE_ROW)
+	{
+		char *set_version = g_strdup_printf("PRAGMA user_version=%d",
+		                                    sqlite3_column_int(st, 0));
+		smart_sql_exec(db, set_version);
+		g_free(set_version);
+	}
+
+	retVal = smart_sql_exec(db, "COMMIT");
+
+end:
+	sqlite3_finalize(st);
+	sqlite3_close(old);
+	sqlite3_close(db);
+
+	if (retVal)
+	{
+		_remove_journals(path);
+		retVal = (rename(salvage_path, path) == 0);
+	}
+
+	if (retVal)
+	{
+		SLEEPDLOG_INFO(MSGID_DB_SALVAGED, 2, PMLOGKS(PATH, path),
+		               PMLOGKFV("ROWS", "%d", rows), "Salvaged corrupted db");
+	}
+	else
+	{
+		SLEEPDLOG_WARNING(MSGID_DB_SALVAGE_ERR, 1, PMLOGKS(PATH, path),
+		                  "Could not salvage corrupted db");
+		remove(salvage_path);
+	}
+
+	g_ptr_array_free(indexes, TRUE);
+	g_free(salvage_path);
+	return retVal;
+}
+
+/*
+   Background integrity check.
+
+   PRAGMA integrity_check cannot be paused, so the full check is replaced by
+   steps that can: walking every table by rowid a few rows at a time, reading
+   every column, then walking every index and comparing its entry count with
+   its table. Steps run from an idle source on the main loop until the time
+   budget of the slice is spent.
+   */
+typedef struct
+{
+	char *table;
+	char *index;            // NULL to walk the table itself
+} SmartSqlCheckStep;
+
+typedef struct
+{
+	sqlite3 *db;
+	SmartSqlCorruptFunc on_corrupt;
+	gpointer user_data;
+	GArray *steps;
+	guint step;
+	sqlite3_int64 last_rowid;
+	int rows;
+	gint64 start_time;
+} SmartSqlCheck;
+
+static void
+_check_free(gpointer data)
+{
+	SmartSqlCheck *check = (SmartSqlCheck *)data;
+	int i;
+
+	for (i = 0; i < check->steps->len; i++)
+	{
+		SmartSqlCheckStep *step = &g_array_index(check->steps, SmartSqlCheckStep, i);
+		g_free(step->table);
+		g_free(step->index);
+	}
+
+	g_array_free(check->steps, TRUE);
+	g_free(check);
+}
+
+static int
+_check_count(sqlite3 *db, const char *sql, int *count)
+{
+	sqlite3_stmt *st = NULL;
+	int rc = sqlite3_prepare_v2(db, sql, -1, &st, NULL);
+
+	if (rc == SQLITE_OK)
+	{
+		rc = sqlite3_step(st);
+
+		if (rc == SQLITE_ROW)
+		{
+			*count = sqlite3_column_int(st, 0);
+			rc = SQLITE_DONE;
+		}
+	}
+
+	sqlite3_finalize(st);
+	return rc;
+}
+
+/**
+ * @brief Run one unit of the current step.
+ *
+ * @retval SQLITE_ROW if the step has more to do, SQLITE_DONE when it is over,
+ *         SQLITE_CORRUPT if corruption was found, or another sqlite error
+ */
+static int
+_check_run(SmartSqlCheck *check, SmartSqlCheckStep *step)
+{
+	int rc;
+
+	if (step->index)
+	{
+		int index_count = 0;
+		int table_count = 0;
+		char *sql = g_strdup_printf("SELECT count(*) FROM \"%s\" INDEXED BY \"%s\"",
+		                            step->table, step->index);
+
+		rc = _check_count(check->db, sql, &index_count);
+		g_free(sql);
+
+		if (rc == SQLITE_DONE)
+		{
+			sql = g_strdup_printf("SELECT count(*) FROM \"%s\" NOT INDEXED", step->table);
+			rc = _check_count(check->db, sql, &table_count);
+			g_free(sql);
+		}
+
+		if (rc == SQLITE_DONE && index_count != table_count)
+		{
+			SLEEPDLOG_DEBUG("index %s has %d entries for %d rows", step->index,
+			                index_count, table_count);
+			rc = SQLITE_CORRUPT;
+		}
+
+		return rc;
+	}
+
+	sqlite3_stmt *st = NULL;
+	int rows = 0;
+	int i;
+	char *sql = g_strdup_printf("SELECT rowid,* FROM \"%s\" WHERE rowid>? "
+	                            "ORDER BY rowid LIMIT %d", step->table, SMART_SQL_CHECK_ROWS);
+
+	rc = sqlite3_prepare_v2(check->db, sql, -1, &st, NULL);
+	g_free(sql);
+
+	if (rc != SQLITE_OK)
+	{
+		return rc;
+	}
+
+	sqlite3_bind_int64(st, 1, check->last_rowid);
+
+	while ((rc = sqlite3_step(st)) == SQLITE_ROW)
+	{
+		check->last_rowid = sqlite3_column_int64(st, 0);
+
+		// loads every column, including overflow pages
+		for (i = 1; i < sqlite3_column_count(st); i++)
+		{
+			sqlite3_column_bytes(st, i);
+		}
+
+		rows++;
+	}
+
+	sqlite3_finalize(st);
+
+	if (rc != SQLITE_DONE)
+	{
+		return rc;
+	}
+
+	check->rows += rows;
+	return rows < SMART_SQL_CHECK_ROWS ? SQLITE_DONE : SQLITE_ROW;
+}
+
+static gboolean
+_check_slice(gpointer data)
+{
+	SmartSqlCheck *check = (SmartSqlCheck *)data;
+	gint64 slice_end = g_get_monotonic_time() + SMART_SQL_CHECK_SLICE_MS * 1000;
+
+	do
+	{
+		if (check->step >= check->steps->len)
+		{
+			SLEEPDLOG_DEBUG("integrity check passed: %d rows, %d steps in %lld ms",
+			                check->rows, check->steps->len,
+			                (long long)(g_get_monotonic_time() - check->start_time) / 1000);
+			return FALSE;
+		}
+
+		SmartSqlCheckStep *step = &g_array_index(check->steps, SmartSqlCheckStep,
+		                          check->step);
+		int rc = _check_run(check, step);
+
+		if (rc == SQLITE_DONE)
+		{
+			check->step++;
+			check->last_rowid = G_MININT64;
+		}
+		else if (rc != SQLITE_ROW)
+		{
+			if (_is_corruption(rc))
+			{
+				SLEEPDLOG_WARNING(MSGID_INTEGRITY_CHK_FAIL, 2, PMLOGKS(CAUSE, "Db corrupted"),
+				                  PMLOGKS("Table", step->index ? step->index : step->table),
+				                  "Integrity check failed");
+				check->on_corrupt(check->db, check->user_data);
+			}
+			else
+			{
+				SLEEPDLOG_DEBUG("integrity check stopped: %s", sqlite3_errmsg(check->db));
+			}
+
+			return FALSE;
+		}
+	}
+	while (g_get_monotonic_time() < slice_end);
+
+	return TRUE;
+}
+
+/**
+ * @brief Start checking the integrity of a database in the background, from the
+ * default main context, a few milliseconds at a time.
+ *
+ * on_corrupt is called from the main loop if corruption is found; the check
+ * then stops. The database must stay open until the check completes, or
+ * until the returned source is removed.
+ *
+ * @retval Source id of the check
+ */
+guint
+smart_sql_check_start(sqlite3 *db, SmartSqlCorruptFunc on_corrupt,
+                      gpointer user_data)
+{
+	sqlite3_stmt *st = NULL;
+	SmartSqlCheck *check = g_new0(SmartSqlCheck, 1);
+
+	check->db = db;
+	check->on_corrupt = on_corrupt;
+	check->user_data = user_data;
+	check->steps = g_array_new(FALSE, FALSE, sizeof(SmartSqlCheckStep));
+	check->last_rowid = G_MININT64;
+	check->start_time = g_get_monotonic_time();
+
+	/*
+	   Each table, followed by its indexes. Partial indexes do not cover every
+	   row, so their count cannot be compared.
+	   */
+	if (sqlite3_prepare_v2(db,
+	                       "SELECT tbl_name, CASE WHEN type='index' THEN name END FROM sqlite_master "
+	                       "WHERE (type='table' AND name NOT LIKE 'sqlite_%') OR "
+	                       "(type='index' AND (sql IS NULL OR sql NOT LIKE '% WHERE %')) "
+	                       "ORDER BY tbl_name, type='index'", -1, &st, NULL) == SQLITE_OK)
+	{
+		while (sqlite3_step(st) == SQLITE_ROW)
+		{
+			SmartSqlCheckStep step;
+
+			step.table = g_strdup((const char *)sqlite3_column_text(st, 0));
+			step.index = g_strdup((const char *)sqlite3_column_text(st, 1));
+			g_array_append_val(check->steps, step);
+		}
+	}
+
+	sqlite3_finalize(st);
+
+	return g_idle_add_full(G_PRIORITY_LOW, _check_slice, check, _check_free);
+}
+
+/**
+ * @brief Open a database, after a quick check of its integrity. A corrupted
+ * database is salvaged, or recreated empty if it cannot be. The full check
+ * runs later, in the background (see smart_sql_check_start()).
+ */
 bool
 smart_sql_open(const char *path, sqlite3 **ret_db)
 {
@@ -183,7 +858,7 @@ smart_sql_open(const char *path, sqlite3 **ret_db)
 		return false;
 	}
 
-	retVal = _check_integrity(db);
+	retVal = _check_integrity(db, "PRAGMA quick_check;");
 
 	if (!retVal)
 	{
@@ -192,23 +867,15 @@ smart_sql_open(const char *path, sqlite3 **ret_db)
 
 		_close(db);
 
-		char *journal = g_strdup_printf("%s-journal", path);
-
-		if (journal != NULL)
+		if (!smart_sql_salvage(path))
 		{
-			if (remove(journal) != 0)
+			_remove_journals(path);
+
+			if (remove(path) != 0)
 			{
-				SLEEPDLOG_WARNING(MSGID_JOURNAL_REMOVE_ERR, 1, PMLOGKS("FileName", journal),
-				                "Failed to remove corrupted db journal");
+				SLEEPDLOG_WARNING(MSGID_DB_REMOVE_ERR, 1, PMLOGKS("FileName", path),
+				                  "Failed to remove corrupted db file");
 			}
-
-			g_free(journal);
-		}
-
-		if (remove(path) != 0)
-		{
-			SLEEPDLOG_WARNING(MSGID_DB_REMOVE_ERR, 1, PMLOGKS("FileName", path),
-			                    "Failed to remove corrupted db file");
 		}
 
 		db = _open(path);
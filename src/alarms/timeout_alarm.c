@@ -28,8 +28,10 @@
 #include <time.h>
 #include <glib.h>
 #include <stdlib.h>
+#include <stdio.h>
 #include <string.h>
 #include <stdbool.h>
+#include <pthread.h>
 #include <cjson/json.h>
 #include <sys/stat.h>
 #include <luna-service2/lunaservice.h>
@@ -47,6 +49,7 @@
 #include "config.h"
 #include "init.h"
 #include "timesaver.h"
+#include "timesource.h"
 
 #define LOG_DOMAIN "ALARMS-TIMEOUT: "
 
@@ -70,11 +73,29 @@
 
 #define STD_ASCTIME_BUF_SIZE    26
 
-// This allows testing the SQL commands to add the new columns. Set to false for production code
-#define CREATE_DB_WITHOUT_ACTIVITY_COLUMNS 0
-
 #define TIMEOUT_DATABASE_NAME "SysTimeouts.db"
 
+// Max delay a caller can allow for a wakeup timeout with "window_s", and max
+// advance for a non-wakeup timeout with "early_s".
+#define TIMEOUT_MAX_WINDOW_SEC (24*60*60)
+
+// Most timeouts set or cleared by one timeout/setBatch or timeout/clearBatch.
+#define TIMEOUT_BATCH_MAX 256
+
+// Page size of timeout/query, by default and at most.
+#define TIMEOUT_QUERY_DEFAULT 50
+#define TIMEOUT_QUERY_MAX 500
+
+// Quiet time after a write before the timeout database is checkpointed.
+#define TIMEOUT_CHECKPOINT_IDLE_SECS 30
+
+// Shortest period of a recurring timeout.
+#define TIMEOUT_MINIMUM_PERIOD_SEC 60
+
+// Longest interval of the non-wakeup timer: far timeouts are re-checked at
+// this pace, which also catches up with wall clock corrections.
+#define TIMEOUT_TIMER_MAX_SECS (60*60)
+
 typedef enum
 {
     AlarmTimeoutRelative,
@@ -83,9 +104,47 @@ typedef enum
 
 static LSPalmService *psh = NULL;
 static sqlite3 *timeout_db = NULL;
+
+/*
+   Held by _timeout_db_corrupt() while it replaces timeout_db, and by the entry
+   points the suspend thread calls, which find timeout_db NULL if it failed.
+   */
+static pthread_mutex_t sTimeoutDbMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static gchar *sTimeoutDbName = NULL;
 static GTimerSource *sTimerCheck = NULL;
+static guint sCheckpointSource = 0;
 static time_t invalid_time = (time_t) - 1;
 
+/*
+   Earliest expiry in the database, cached by _queue_next_timeout() so that
+   on resume we can tell without touching the database whether any timeout
+   could have expired while the device was asleep.
+   */
+static bool sNextExpiryKnown = false;
+static bool sHaveTimeouts = false;
+static time_t sNextExpiry = 0;
+
+/*
+   Earliest time a timeout can fire on a wake: sNextExpiry, or earlier for a
+   non-wakeup timeout with an early_s (see _expire_timeouts()).
+   */
+static time_t sNextOnWake = 0;
+
+/*
+   Wakeup timeout the RTC alarm was last armed for by _queue_next_wakeup(). The
+   suspend thread reads it to classify a wake while the main thread may re-arm.
+   */
+static pthread_mutex_t sWakeupArmedMutex = PTHREAD_MUTEX_INITIALIZER;
+static bool sWakeupArmed = false;
+static time_t sWakeupArmedExpiry = 0;
+static gchar *sWakeupArmedAppId = NULL;
+static gchar *sWakeupArmedKey = NULL;
+static int sWakeupArmedCoalesced = 0;
+
+// An RTC wakeup may be reported slightly ahead of the reference clock.
+#define WAKEUP_DUE_TOLERANCE_SECS 2
+
 /*
    Database Schema.
 
@@ -95,9 +154,13 @@ static time_t invalid_time = (time_t) - 1;
 
    expiry is the absolute system time of when the next event is to be
    fired. It is GMT, so all math performed with it needs to be in GMT
-   as well.
+   as well. deadline is expiry + window_s, the latest time a wakeup
+   timeout can fire.
+
+   Databases are created with the first released schema, and brought up to
+   date by the migrations in kTimeoutMigrations, whatever version they were
+   left at.
    */
-#if CREATE_DB_WITHOUT_ACTIVITY_COLUMNS
 static const char *kSysTimeoutDatabaseCreateSchema = "\
 CREATE TABLE IF NOT EXISTS AlarmTimeout (t1key INTEGER PRIMARY KEY,\
                                          app_id TEXT,\
@@ -108,20 +171,6 @@ CREATE TABLE IF NOT EXISTS AlarmTimeout (t1key INTEGER PRIMARY KEY,\
                                          wakeup   INTEGER,\
                                          calendar INTEGER,\
                                          expiry DATE);";
-#else
-static const char *kSysTimeoutDatabaseCreateSchema = "\
-CREATE TABLE IF NOT EXISTS AlarmTimeout (t1key INTEGER PRIMARY KEY,\
-                                         app_id TEXT,\
-                                         key TEXT,\
-                                         uri TEXT,\
-                                         params TEXT,\
-                                         public_bus INTEGER,\
-                                         wakeup   INTEGER,\
-                                         calendar INTEGER,\
-                                         expiry DATE,\
-                                         activity_id TEXT,\
-                                         activity_duration_ms INTEGER);";
-#endif
 
 static const char *kSysTimeoutDatabaseCreateIndex = "\
 CREATE INDEX IF NOT EXISTS expiry_index on AlarmTimeout (expiry);";
@@ -150,7 +199,7 @@ _print_timeout(const char *message, const char *app_id, const char *key,
 	                message, app_id, key, public_bus ? "public" : "private", expiry, buf);
 }
 
-static void _update_timeouts(void);
+static void _update_timeouts_delta(time_t delta, bool on_wake);
 
 /**
 * @brief Called when a new alarm from the RTC is fired.
@@ -158,7 +207,7 @@ static void _update_timeouts(void);
 static void _rtc_alarm_fired(nyx_device_handle_t handle,
                              nyx_callback_status_t status, void *data)
 {
-	_update_timeouts();
+	_update_timeouts_delta(update_reference_time(NULL, NULL), true);
 }
 
 
@@ -279,28 +328,148 @@ _timeout_fire(_AlarmTimeout *timeout)
 	g_string_free(payload, TRUE);
 }
 
-bool _sql_step_finalize(const char *func, sqlite3_stmt *st)
+/*
+   Statements run on every timeout operation from the main loop, prepared
+   once and reused with new bindings.
+   */
+typedef enum
 {
-	int rc;
+	kTimeoutStmtRead,
+	kTimeoutStmtInsert,
+	kTimeoutStmtDelete,
+	kTimeoutStmtDeleteId,
+	kTimeoutStmtUpdateExpiry,
+	kTimeoutStmtSelectExpired,
+	kTimeoutStmtSelectRelative,
+	kTimeoutStmtCountCoalesced,
+	kTimeoutStmtLast
+} TimeoutStmt;
+
+static const char *kTimeoutStmtSql[kTimeoutStmtLast] =
+{
+	[kTimeoutStmtRead] =
+	"SELECT t1key,app_id,key,uri,params,public_bus,wakeup,calendar,expiry,"
+	"activity_id,activity_duration_ms,window_s,period_s,early_s FROM AlarmTimeout "
+	"WHERE app_id=$1 AND key=$2 AND public_bus=$3",
+
+	[kTimeoutStmtInsert] =
+	"INSERT OR REPLACE INTO AlarmTimeout (app_id,key,uri,params,public_bus,wakeup,calendar,expiry,"
+	"activity_id,activity_duration_ms,window_s,period_s,deadline,early_s) "
+	"VALUES ( $1, $2, $3, $4, $5, $6, $7, $8, $9, $10, $11, $12, $8+$11, $13 )",
+
+	[kTimeoutStmtDelete] =
+	"DELETE FROM AlarmTimeout WHERE app_id=$1 AND key=$2 AND public_bus=$3",
+
+	[kTimeoutStmtDeleteId] =
+	"DELETE FROM AlarmTimeout WHERE t1key=$1",
+
+	[kTimeoutStmtUpdateExpiry] =
+	"UPDATE AlarmTimeout SET expiry=$1,deadline=$1+IFNULL(window_s,0) WHERE t1key=$2",
+
+	[kTimeoutStmtSelectExpired] =
+	"SELECT t1key,app_id,key,uri,params,public_bus,activity_id,activity_duration_ms,"
+	"expiry,period_s FROM AlarmTimeout "
+	"WHERE expiry<=$1 OR ($2 AND wakeup=0 AND early_s>0 AND expiry-early_s<=$1) "
+	"ORDER BY expiry",
+
+	[kTimeoutStmtSelectRelative] =
+	"SELECT t1key,expiry FROM AlarmTimeout WHERE calendar=0",
+
+	[kTimeoutStmtCountCoalesced] =
+	"SELECT COUNT(DISTINCT expiry) FROM AlarmTimeout WHERE wakeup=1 AND expiry<=$1",
+};
+
+static sqlite3_stmt *sTimeoutStmts[kTimeoutStmtLast];
+
+/**
+* @brief Get a prepared statement from the cache, ready to be bound.
+*
+* @retval NULL if the statement cannot be prepared, or the database could not be
+* reopened after a corruption
+*/
+static sqlite3_stmt *
+_timeout_stmt(TimeoutStmt which)
+{
+	if (!timeout_db)
+	{
+		return NULL;
+	}
+
+	if (!sTimeoutStmts[which])
+	{
+		int rc = sqlite3_prepare_v2(timeout_db, kTimeoutStmtSql[which], -1,
+		                            &sTimeoutStmts[which], NULL);
+
+		if (rc != SQLITE_OK)
+		{
+			SLEEPDLOG_WARNING(MSGID_SQLITE_PREPARE_FAIL, 1, PMLOGKFV(ERRCODE, "%d", rc),
+			                  "%s", sqlite3_errmsg(timeout_db));
+			sTimeoutStmts[which] = NULL;
+			return NULL;
+		}
+	}
+
+	return sTimeoutStmts[which];
+}
 
-	rc = sqlite3_step(st);
+/**
+* @brief Make a cached statement ready for its next use, releasing its bindings.
+*/
+static void
+_timeout_stmt_reset(sqlite3_stmt *st)
+{
+	sqlite3_reset(st);
+	sqlite3_clear_bindings(st);
+}
+
+/**
+* @brief Run a cached statement which returns no rows, and reset it.
+*/
+static bool
+_timeout_stmt_step(const char *func, sqlite3_stmt *st)
+{
+	int rc = sqlite3_step(st);
+
+	_timeout_stmt_reset(st);
 
 	if (rc != SQLITE_DONE)
 	{
-		SLEEPDLOG_WARNING(MSGID_SQLITE_STEP_FAIL, 1, PMLOGKFV(ERRCODE, "%d", rc), "");
+		SLEEPDLOG_WARNING(MSGID_SQLITE_STEP_FAIL, 1, PMLOGKFV(ERRCODE, "%d", rc),
+		                  "%s", func);
 		return false;
 	}
 
-	rc = sqlite3_finalize(st);
+	return true;
+}
 
-	if (rc != SQLITE_OK)
+/**
+* @brief Duplicate a text column, or return a copy of fallback if it is NULL.
+*/
+static char *
+_column_strdup(sqlite3_stmt *st, int column, const char *fallback)
+{
+	const char *text = (const char *)sqlite3_column_text(st, column);
+
+	return g_strdup(text ? text : fallback);
+}
+
+/**
+* @brief Set the expiry of the timeout with the given row id.
+*/
+static bool
+_timeout_update_expiry(sqlite3_int64 table_id, time_t expiry)
+{
+	sqlite3_stmt *st = _timeout_stmt(kTimeoutStmtUpdateExpiry);
+
+	if (!st)
 	{
-		SLEEPDLOG_WARNING(MSGID_SQLITE_FINALIZE_FAIL, 1, PMLOGKFV(ERRCODE, "%d", rc),
-		                  "");
+		SLEEPDLOG_WARNING(MSGID_UPDATE_EXPIRY_FAIL, 0, "cannot update expiry");
 		return false;
 	}
 
-	return true;
+	sqlite3_bind_int64(st, 1, expiry);
+	sqlite3_bind_int64(st, 2, table_id);
+	return _timeout_stmt_step(__func__, st);
 }
 
 /**
@@ -315,149 +484,190 @@ _recalculate_timeouts(time_t delta)
 
 	if (delta)
 	{
-
 		int rc;
-		char **table;
-		int noRows, noCols;
-		char *zErrMsg;
+		GArray *ids;
+		GArray *expiries;
 		int i;
 
 		/* Find all relative (non-calendar alarms) */
-		const char *sqlquery =
-		    "SELECT t1key,expiry FROM AlarmTimeout WHERE calendar=0";
+		sqlite3_stmt *st = _timeout_stmt(kTimeoutStmtSelectRelative);
 
-		rc = sqlite3_get_table(timeout_db, sqlquery,
-		                       &table, &noRows, &noCols, &zErrMsg);
-
-		if (SQLITE_OK != rc)
+		if (!st)
 		{
-			SLEEPDLOG_WARNING(MSGID_EXPIRY_SELECT_FAIL, 2, PMLOGKS(ERRTEXT, zErrMsg),
-			                  PMLOGKFV(ERRCODE, "%d", rc), "");
-			sqlite3_free(zErrMsg);
 			return;
 		}
 
-		int base = 0;
+		ids = g_array_new(FALSE, FALSE, sizeof(sqlite3_int64));
+		expiries = g_array_new(FALSE, FALSE, sizeof(time_t));
 
-		for (i = 0; i < noRows; i++)
+		while ((rc = sqlite3_step(st)) == SQLITE_ROW)
 		{
+			sqlite3_int64 table_id = sqlite3_column_int64(st, 0);
+			time_t new_expiry = sqlite3_column_int64(st, 1) + delta;
 
-			base += noCols;
-			const char *table_id = table[base];
-			const char *expiry = table[base + 1];
+			g_array_append_val(ids, table_id);
+			g_array_append_val(expiries, new_expiry);
+		}
 
-			time_t new_expiry = atoi(expiry) + delta;
+		_timeout_stmt_reset(st);
 
-			/* Delete the timeout.*/
-			sqlite3_stmt *st = NULL;
-			const char *tail;
-			rc = sqlite3_prepare_v2(timeout_db,
-			                        "UPDATE AlarmTimeout SET expiry=$1 WHERE t1key=$2",
-			                        -1, &st, &tail);
+		if (rc != SQLITE_DONE)
+		{
+			SLEEPDLOG_WARNING(MSGID_EXPIRY_SELECT_FAIL, 2,
+			                  PMLOGKS(ERRTEXT, sqlite3_errmsg(timeout_db)),
+			                  PMLOGKFV(ERRCODE, "%d", rc), "");
+		}
 
-			if (rc != SQLITE_OK)
-			{
-				SLEEPDLOG_WARNING(MSGID_UPDATE_EXPIRY_FAIL, 0, "cannot update expiry");
-			}
-			else
-			{
-				rc = sqlite3_bind_int(st, 1, new_expiry);
-				rc = sqlite3_bind_int(st, 2, atoi(table_id));
-				_sql_step_finalize(__func__, st);
-			}
+		/* Update once the select is done, not while walking it. */
+		for (i = 0; i < ids->len; i++)
+		{
+			_timeout_update_expiry(g_array_index(ids, sqlite3_int64, i),
+			                       g_array_index(expiries, time_t, i));
 		}
 
-		sqlite3_free_table(table);
+		g_array_free(ids, TRUE);
+		g_array_free(expiries, TRUE);
+	}
+}
+
+/**
+* @brief Move a recurring timeout which just fired to its next occurrence.
+*
+* Occurrences are counted from the first expiry rather than from the time the
+* timeout fired, so that they do not drift; those missed while the device
+* slept are skipped.
+*/
+static void
+_timeout_reschedule(sqlite3_int64 table_id, time_t expiry, int period_s,
+                    time_t now)
+{
+	time_t next = expiry + period_s;
+
+	if (now >= expiry)
+	{
+		next = expiry + ((now - expiry) / period_s + 1) * period_s;
 	}
+
+	_timeout_update_expiry(table_id, next);
 }
 
 /**
-* @brief Trigger all expired timeouts.
+* @brief Fire the expired timeouts.
+*
+* @param  on_wake  The device just woke up: also fire the non-wakeup timeouts
+*                  which accept, with their early_s, to fire that much early,
+*                  rather than keep the device awake later on their own.
 */
 static void
-_expire_timeouts(void)
+_expire_timeouts(bool on_wake)
 {
 	int rc;
-	char **table;
-	int noRows, noCols;
-	char *zErrMsg;
 	int i;
 	time_t now;
-	int base;
 	_AlarmTimeout timeout;
+	GArray *fired;
 
-	now = reference_time();
-
-	/* Find all expired calendar timeouts */
-	char *sqlquery = g_strdup_printf(
-	                     "SELECT t1key,app_id,key,uri,params,public_bus,activity_id,activity_duration_ms FROM AlarmTimeout "
-	                     "WHERE expiry<=%ld ORDER BY expiry", now);
+	typedef struct
+	{
+		sqlite3_int64 table_id;
+		time_t expiry;
+		int period_s;
+	} FiredTimeout;
 
-	rc = sqlite3_get_table(timeout_db, sqlquery,
-	                       &table, &noRows, &noCols, &zErrMsg);
+	now = reference_time();
 
-	g_free(sqlquery);
+	/* Find all expired timeouts, and on a wake the non-wakeup ones within their window */
+	sqlite3_stmt *st = _timeout_stmt(kTimeoutStmtSelectExpired);
 
-	if (SQLITE_OK != rc)
+	if (!st)
 	{
-		SLEEPDLOG_WARNING(MSGID_SELECT_EXPIRED_TIMEOUT, 2, PMLOGKS(ERRTEXT, zErrMsg),
-		                  PMLOGKFV(ERRCODE, "%d", rc), "");
-		sqlite3_free(zErrMsg);
 		return;
 	}
 
-	for (i = 0, base = 0; i < noRows; i++)
+	sqlite3_bind_int64(st, 1, now);
+	sqlite3_bind_int(st, 2, on_wake);
+
+	fired = g_array_new(FALSE, FALSE, sizeof(FiredTimeout));
+
+	while ((rc = sqlite3_step(st)) == SQLITE_ROW)
 	{
+		FiredTimeout row;
 
-		base += noCols;
+		row.table_id = sqlite3_column_int64(st, 0);
+		row.expiry = sqlite3_column_int64(st, 8);
+		row.period_s = sqlite3_column_int(st, 9);
 
-		timeout.table_id = table[base];
-		timeout.app_id = table[base + 1];
-		timeout.key = table[base + 2];
-		timeout.uri = table[base + 3];
-		timeout.params = table[base + 4];
-		timeout.public_bus = atoi(table[base + 5]);
+		/* The column texts remain valid until the next step. */
+		memset(&timeout, 0, sizeof(timeout));
+		timeout.table_id = (const char *)sqlite3_column_text(st, 0);
+		timeout.app_id = (const char *)sqlite3_column_text(st, 1);
+		timeout.key = (const char *)sqlite3_column_text(st, 2);
+		timeout.uri = (const char *)sqlite3_column_text(st, 3);
+		timeout.params = (const char *)sqlite3_column_text(st, 4);
+		timeout.public_bus = sqlite3_column_int(st, 5);
 
 		/*
 		  If we have an upgraded db where the activity_id and activity_duration_ms columns were
 		  added and there were existing rows then these two fields will return NULL.
 		*/
-		if (!table[base + 6] || !table[base + 7])
+		if (sqlite3_column_type(st, 6) == SQLITE_NULL ||
+		        sqlite3_column_type(st, 7) == SQLITE_NULL)
 		{
 			SLEEPDLOG_DEBUG("null activity_id or activity_duration_ms fields for \"%s\":\"%s\"",
 			                timeout.app_id, timeout.key);
 		}
 
-		timeout.activity_id =
-		    table[base + 6]; // _timeout_fire can handle a null activity_id
-		timeout.activity_duration_ms = table[base + 7] ? atoi(table[base + 7]) :
-		                               0; // _timeout_fire will fill-in the default duration
+		// _timeout_fire can handle a null activity_id, and fills in the default duration
+		timeout.activity_id = (const char *)sqlite3_column_text(st, 6);
+		timeout.activity_duration_ms = sqlite3_column_int(st, 7);
 
 		/* Fire timeout */
 		_timeout_fire(&timeout);
 
-		/* Delete the timeout.*/
-		sqlite3_stmt *st = NULL;
-		const char *tail;
-		rc = sqlite3_prepare_v2(timeout_db,
-		                        "DELETE FROM AlarmTimeout WHERE t1key=$1", -1, &st, &tail);
+		g_array_append_val(fired, row);
+	}
+
+	_timeout_stmt_reset(st);
+
+	if (rc != SQLITE_DONE)
+	{
+		SLEEPDLOG_WARNING(MSGID_SELECT_EXPIRED_TIMEOUT, 2,
+		                  PMLOGKS(ERRTEXT, sqlite3_errmsg(timeout_db)),
+		                  PMLOGKFV(ERRCODE, "%d", rc), "");
+	}
+
+	if (on_wake && fired->len)
+	{
+		SLEEPDLOG_DEBUG("fired %d timeouts on wake", fired->len);
+	}
+
+	/* Delete or reschedule the fired timeouts once the select is done. */
+	for (i = 0; i < fired->len; i++)
+	{
+		FiredTimeout *row = &g_array_index(fired, FiredTimeout, i);
 
-		if (rc == SQLITE_OK)
+		if (row->period_s > 0)
 		{
-			rc = sqlite3_bind_int(st, 1, atoi(timeout.table_id));
-			_sql_step_finalize(__func__, st);
+			_timeout_reschedule(row->table_id, row->expiry, row->period_s, now);
+			continue;
 		}
-		else
+
+		st = _timeout_stmt(kTimeoutStmtDeleteId);
+
+		if (st)
 		{
-			SLEEPDLOG_WARNING(MSGID_SQLITE_PREPARE_FAIL, 1, PMLOGKFV(ERRCODE, "%d", rc),
-			                  "");
+			sqlite3_bind_int64(st, 1, row->table_id);
+			_timeout_stmt_step(__func__, st);
 		}
 	}
 
-	sqlite3_free_table(table);
+	g_array_free(fired, TRUE);
 }
 
-
+/**
+ * @brief Get the next time the device has to wake up for a timeout: the earliest
+ * deadline (expiry + window_s) of all wakeup timeouts, and the timeout it is for.
+ */
 bool
 timeout_get_next_wakeup(time_t *expiry, gchar **app_id, gchar **key)
 {
@@ -471,9 +681,19 @@ timeout_get_next_wakeup(time_t *expiry, gchar **app_id, gchar **key)
 	char *zErrMsg;
 	int rc;
 
+	pthread_mutex_lock(&sTimeoutDbMutex);
+
+	if (!timeout_db)
+	{
+		pthread_mutex_unlock(&sTimeoutDbMutex);
+		return false;
+	}
+
 	rc = sqlite3_get_table(timeout_db,
-	                       "SELECT expiry, app_id, key FROM AlarmTimeout "
-	                       "WHERE wakeup=1 ORDER BY expiry LIMIT 1", &table, &noRows, &noCols, &zErrMsg);
+	                       "SELECT deadline, app_id, key FROM AlarmTimeout "
+	                       "WHERE wakeup=1 ORDER BY deadline LIMIT 1", &table, &noRows, &noCols, &zErrMsg);
+
+	pthread_mutex_unlock(&sTimeoutDbMutex);
 
 	if (rc != SQLITE_OK)
 	{
@@ -497,20 +717,43 @@ timeout_get_next_wakeup(time_t *expiry, gchar **app_id, gchar **key)
 }
 
 /**
- * @brief Queues a RTC alarm for wakeup timeouts
- *
- * Should be called before suspending
- *
- * @param set_callback_fn
- *  If set_callback_fn is set to true, the callback function _rtc_alarm_fired
- *  will be triggered as soon as the alarm is fired.
- *  It will be set to true as long as device is awake, and will be set to false when
- *  the device suspends.
- *
- * @retval false if any failure met
+ * @brief Count the wakeups saved by firing at "deadline": every distinct expiry of a
+ * wakeup timeout covered by that wake would have needed a wake of its own.
+ */
+static int
+_count_coalesced_wakeups(time_t deadline)
+{
+	int saved = 0;
+	sqlite3_stmt *st = _timeout_stmt(kTimeoutStmtCountCoalesced);
+
+	if (!st)
+	{
+		return 0;
+	}
+
+	sqlite3_bind_int64(st, 1, deadline);
+
+	if (sqlite3_step(st) == SQLITE_ROW)
+	{
+		saved = sqlite3_column_int(st, 0) - 1;
+	}
+
+	_timeout_stmt_reset(st);
+
+	if (saved > 0)
+	{
+		SLEEPDLOG_DEBUG("next wakeup at %ld covers %d more timeouts", deadline, saved);
+	}
+
+	return saved > 0 ? saved : 0;
+}
+
+/**
+ * @brief Arm the RTC alarm for the next wakeup timeout, see _queue_next_wakeup().
+ * Called with sTimeoutDbMutex held.
  */
 static bool
-_queue_next_wakeup(bool set_callback_fn)
+_arm_next_wakeup(bool set_callback_fn)
 {
 	int rc;
 	char **table;
@@ -518,10 +761,14 @@ _queue_next_wakeup(bool set_callback_fn)
 	char *zErrMsg;
 	nyx_error_t nyx_error;
 
-	g_return_val_if_fail(timeout_db != NULL, false);
-
-	rc = sqlite3_get_table(timeout_db, "SELECT expiry FROM AlarmTimeout "
-	                       "WHERE wakeup=1 ORDER BY expiry LIMIT 1", &table, &noRows, &noCols, &zErrMsg);
+	/*
+	   The RTC fires at the earliest deadline (expiry + window_s) of all wakeup
+	   timeouts: every tolerant timeout already expired by then is fired on the
+	   same wake.
+	   */
+	rc = sqlite3_get_table(timeout_db,
+	                       "SELECT deadline, app_id, key FROM AlarmTimeout "
+	                       "WHERE wakeup=1 ORDER BY deadline LIMIT 1", &table, &noRows, &noCols, &zErrMsg);
 
 	if (rc != SQLITE_OK)
 	{
@@ -531,6 +778,10 @@ _queue_next_wakeup(bool set_callback_fn)
 		return false;
 	}
 
+	pthread_mutex_lock(&sWakeupArmedMutex);
+	sWakeupArmed = false;
+	pthread_mutex_unlock(&sWakeupArmedMutex);
+
 	if (!noRows)
 	{
 		sqlite3_free_table(table);
@@ -542,16 +793,23 @@ _queue_next_wakeup(bool set_callback_fn)
 	{
 		time_t rtctime = 0;
 		time_t expiry = atol(table[ noCols ]);
+		gchar *app_id = g_strdup(table[ noCols + 1 ]);
+		gchar *key = g_strdup(table[ noCols + 2 ]);
+
 		sqlite3_free_table(table);
 
+		int coalesced = _count_coalesced_wakeups(expiry);
+
 		// we should adjust our expiry (reference clock based) to RTC clock
-		nyx_error = nyx_system_query_rtc_time(GetNyxSystemDevice(), &rtctime);
+		nyx_error = TimeSourceGetRtc(&rtctime);
 
 		if (nyx_error != NYX_ERROR_NONE)
 		{
 			SLEEPDLOG_WARNING(MSGID_SELECT_EXPIRY_WITH_WAKEUP, 1, PMLOGKFV("nyx_error",
 			                  "%d", nyx_error),
 			                  "Failed to get RTC clocks while setting up wakeup alarm");
+			g_free(app_id);
+			g_free(key);
 			return false;
 		}
 
@@ -567,25 +825,125 @@ _queue_next_wakeup(bool set_callback_fn)
 			SLEEPDLOG_WARNING(MSGID_SELECT_EXPIRY_WITH_WAKEUP, 1, PMLOGKFV("nyx_error",
 			                  "%d", nyx_error),
 			                  "Failed to setup RTC wakeup alarm");
+			g_free(app_id);
+			g_free(key);
 			return false;
 		}
+
+		pthread_mutex_lock(&sWakeupArmedMutex);
+		g_free(sWakeupArmedAppId);
+		g_free(sWakeupArmedKey);
+		sWakeupArmedAppId = app_id;
+		sWakeupArmedKey = key;
+		sWakeupArmedCoalesced = coalesced;
+		sWakeupArmedExpiry = expiry;
+		sWakeupArmed = true;
+		pthread_mutex_unlock(&sWakeupArmedMutex);
 	}
 
 	return true;
 }
 
+/**
+ * @brief Queues a RTC alarm for wakeup timeouts
+ *
+ * Should be called before suspending
+ *
+ * @param set_callback_fn
+ *  If set_callback_fn is set to true, the callback function _rtc_alarm_fired
+ *  will be triggered as soon as the alarm is fired.
+ *  It will be set to true as long as device is awake, and will be set to false when
+ *  the device suspends.
+ *
+ * @retval false if any failure met
+ */
+static bool
+_queue_next_wakeup(bool set_callback_fn)
+{
+	pthread_mutex_lock(&sTimeoutDbMutex);
+	bool ret = timeout_db && _arm_next_wakeup(set_callback_fn);
+	pthread_mutex_unlock(&sTimeoutDbMutex);
+
+	return ret;
+}
+
+bool
+timeout_wakeup_due(void)
+{
+	time_t now = reference_time();
+
+	pthread_mutex_lock(&sWakeupArmedMutex);
+	bool due = sWakeupArmed &&
+	           now + WAKEUP_DUE_TOLERANCE_SECS >= sWakeupArmedExpiry;
+	pthread_mutex_unlock(&sWakeupArmedMutex);
+
+	return due;
+}
+
+int
+timeout_wakeup_coalesced(void)
+{
+	pthread_mutex_lock(&sWakeupArmedMutex);
+	int coalesced = sWakeupArmed ? sWakeupArmedCoalesced : 0;
+	pthread_mutex_unlock(&sWakeupArmedMutex);
+
+	return coalesced;
+}
+
+bool
+timeout_get_armed_wakeup(gchar **app_id, gchar **key)
+{
+	g_return_val_if_fail(app_id != NULL, false);
+	g_return_val_if_fail(key != NULL, false);
+
+	pthread_mutex_lock(&sWakeupArmedMutex);
+
+	bool armed = sWakeupArmed;
+
+	if (armed)
+	{
+		*app_id = g_strdup(sWakeupArmedAppId);
+		*key = g_strdup(sWakeupArmedKey);
+	}
+
+	pthread_mutex_unlock(&sWakeupArmedMutex);
+
+	return armed;
+}
+
 bool queue_next_wakeup()
 {
 	return _queue_next_wakeup(false);
 }
 
-/* If next wakeup time exceeds 7 days its due to incorrect system time,
-   so set the minimum wakeup interval to 10 sec after which sleepd can
-   again check if the next wakeup time is sane (less than 7 days)
-   and set it accordingly */
+/**
+* @brief Arm the timer for non-wakeup timeouts from the cached next expiry.
+*
+* Timeouts further away than TIMEOUT_TIMER_MAX_SECS, including ones pushed
+* far away by an incorrect system time, are simply re-checked when the
+* timer fires.
+*/
+static void
+_queue_timer_check(void)
+{
+	long wakeInSeconds = TIMEOUT_TIMER_MAX_SECS;
+
+	if (sHaveTimeouts)
+	{
+		wakeInSeconds = sNextExpiry - reference_time();
+
+		if (wakeInSeconds < 0)
+		{
+			wakeInSeconds = 0;
+		}
+		else if (wakeInSeconds > TIMEOUT_TIMER_MAX_SECS)
+		{
+			wakeInSeconds = TIMEOUT_TIMER_MAX_SECS;
+		}
+	}
 
-#define MAX_WAKEUP_SECS	7*24*60*60
-#define MIN_WAKEUP_SECS	10
+	g_timer_source_set_interval_seconds(sTimerCheck, wakeInSeconds, true);
+}
 
 /**
 * @brief Queues a timer for non-wakeup timeouts.
@@ -604,55 +962,86 @@ _queue_next_timeout()
 	int noRows, noCols;
 	char *zErrMsg;
 
-	time_t timer_expiry = 0;
-	time_t now = reference_time();
-
 	g_return_if_fail(timeout_db != NULL);
 
-	rc = sqlite3_get_table(timeout_db, "SELECT expiry FROM AlarmTimeout "
-	                       "ORDER BY expiry LIMIT 1", &table, &noRows, &noCols, &zErrMsg);
+	rc = sqlite3_get_table(timeout_db, "SELECT MIN(expiry),"
+	                       "MIN(CASE WHEN wakeup=0 AND early_s>0 THEN expiry-early_s END) "
+	                       "FROM AlarmTimeout", &table, &noRows, &noCols, &zErrMsg);
 
 	if (rc != SQLITE_OK)
 	{
 		SLEEPDLOG_WARNING(MSGID_ALARM_TIMEOUT_SELECT, 2, PMLOGKS(ERRTEXT, zErrMsg),
 		                  PMLOGKFV(ERRCODE, "%d", rc), "");
 		sqlite3_free(zErrMsg);
+		sNextExpiryKnown = false;
 		return;
 	}
 
-	if (!noRows)
+	sNextExpiryKnown = true;
+	sHaveTimeouts = (noRows != 0 && table[ noCols ] != NULL);
+
+	if (sHaveTimeouts)
 	{
-		g_timer_source_set_interval_seconds(sTimerCheck, 60 * 60, true);
+		sNextExpiry = atol(table[ noCols ]);
+		sNextOnWake = sNextExpiry;
+
+		if (table[ noCols + 1 ] && atol(table[ noCols + 1 ]) < sNextOnWake)
+		{
+			sNextOnWake = atol(table[ noCols + 1 ]);
+		}
 	}
-	else
+
+	sqlite3_free_table(table);
+
+	_queue_timer_check();
+}
+
+static gboolean
+_timeout_checkpoint_idle(gpointer data)
+{
+	sCheckpointSource = 0;
+	smart_sql_checkpoint(timeout_db);
+	return FALSE;
+}
+
+/**
+* @brief Checkpoint the database once timeouts stop changing for a while, at low
+* priority, rather than in the middle of handling requests.
+*/
+static void
+_timeout_checkpoint_schedule(void)
+{
+	if (sCheckpointSource || !smart_sql_wal_pending())
 	{
-		timer_expiry = atol(table[ noCols ]);
+		return;
+	}
 
-		long wakeInSeconds = timer_expiry - now;
+	sCheckpointSource = g_timeout_add_seconds_full(G_PRIORITY_LOW,
+	                    TIMEOUT_CHECKPOINT_IDLE_SECS, _timeout_checkpoint_idle, NULL, NULL);
+}
 
-		if (wakeInSeconds < 0)
-		{
-			wakeInSeconds = 0;
-		}
-		else if(wakeInSeconds > MAX_WAKEUP_SECS)
-		{
-			wakeInSeconds = MIN_WAKEUP_SECS;
-		}
+void
+timeout_db_checkpoint(void)
+{
+	pthread_mutex_lock(&sTimeoutDbMutex);
 
-		g_timer_source_set_interval_seconds(sTimerCheck, wakeInSeconds, true);
+	if (timeout_db)
+	{
+		smart_sql_checkpoint(timeout_db);
 	}
 
-	sqlite3_free_table(table);
+	pthread_mutex_unlock(&sTimeoutDbMutex);
 }
 
 /**
 * @brief Trigger expired timeouts, and queue up the next one.
+*
+* @param  delta    Adjustment of the reference clock just applied
+* @param  on_wake  The device just woke up, see _expire_timeouts()
 */
 static void
-_update_timeouts(void)
+_update_timeouts_delta(time_t delta, bool on_wake)
 {
-	time_t delta = update_reference_time(NULL, NULL);
-
 	if (delta != invalid_time && delta != 0)
 	{
 		_recalculate_timeouts(delta);
@@ -660,7 +1049,7 @@ _update_timeouts(void)
 		update_alarms_delta(delta);
 	}
 
-	_expire_timeouts();
+	_expire_timeouts(on_wake);
 #ifdef ENABLE_UNMANAGED_SUSPEND
 	/* By some reason original code sets wakeup alarm for every next wakeup
 	 * event.
@@ -673,6 +1062,73 @@ _update_timeouts(void)
 	_queue_next_wakeup(true);
 #endif
 	_queue_next_timeout();
+	_timeout_checkpoint_schedule();
+}
+
+/**
+* @brief Trigger expired timeouts, and queue up the next one.
+*/
+static void
+_update_timeouts(void)
+{
+	_update_timeouts_delta(update_reference_time(NULL, NULL), false);
+}
+
+/**
+* @brief Timeout maintenance after the device woke up, run on the main loop.
+*
+* When the system clock did not jump and no timeout can fire yet, nothing
+* expired while asleep: only the non-wakeup timer, which does not account for
+* the time spent asleep, needs to be re-armed. Otherwise the non-wakeup
+* timeouts within their early_s are fired along with the expired ones, while
+* the device is awake anyway.
+*/
+static gboolean
+_resume_update_timeouts(gpointer data)
+{
+	time_t delta = update_reference_time(NULL, NULL);
+
+	if (delta == 0 && sNextExpiryKnown &&
+	        (!sHaveTimeouts || reference_time() < sNextOnWake))
+	{
+		SLEEPDLOG_DEBUG("No timeout expired while asleep, skipping timeout update");
+		_queue_timer_check();
+		return FALSE;
+	}
+
+	_update_timeouts_delta(delta, true);
+	return FALSE;
+}
+
+/**
+* @brief Called by the suspend state machine on every resume, so that
+*        non-wakeup timeouts which expired while asleep are fired.
+*
+* The work is handed to the main loop, which owns the timeout timers, at a
+* higher priority than pending bus traffic.
+*
+* @retval false if timeouts are disabled
+*/
+bool
+update_timeouts_on_resume(void)
+{
+	// Runs on the suspend thread: the handle can be swapped under it.
+	pthread_mutex_lock(&sTimeoutDbMutex);
+	bool enabled = timeout_db && sTimerCheck;
+	pthread_mutex_unlock(&sTimeoutDbMutex);
+
+	if (!enabled)
+	{
+		return false;
+	}
+
+	GSource *source = g_idle_source_new();
+	g_source_set_priority(source, G_PRIORITY_HIGH);
+	g_source_set_callback(source, _resume_update_timeouts, NULL, NULL);
+	g_source_attach(source, GetMainLoopContext());
+	g_source_unref(source);
+
+	return true;
 }
 
 void _timeout_create(_AlarmTimeout *timeout,
@@ -695,46 +1151,59 @@ void _timeout_create(_AlarmTimeout *timeout,
 	timeout->activity_duration_ms = activity_duration_ms;
 	timeout->calendar = calendar;
 	timeout->expiry = expiry;
+	timeout->window_s = 0;
+	timeout->early_s = 0;
+	timeout->period_s = 0;
 }
 
-bool
-_timeout_set(_AlarmTimeout *timeout)
+/**
+* @brief Write a timeout to the database, replacing any timeout with the same
+* (app_id, key, public_bus), without rescheduling.
+*/
+static bool
+_timeout_insert(const _AlarmTimeout *timeout)
 {
-	int rc;
-	sqlite3_stmt *st = NULL;
-	const char *tail;
+	sqlite3_stmt *st;
 
 	g_return_val_if_fail(timeout != NULL, false);
 
-	/* Delete (app_id,key,public_bus) if it already exists */
-	_timeout_delete(timeout->app_id, timeout->key, timeout->public_bus);
-
-	rc = sqlite3_prepare_v2(timeout_db,
-	                        "INSERT INTO AlarmTimeout (app_id,key,uri,params,public_bus,wakeup,calendar,expiry,activity_id,activity_duration_ms) "
-	                        "VALUES ( $1, $2, $3, $4, $5, $6, $7, $8, $9, $10 )", -1, &st, &tail);
+	/*
+	   owner_index makes the insert replace the timeout with the same
+	   (app_id,key,public_bus) if it already exists. The sqlite versions we
+	   support predate UPSERT.
+	   */
+	st = _timeout_stmt(kTimeoutStmtInsert);
 
-	if (rc != SQLITE_OK)
+	if (!st)
 	{
-		SLEEPDLOG_WARNING(MSGID_ALARM_TIMEOUT_INSERT, 1, PMLOGKFV(ERRCODE, "%d", rc),
+		SLEEPDLOG_WARNING(MSGID_ALARM_TIMEOUT_INSERT, 0,
 		                  "Insert into AlarmTimeout failed");
 		return false;
 	}
 
-	sqlite3_bind_text(st,  1, timeout->app_id,
-	                  timeout->app_id ? strlen(timeout->app_id) : -1, SQLITE_STATIC);
-	sqlite3_bind_text(st,  2, timeout->key, strlen(timeout->key), SQLITE_STATIC);
-	sqlite3_bind_text(st,  3, timeout->uri, strlen(timeout->uri), SQLITE_STATIC);
-	sqlite3_bind_text(st,  4, timeout->params, strlen(timeout->params),
+	// _timeout_delete() and _timeout_read() match a missing app_id as ""
+	sqlite3_bind_text(st,  1, timeout->app_id ? timeout->app_id : "", -1,
 	                  SQLITE_STATIC);
+	sqlite3_bind_text(st,  2, timeout->key, -1, SQLITE_STATIC);
+	sqlite3_bind_text(st,  3, timeout->uri, -1, SQLITE_STATIC);
+	sqlite3_bind_text(st,  4, timeout->params, -1, SQLITE_STATIC);
 	sqlite3_bind_int(st,  5, timeout->public_bus);
 	sqlite3_bind_int(st,  6, timeout->wakeup);
 	sqlite3_bind_int(st,  7, timeout->calendar);
-	sqlite3_bind_int(st,  8, timeout->expiry);
-	sqlite3_bind_text(st,  9, timeout->activity_id, strlen(timeout->activity_id),
-	                  SQLITE_STATIC);
+	sqlite3_bind_int64(st,  8, timeout->expiry);
+	sqlite3_bind_text(st,  9, timeout->activity_id, -1, SQLITE_STATIC);
 	sqlite3_bind_int(st, 10, timeout->activity_duration_ms);
+	sqlite3_bind_int(st, 11, timeout->window_s);
+	sqlite3_bind_int(st, 12, timeout->period_s);
+	sqlite3_bind_int(st, 13, timeout->early_s);
+
+	return _timeout_stmt_step(__func__, st);
+}
 
-	if (!_sql_step_finalize(__func__, st))
+bool
+_timeout_set(_AlarmTimeout *timeout)
+{
+	if (!_timeout_insert(timeout))
 	{
 		return false;
 	}
@@ -775,9 +1244,7 @@ _timeout_read(_AlarmTimeoutNonConst *timeout, const char *app_id,
 {
 	bool ret = false;
 	int rc;
-	char **table;
-	int noRows, noCols;
-	char *zErrMsg;
+	int rows = 0;
 
 	if (!app_id)
 	{
@@ -792,53 +1259,59 @@ _timeout_read(_AlarmTimeoutNonConst *timeout, const char *app_id,
 	SLEEPDLOG_DEBUG("SELECT (\"%s\", \"%s\", %s)", app_id, key,
 	                public_bus ? "public" : "private");
 
-	char *sqlquery = g_strdup_printf(
-	                     "SELECT t1key,app_id,key,uri,params,public_bus,wakeup,calendar,expiry,activity_id,activity_duration_ms FROM AlarmTimeout "
-	                     "WHERE app_id=\"%s\" AND key=\"%s\" AND public_bus=%d", app_id, key,
-	                     public_bus);
-
-	rc = sqlite3_get_table(timeout_db, sqlquery, &table, &noRows, &noCols,
-	                       &zErrMsg);
-
-	g_free(sqlquery);
+	sqlite3_stmt *st = _timeout_stmt(kTimeoutStmtRead);
 
-	if (rc != SQLITE_OK)
+	if (!st)
 	{
-		SLEEPDLOG_WARNING(MSGID_SELECT_ALL_FROM_TIMEOUT, 2, PMLOGKS(ERRTEXT, zErrMsg),
-		                  PMLOGKFV(ERRCODE, "%d", rc), "");
-		sqlite3_free(zErrMsg);
+		return false;
 	}
-	else
+
+	sqlite3_bind_text(st, 1, app_id, -1, SQLITE_STATIC);
+	sqlite3_bind_text(st, 2, key, -1, SQLITE_STATIC);
+	sqlite3_bind_int(st, 3, public_bus);
+
+	while ((rc = sqlite3_step(st)) == SQLITE_ROW)
 	{
-		if (noRows)
+		if (rows++)
 		{
-			if (noRows > 1)
-			{
-				SLEEPDLOG_DEBUG("%d rows for (%s, %s, %s)", noRows,
-				                app_id, key, public_bus ? "public" : "private");
-			}
-
-			timeout->table_id               = g_strdup(table[ noCols      ]);
-			timeout->app_id                 = g_strdup(table[ noCols +  1 ]);
-			timeout->key                    = g_strdup(table[ noCols +  2 ]);
-			timeout->uri                    = g_strdup(table[ noCols +  3 ]);
-			timeout->params                 = g_strdup(table[ noCols +  4 ]);
-			timeout->public_bus             = atoi(table[ noCols +  5 ]);
-			timeout->wakeup                 = atoi(table[ noCols +  6 ]);
-			timeout->calendar               = atoi(table[ noCols +  7 ]);
-			timeout->expiry                 = atol(table[ noCols +  8 ]);
-
-			// The two "activity" fields could be null if this is an
-			// old record where the new columns were inserted.
-			timeout->activity_id            = table[noCols + 9] ? g_strdup(
-			                                      table[noCols +  9]) : g_strdup(DEFAULT_ACTIVITY_ID);
-			timeout->activity_duration_ms   = table[noCols + 10] ? atoi(
-			                                      table[noCols + 10]) : TIMEOUT_KEEP_ALIVE_MS;
-
-			ret = true;
+			continue;
 		}
 
-		sqlite3_free_table(table);
+		timeout->table_id               = _column_strdup(st,  0, "");
+		timeout->app_id                 = _column_strdup(st,  1, NULL);
+		timeout->key                    = _column_strdup(st,  2, NULL);
+		timeout->uri                    = _column_strdup(st,  3, NULL);
+		timeout->params                 = _column_strdup(st,  4, NULL);
+		timeout->public_bus             = sqlite3_column_int(st, 5);
+		timeout->wakeup                 = sqlite3_column_int(st, 6);
+		timeout->calendar               = sqlite3_column_int(st, 7);
+		timeout->expiry                 = sqlite3_column_int64(st, 8);
+
+		// The two "activity" fields could be null if this is an
+		// old record where the new columns were inserted.
+		timeout->activity_id            = _column_strdup(st,  9, DEFAULT_ACTIVITY_ID);
+		timeout->activity_duration_ms   = sqlite3_column_type(st, 10) == SQLITE_NULL ?
+		                                  TIMEOUT_KEEP_ALIVE_MS : sqlite3_column_int(st, 10);
+		timeout->window_s               = sqlite3_column_int(st, 11);
+		timeout->period_s               = sqlite3_column_int(st, 12);
+		timeout->early_s                = sqlite3_column_int(st, 13);
+
+		ret = true;
+	}
+
+	_timeout_stmt_reset(st);
+
+	if (rc != SQLITE_DONE)
+	{
+		SLEEPDLOG_WARNING(MSGID_SELECT_ALL_FROM_TIMEOUT, 2,
+		                  PMLOGKS(ERRTEXT, sqlite3_errmsg(timeout_db)),
+		                  PMLOGKFV(ERRCODE, "%d", rc), "");
+	}
+
+	if (rows > 1)
+	{
+		SLEEPDLOG_DEBUG("%d rows for (%s, %s, %s)", rows,
+		                app_id, key, public_bus ? "public" : "private");
 	}
 
 	return ret;
@@ -857,9 +1330,7 @@ _timeout_read(_AlarmTimeoutNonConst *timeout, const char *app_id,
 bool
 _timeout_delete(const char *app_id, const char *key, bool public_bus)
 {
-	sqlite3_stmt *st = NULL;
-	const char *tail;
-	int rc;
+	sqlite3_stmt *st;
 
 	if (!app_id)
 	{
@@ -875,21 +1346,19 @@ _timeout_delete(const char *app_id, const char *key, bool public_bus)
 	                public_bus ? "public" : "private");
 
 	/* Delete the matching timeout.*/
-	rc = sqlite3_prepare_v2(timeout_db,
-	                        "DELETE FROM AlarmTimeout WHERE "
-	                        "app_id=$1 AND key=$2 AND public_bus=$3", -1, &st, &tail);
+	st = _timeout_stmt(kTimeoutStmtDelete);
 
-	if (rc != SQLITE_OK)
+	if (!st)
 	{
-		SLEEPDLOG_DEBUG("Could not remove AlarmTimeout, failed with %d", rc);
+		SLEEPDLOG_DEBUG("Could not remove AlarmTimeout");
 		return false;
 	}
 
-	sqlite3_bind_text(st, 1, app_id, app_id ? strlen(app_id) : -1, SQLITE_STATIC);
-	sqlite3_bind_text(st, 2, key, key ? strlen(key) : -1, SQLITE_STATIC);
+	sqlite3_bind_text(st, 1, app_id, -1, SQLITE_STATIC);
+	sqlite3_bind_text(st, 2, key, -1, SQLITE_STATIC);
 	sqlite3_bind_int(st, 3, public_bus);
 
-	return _sql_step_finalize(__func__, st);
+	return _timeout_stmt_step(__func__, st);
 
 } // _timeout_delete
 
@@ -928,7 +1397,7 @@ _rtc_check(gpointer data)
 	static long int sNumTimes = 0;
 
 	long int this_time = 0;
-	nyx_system_query_rtc_time(GetNyxSystemDevice(), (time_t *)&this_time);
+	TimeSourceGetRtc((time_t *)&this_time);
 
 	if (this_time == sLastRTCTime)
 	{
@@ -957,7 +1426,7 @@ _rtc_check(gpointer data)
 static gboolean
 _timer_check(gpointer data)
 {
-	_update_timeouts();
+	_update_timeouts_delta(update_reference_time(NULL, NULL), false);
 	return TRUE;
 }
 
@@ -999,22 +1468,39 @@ _timeout_exists(const char *app_id, const char *key, bool public_bus)
 	return ret;
 }
 
+#define TIMEOUT_SET_INVALID_TEXT "Invalid format for 'timeout/set'."
+#define TIMEOUT_SET_DURATION_TEXT "activity_duration_ms less than " \
+	ACTIVITY_DURATION_MS_MINIMUM_AS_TEXT "."
+
 /**
-* @brief Handle a timeout/set message and add a new power timeout.
+* @brief Build a timeout from the parameters of a timeout/set request, or of one
+* item of a timeout/setBatch request.
+*
 * Relative timeouts can be set by passing the "in" parameter.
 * Absolute timeouts can be set by passing the "at" parameter.
+* A wakeup timeout passing "window_s" accepts to fire up to window_s seconds
+* late, so that it can share the RTC wake of another timeout. A non-wakeup
+* timeout passing "early_s" accepts to fire up to early_s seconds early when
+* the device wakes up, rather than keep it awake later on its own; it never
+* fires early otherwise. Each is rejected on the other kind of timeout.
+* A timeout passing "period" (HH:MM:SS) recurs with that period until it is
+* cleared; without "at" or "in" it first fires one period from now. With
+* "align" set, occurrences fall on multiples of the period in UTC, e.g. on
+* the hour for a period of "01:00:00".
 *
-* @param  sh
-* @param  message
-* @param  ctx
+* The strings of the timeout point into object and app_id.
 *
-* @retval
+* @param  object      Parameters of the timeout
+* @param  app_id      Application setting the timeout
+* @param  public_bus  Whether the request came on the public bus
+* @param  timeout     Filled in on success
+*
+* @retval NULL on success, else the error text for the reply
 */
-static bool
-_alarm_timeout_set(LSHandle *sh, LSMessage *message, void *ctx)
+static const char *
+_timeout_parse(struct json_object *object, const char *app_id, bool public_bus,
+               _AlarmTimeout *timeout)
 {
-	bool retVal;
-	const char *app_instance_id;
 	const char *key;
 	const char *at;
 	const char *in;
@@ -1023,32 +1509,23 @@ _alarm_timeout_set(LSHandle *sh, LSMessage *message, void *ctx)
 	bool wakeup;
 	const char *activity_id;
 	int activity_duration_ms;
-	bool calendar;
 	time_t expiry;
-	_AlarmTimeout timeout;
 	char **str_split;
 
-	char *app_id = NULL;
-
-	bool public_bus;
 	AlarmTimeoutType timeout_type;
-	struct json_object *object;
 	struct json_object *duration_object;
 	bool duration_provided;
 
-	// for optional "keep_existing" boolean argument
-	bool keep_existing_provided;
-	bool keep_existing = false;
-	struct json_object *keep_existing_object;
-
-	object = json_tokener_parse(LSMessageGetPayload(message));
+	// for optional "window_s" wakeup and "early_s" non-wakeup tolerances
+	int window_s = 0;
+	int early_s = 0;
+	struct json_object *window_object;
 
-	if (is_error(object))
-	{
-		goto malformed_json;
-	}
+	// for optional "period" and "align" recurrence
+	const char *period;
+	int period_s = 0;
+	bool align;
 
-	app_instance_id = LSMessageGetApplicationID(message);
 	key = json_object_get_string(json_object_object_get(object, "key"));
 	at = json_object_get_string(json_object_object_get(object, "at"));
 	in = json_object_get_string(json_object_object_get(object, "in"));
@@ -1058,12 +1535,7 @@ _alarm_timeout_set(LSHandle *sh, LSMessage *message, void *ctx)
 
 	if (!key || !strlen(key) || !uri || !strlen(uri) || !params || !strlen(params))
 	{
-		goto invalid_json;
-	}
-
-	if (!app_instance_id)
-	{
-		app_instance_id = "";
+		return TIMEOUT_SET_INVALID_TEXT;
 	}
 
 	// optional arguments to allow caller to specify activity name and duration
@@ -1077,14 +1549,14 @@ _alarm_timeout_set(LSHandle *sh, LSMessage *message, void *ctx)
 		if (!duration_provided)
 		{
 			SLEEPDLOG_DEBUG("activity_id w/o activity_duration_ms");
-			goto invalid_json;
+			return TIMEOUT_SET_INVALID_TEXT;
 		}
 
 		activity_duration_ms = json_object_get_int(duration_object);
 
 		if (activity_duration_ms < ACTIVITY_DURATION_MS_MINIMUM)
 		{
-			goto activity_duration_too_short;
+			return TIMEOUT_SET_DURATION_TEXT;
 		}
 	}
 	else
@@ -1092,23 +1564,57 @@ _alarm_timeout_set(LSHandle *sh, LSMessage *message, void *ctx)
 		if (duration_provided)
 		{
 			SLEEPDLOG_DEBUG("activity_duration_ms w/o activity_id");
-			goto invalid_json;
+			return TIMEOUT_SET_INVALID_TEXT;
 		}
 
 		activity_id = DEFAULT_ACTIVITY_ID;
 		activity_duration_ms = TIMEOUT_KEEP_ALIVE_MS;
 	}
 
-	// optional argument which tells us to keep a pre-existing alarm with the same key
-	keep_existing_provided = json_object_object_get_ex(object, "keep_existing",
-	                         &keep_existing_object);
+	if (json_object_object_get_ex(object, "window_s", &window_object))
+	{
+		window_s = json_object_get_int(window_object);
 
-	if (keep_existing_provided)
+		if (!wakeup || window_s < 0 || window_s > TIMEOUT_MAX_WINDOW_SEC)
+		{
+			return TIMEOUT_SET_INVALID_TEXT;
+		}
+	}
+
+	if (json_object_object_get_ex(object, "early_s", &window_object))
 	{
-		keep_existing = json_object_get_boolean(keep_existing_object);
+		early_s = json_object_get_int(window_object);
+
+		if (wakeup || early_s < 0 || early_s > TIMEOUT_MAX_WINDOW_SEC)
+		{
+			return TIMEOUT_SET_INVALID_TEXT;
+		}
 	}
 
-	app_id = _get_appid_dup(app_instance_id);
+	period = json_object_get_string(json_object_object_get(object, "period"));
+	align = json_object_get_boolean(json_object_object_get(object, "align"));
+
+	if (period)
+	{
+		int HH, MM, SS;
+
+		if (!(ConvertJsonTime(period, &HH, &MM, &SS)) || (HH < 0 || HH > 24 || MM < 0 ||
+		        MM > 59 || SS < 0 || SS > 59))
+		{
+			return TIMEOUT_SET_INVALID_TEXT;
+		}
+
+		period_s = SS + MM * 60 + HH * 60 * 60;
+
+		if (period_s < TIMEOUT_MINIMUM_PERIOD_SEC)
+		{
+			return TIMEOUT_SET_INVALID_TEXT;
+		}
+	}
+	else if (align)
+	{
+		return TIMEOUT_SET_INVALID_TEXT;
+	}
 
 	if (at)
 	{
@@ -1126,13 +1632,13 @@ _alarm_timeout_set(LSHandle *sh, LSMessage *message, void *ctx)
 
 		if (!str_split)
 		{
-			goto invalid_json;
+			return TIMEOUT_SET_INVALID_TEXT;
 		}
 
 		if ((NULL == str_split[0]) || (NULL == str_split[1]))
 		{
 			g_strfreev(str_split);
-			goto invalid_json;
+			return TIMEOUT_SET_INVALID_TEXT;
 		}
 
 		date_str = g_strsplit(str_split[0], "/", 3);
@@ -1140,14 +1646,14 @@ _alarm_timeout_set(LSHandle *sh, LSMessage *message, void *ctx)
 		if (!date_str)
 		{
 			g_strfreev(str_split);
-			goto invalid_json;
+			return TIMEOUT_SET_INVALID_TEXT;
 		}
 
 		if ((NULL == date_str[0]) || (NULL == date_str[1]) || (NULL == date_str[2]))
 		{
 			g_strfreev(str_split);
 			g_strfreev(date_str);
-			goto invalid_json;
+			return TIMEOUT_SET_INVALID_TEXT;
 		}
 
 		mm = atoi(date_str[0]);
@@ -1159,14 +1665,14 @@ _alarm_timeout_set(LSHandle *sh, LSMessage *message, void *ctx)
 		        MM < 0 || MM > 59 || SS < 0 || SS > 59))
 		{
 			g_strfreev(str_split);
-			goto invalid_json;
+			return TIMEOUT_SET_INVALID_TEXT;
 		}
 
 		g_strfreev(str_split);
 
 		if (!g_date_valid_dmy(dd, mm, yyyy))
 		{
-			goto invalid_json;
+			return TIMEOUT_SET_INVALID_TEXT;
 		}
 
 		struct tm gm_time;
@@ -1206,7 +1712,7 @@ _alarm_timeout_set(LSHandle *sh, LSMessage *message, void *ctx)
 		if (!(ConvertJsonTime(in, &HH, &MM, &SS)) || (HH < 0 || HH > 24 || MM < 0 ||
 		        MM > 59 || SS < 0 || SS > 59))
 		{
-			goto invalid_json;
+			return TIMEOUT_SET_INVALID_TEXT;
 		}
 
 		int delta = SS + MM * 60 + HH * 60 * 60;
@@ -1215,7 +1721,7 @@ _alarm_timeout_set(LSHandle *sh, LSMessage *message, void *ctx)
 
 		if (delta < TIMEOUT_MINIMUM_SEC)
 		{
-			goto timeout_relative_too_short;
+			return "Timeout value for 'in' less than " TIMEOUT_MINIMUM_AS_TEXT ".";
 		}
 
 #endif
@@ -1228,30 +1734,113 @@ _alarm_timeout_set(LSHandle *sh, LSMessage *message, void *ctx)
 
 		expiry = reference_time() + delta;
 	}
+	else if (period_s)
+	{
+		SLEEPDLOG_DEBUG("%s (%s,%s) every %s", app_id, key, wakeup ? "wakeup" : "_",
+		                period);
+
+		timeout_type = AlarmTimeoutRelative;
+		expiry = reference_time() + period_s;
+	}
 	else
 	{
-		goto invalid_json;
+		return TIMEOUT_SET_INVALID_TEXT;
 	}
 
+	/*
+	   Aligned occurrences are wall clock times: round the first one up to the
+	   period boundary, and keep them from moving with time changes.
+	   */
+	if (align)
+	{
+		timeout_type = AlarmTimeoutCalendar;
+		expiry = ((expiry + period_s - 1) / period_s) * period_s;
+	}
+
+	_timeout_create(timeout, app_id, key, uri, params,
+	                public_bus, wakeup, activity_id, activity_duration_ms,
+	                timeout_type == AlarmTimeoutCalendar, expiry);
+	timeout->window_s = window_s;
+	timeout->early_s = early_s;
+	timeout->period_s = period_s;
+
+	return NULL;
+}
+
+/**
+* @brief Handle a timeout/set message and add a new power timeout.
+* See _timeout_parse() for the parameters of the timeout.
+*
+* @param  sh
+* @param  message
+* @param  ctx
+*
+* @retval
+*/
+static bool
+_alarm_timeout_set(LSHandle *sh, LSMessage *message, void *ctx)
+{
+	bool retVal;
+	const char *app_instance_id;
+	const char *errorText;
+	_AlarmTimeout timeout;
+
+	char *app_id = NULL;
+
+	bool public_bus;
+	struct json_object *object;
+
+	// for optional "keep_existing" boolean argument
+	bool keep_existing_provided;
+	bool keep_existing = false;
+	struct json_object *keep_existing_object;
+
+	object = json_tokener_parse(LSMessageGetPayload(message));
+
+	if (is_error(object))
+	{
+		goto malformed_json;
+	}
+
+	app_instance_id = LSMessageGetApplicationID(message);
+
+	if (!app_instance_id)
+	{
+		app_instance_id = "";
+	}
+
+	// optional argument which tells us to keep a pre-existing alarm with the same key
+	keep_existing_provided = json_object_object_get_ex(object, "keep_existing",
+	                         &keep_existing_object);
+
+	if (keep_existing_provided)
+	{
+		keep_existing = json_object_get_boolean(keep_existing_object);
+	}
+
+	app_id = _get_appid_dup(app_instance_id);
 	public_bus = LSMessageIsPublic(psh, message);
-	calendar = (timeout_type == AlarmTimeoutCalendar);
+
+	errorText = _timeout_parse(object, app_id, public_bus, &timeout);
+
+	if (errorText)
+	{
+		goto invalid_params;
+	}
 
 	bool kept_existing = false;
 	char *payload;
 
-	if (keep_existing && _timeout_exists(app_id, key, public_bus))
+	if (keep_existing && _timeout_exists(app_id, timeout.key, public_bus))
 	{
 
 		kept_existing = true;
 
 		SLEEPDLOG_DEBUG("keeping existing timeout for (\"%s\", \"%s\", %s)",
-		                app_id, key, public_bus ? "public" : "private");
+		                app_id, timeout.key, public_bus ? "public" : "private");
 	}
 	else
 	{
-		_timeout_create(&timeout, app_id, key, uri, params,
-		                public_bus, wakeup, activity_id, activity_duration_ms, calendar, expiry);
-
 		retVal = _timeout_set(&timeout);
 
 		if (!retVal)
@@ -1260,7 +1849,7 @@ _alarm_timeout_set(LSHandle *sh, LSMessage *message, void *ctx)
 		}
 	}
 
-	char *escaped_key = g_strescape(key, NULL);
+	char *escaped_key = g_strescape(timeout.key, NULL);
 
 	if (keep_existing_provided)
 	{
@@ -1284,32 +1873,6 @@ _alarm_timeout_set(LSHandle *sh, LSMessage *message, void *ctx)
 	g_free(payload);
 	g_free(escaped_key);
 	goto cleanup;
-#if 0
-timeout_relative_too_short:
-	retVal = LSMessageReply(sh, message, "{\"returnValue\":false,"
-	                        "\"errorText\":\"Timeout value for 'in' less than " TIMEOUT_MINIMUM_AS_TEXT
-	                        ".\"}", NULL);
-
-	if (!retVal)
-	{
-		SLEEPDLOG(LOG_WARNING, "%s could not send reply <timeout_too_short>.",
-		          __FUNCTION__);
-	}
-
-	goto cleanup;
-#endif
-activity_duration_too_short:
-	retVal = LSMessageReply(sh, message, "{\"returnValue\":false,"
-	                        "\"errorText\":\"activity_duration_ms less than "
-	                        ACTIVITY_DURATION_MS_MINIMUM_AS_TEXT ".\"}", NULL);
-
-	if (!retVal)
-	{
-		SLEEPDLOG_WARNING(MSGID_SHORT_ACTIVITY_DURATION, 0,
-		                  "could not send reply <activity duration too short>");
-	}
-
-	goto cleanup;
 
 unknown_error:
 	retVal = LSMessageReply(sh, message, "{\"returnValue\":false,"
@@ -1322,9 +1885,11 @@ unknown_error:
 
 	goto cleanup;
 
-invalid_json:
-	retVal = LSMessageReply(sh, message, "{\"returnValue\":false,"
-	                        "\"errorText\":\"Invalid format for 'timeout/set'.\"}", NULL);
+invalid_params:
+	payload = g_strdup_printf("{\"returnValue\":false,\"errorText\":\"%s\"}",
+	                          errorText);
+	retVal = LSMessageReply(sh, message, payload, NULL);
+	g_free(payload);
 
 	if (!retVal)
 	{
@@ -1446,16 +2011,121 @@ cleanup:
 
 }
 
-static LSMethod timeout_methods[] =
+/**
+* @brief Start a batch of timeout changes: all of them are written in a single
+* transaction, and the timeouts are rescheduled once at the end.
+*/
+static bool
+_timeout_batch_begin(void)
 {
-	{ "set", _alarm_timeout_set },
-	{ "clear", _alarm_timeout_clear },
-	{ },
-};
+	return smart_sql_exec(timeout_db, "BEGIN TRANSACTION");
+}
+
+/**
+* @brief Commit a batch of timeout changes, and queue up the next timeouts if any
+* was changed.
+*
+* @retval false if the commit failed, and the whole batch was rolled back
+*/
+static bool
+_timeout_batch_end(bool changed)
+{
+	if (!smart_sql_exec(timeout_db, "COMMIT"))
+	{
+		smart_sql_exec(timeout_db, "ROLLBACK");
+		return false;
+	}
+
+	if (changed)
+	{
+		_update_timeouts();
+	}
+
+	return true;
+}
+
+/**
+* @brief Run one item of a batch in a savepoint, so that a failed item leaves
+* its previous timeout in place.
+*/
+static bool
+_timeout_batch_item(bool (*apply)(const void *item, void *data),
+                    const void *item, void *data)
+{
+	if (!smart_sql_exec(timeout_db, "SAVEPOINT timeout_item"))
+	{
+		return false;
+	}
+
+	bool retVal = apply(item, data);
+
+	if (!retVal)
+	{
+		smart_sql_exec(timeout_db, "ROLLBACK TO timeout_item");
+	}
+
+	smart_sql_exec(timeout_db, "RELEASE timeout_item");
+	return retVal;
+}
+
+static bool
+_timeout_batch_set_apply(const void *item, void *data)
+{
+	return _timeout_insert((const _AlarmTimeout *)item);
+}
+
+typedef struct
+{
+	const char *app_id;
+	bool public_bus;
+	bool found;  // set by _timeout_batch_clear_apply()
+} TimeoutBatchOwner;
+
+static bool
+_timeout_batch_clear_apply(const void *item, void *data)
+{
+	TimeoutBatchOwner *owner = (TimeoutBatchOwner *)data;
+
+	if (!_timeout_delete(owner->app_id, (const char *)item, owner->public_bus))
+	{
+		return false;
+	}
+
+	owner->found = (sqlite3_changes(timeout_db) > 0);
+	return true;
+}
+
+/**
+* @brief Get the array of a batch request, with at most TIMEOUT_BATCH_MAX items.
+*/
+static struct json_object *
+_timeout_batch_array(struct json_object *object, const char *name)
+{
+	struct json_object *array;
+
+	if (!json_object_object_get_ex(object, name, &array) ||
+	        !json_object_is_type(array, json_type_array))
+	{
+		return NULL;
+	}
+
+	int length = json_object_array_length(array);
+
+	if (length < 1 || length > TIMEOUT_BATCH_MAX)
+	{
+		return NULL;
+	}
+
+	return array;
+}
 
 /**
-* @brief When we wake, we should check to see if any non-wakeup timeouts
-*        have expired.
+* @brief Handle a timeout/setBatch message: set every timeout of the "timeouts"
+* array, each with the parameters of timeout/set.
+*
+* The reply has one result per timeout, in the same order:
+* {"returnValue":true,"results":[{"key":..,"returnValue":true,"kept_existing":..},
+*                                {"key":..,"returnValue":false,"errorText":..}]}
 *
 * @param  sh
 * @param  message
@@ -1464,120 +2134,1053 @@ static LSMethod timeout_methods[] =
 * @retval
 */
 static bool
-_resume_callback(LSHandle *sh, LSMessage *message, void *ctx)
-{
-	_update_timeouts();
-	return true;
-}
-
-static int
-_alarms_timeout_init(void)
+_alarm_timeout_set_batch(LSHandle *sh, LSMessage *message, void *ctx)
 {
 	bool retVal;
+	const char *app_instance_id;
+	struct json_object *object;
+	struct json_object *array;
+	bool public_bus;
+	bool changed = false;
+	int i;
 
-	gchar *timeout_db_name = g_build_filename(gSleepConfig.preference_dir,
-	                         TIMEOUT_DATABASE_NAME, NULL);
+	char *app_id = NULL;
+	GString *results = NULL;
+	char *payload = NULL;
 
-	if (gSleepConfig.disable_rtc_alarms)
+	object = json_tokener_parse(LSMessageGetPayload(message));
+
+	if (is_error(object))
 	{
-		SLEEPDLOG_DEBUG("RTC alarms disabled");
-		return 0;
+		goto malformed_json;
 	}
 
-	gchar *timeout_db_path = g_path_get_dirname(timeout_db_name);
-	g_mkdir_with_parents(timeout_db_path, S_IRWXU);
-	g_free(timeout_db_path);
+	array = _timeout_batch_array(object, "timeouts");
+
+	if (!array)
+	{
+		goto invalid_json;
+	}
 
-	retVal = smart_sql_open(timeout_db_name, &timeout_db);
+	app_instance_id = LSMessageGetApplicationID(message);
 
-	if (!retVal)
+	if (!app_instance_id)
 	{
-		SLEEPDLOG_ERROR(MSGID_DB_OPEN_ERR, 1, PMLOGKS("DBName", timeout_db_name),
-		                "Failed to open database");
-		goto error;
+		app_instance_id = "";
 	}
 
-	g_free(timeout_db_name);
+	app_id = _get_appid_dup(app_instance_id);
+	public_bus = LSMessageIsPublic(psh, message);
 
-	retVal = smart_sql_exec(timeout_db, kSysTimeoutDatabaseCreateSchema);
+	if (!_timeout_batch_begin())
+	{
+		goto unknown_error;
+	}
+
+	results = g_string_new(NULL);
+
+	for (i = 0; i < json_object_array_length(array); i++)
+	{
+		struct json_object *item = json_object_array_get_idx(array, i);
+		const char *key = json_object_get_string(json_object_object_get(item, "key"));
+		const char *errorText = NULL;
+		bool kept_existing = false;
+		_AlarmTimeout timeout;
+
+		if (i)
+		{
+			g_string_append_c(results, ',');
+		}
+
+		if (key)
+		{
+			char *escaped_key = g_strescape(key, NULL);
+			g_string_append_printf(results, "{\"key\":\"%s\",", escaped_key);
+			g_free(escaped_key);
+		}
+		else
+		{
+			g_string_append_c(results, '{');
+		}
+
+		if (!json_object_is_type(item, json_type_object))
+		{
+			errorText = TIMEOUT_SET_INVALID_TEXT;
+		}
+		else
+		{
+			errorText = _timeout_parse(item, app_id, public_bus, &timeout);
+		}
+
+		if (!errorText)
+		{
+			if (json_object_get_boolean(json_object_object_get(item, "keep_existing")) &&
+			        _timeout_exists(app_id, timeout.key, public_bus))
+			{
+				kept_existing = true;
+			}
+			else if (_timeout_batch_item(_timeout_batch_set_apply, &timeout, NULL))
+			{
+				changed = true;
+			}
+			else
+			{
+				errorText = "Could not set timeout.";
+			}
+		}
+
+		if (errorText)
+		{
+			g_string_append_printf(results, "\"returnValue\":false,\"errorText\":\"%s\"}",
+			                       errorText);
+		}
+		else
+		{
+			g_string_append_printf(results, "\"returnValue\":true,\"kept_existing\":%s}",
+			                       kept_existing ? "true" : "false");
+		}
+	}
+
+	// The results only hold once the batch is committed
+	if (!_timeout_batch_end(changed))
+	{
+		goto unknown_error;
+	}
+
+	payload = g_strdup_printf("{\"returnValue\":true,\"results\":[%s]}",
+	                          results->str);
+
+	retVal = LSMessageReply(sh, message, payload, NULL);
 
 	if (!retVal)
 	{
-		SLEEPDLOG_ERROR(MSGID_DB_CREATE_ERR, 0, "could not create database");
-		goto error;
+		SLEEPDLOG_WARNING(MSGID_LSMESSAGE_REPLY_FAIL, 0, "could not send reply");
 	}
 
-	retVal = smart_sql_exec(timeout_db, kSysTimeoutDatabaseCreateIndex);
+	goto cleanup;
+
+unknown_error:
+	retVal = LSMessageReply(sh, message, "{\"returnValue\":false,"
+	                        "\"errorText\":\"Could not set timeouts.\"}", NULL);
 
 	if (!retVal)
 	{
-		SLEEPDLOG_ERROR(MSGID_INDEX_CREATE_FAIL, 0, "could not create index");
-		goto error;
+		SLEEPDLOG_WARNING(MSGID_UNKNOWN_ERR, 0, "could not send reply <unknown error>");
 	}
 
-	/* Set up luna service */
+	goto cleanup;
+invalid_json:
+	LSMessageReplyErrorInvalidParams(sh, message);
+	goto cleanup;
+malformed_json:
+	LSMessageReplyErrorBadJSON(sh, message);
+	goto cleanup;
+cleanup:
 
-	psh = GetPalmService();
+	if (!is_error(object))
+	{
+		json_object_put(object);
+	}
 
-	LSError lserror;
-	LSErrorInit(&lserror);
+	if (results)
+	{
+		g_string_free(results, TRUE);
+	}
+
+	g_free(payload);
+
+	g_free(app_id);
+	return true;
+}
+
+/**
+* @brief Handle a timeout/clearBatch message: delete every timeout whose key is
+* in the "keys" array.
+*
+* The reply has one result per key, in the same order, false for a key which
+* has no timeout:
+* {"returnValue":true,"results":[{"key":..,"returnValue":true}]}
+*
+* @param  sh
+* @param  message
+* @param  ctx
+*
+* @retval
+*/
+static bool
+_alarm_timeout_clear_batch(LSHandle *sh, LSMessage *message, void *ctx)
+{
+	bool retVal;
+	const char *app_instance_id;
+	struct json_object *object;
+	struct json_object *array;
+	TimeoutBatchOwner owner;
+	bool changed = false;
+	int i;
+
+	char *app_id = NULL;
+	GString *results = NULL;
+	char *payload = NULL;
+
+	object = json_tokener_parse(LSMessageGetPayload(message));
 
-	if (!LSPalmServiceRegisterCategory(psh,
-	                                   "/timeout", timeout_methods /*public*/, NULL /*private*/, NULL, NULL,
-	                                   &lserror))
+	if (is_error(object))
 	{
-		SLEEPDLOG_ERROR(MSGID_CATEGORY_REG_FAIL, 1, PMLOGKS(ERRTEXT, lserror.message),
-		                "could not register category");
-		LSErrorFree(&lserror);
-		goto error;
+		goto malformed_json;
 	}
 
-	retVal = LSCall(LSPalmServiceGetPrivateConnection(psh),
-	                "palm://com.palm.bus/signal/addmatch",
-	                "{\"category\":\"/com/palm/power\",\"method\":\"resume\"}",
-	                _resume_callback, NULL, NULL, &lserror);
+	array = _timeout_batch_array(object, "keys");
 
-	if (!retVal)
+	if (!array)
 	{
-		SLEEPDLOG_ERROR(MSGID_METHOD_REG_ERR, 1, PMLOGKS(ERRTEXT, lserror.message),
-		                "could not register for suspend resume signal");
-		LSErrorFree(&lserror);
-		goto error;
+		goto invalid_json;
 	}
 
-	retVal = (update_reference_time(NULL, NULL) != invalid_time);
+	app_instance_id = LSMessageGetApplicationID(message);
 
-	if (!retVal)
+	if (!app_instance_id)
 	{
-		SLEEPDLOG_DEBUG("could not initialize reference clock");
+		app_instance_id = "";
 	}
 
-#ifndef WITHOUT_RTC_WATCHDOG
-	GTimerSource *timer_rtc_check = g_timer_source_new_seconds(5 * 60);
-	g_source_set_callback((GSource *)timer_rtc_check,
-	                      (GSourceFunc)_rtc_check, NULL, NULL);
-	g_source_attach((GSource *)timer_rtc_check, GetMainLoopContext());
-#endif
+	app_id = _get_appid_dup(app_instance_id);
+	owner.app_id = app_id;
+	owner.public_bus = LSMessageIsPublic(psh, message);
 
-	sTimerCheck = g_timer_source_new_seconds(60 * 60);
-	g_source_set_callback((GSource *)sTimerCheck,
-	                      (GSourceFunc)_timer_check, NULL, NULL);
-	g_source_attach((GSource *)sTimerCheck, GetMainLoopContext());
+	if (!_timeout_batch_begin())
+	{
+		goto unknown_error;
+	}
 
-	/** To support the deprecated interface */
-	int alarm_init(void);
-	alarm_init();
-	/*************/
+	results = g_string_new(NULL);
 
-	_update_timeouts();
+	for (i = 0; i < json_object_array_length(array); i++)
+	{
+		struct json_object *item = json_object_array_get_idx(array, i);
+		const char *key = NULL;
+
+		if (json_object_is_type(item, json_type_string))
+		{
+			key = json_object_get_string(item);
+		}
+
+		if (i)
+		{
+			g_string_append_c(results, ',');
+		}
+
+		if (!key)
+		{
+			g_string_append(results, "{\"returnValue\":false,\"errorText\":\"Invalid key.\"}");
+			continue;
+		}
+
+		char *escaped_key = g_strescape(key, NULL);
+
+		SLEEPDLOG_DEBUG("(%s,%s,%s)", app_id, key,
+		                owner.public_bus ? "public" : "private");
+
+		owner.found = false;
+
+		if (!_timeout_batch_item(_timeout_batch_clear_apply, key, &owner))
+		{
+			g_string_append_printf(results, "{\"key\":\"%s\",\"returnValue\":false,"
+			                       "\"errorText\":\"Could not clear timeout.\"}", escaped_key);
+		}
+		else if (!owner.found)
+		{
+			g_string_append_printf(results, "{\"key\":\"%s\",\"returnValue\":false,"
+			                       "\"errorText\":\"Could not find key.\"}", escaped_key);
+		}
+		else
+		{
+			changed = true;
+			g_string_append_printf(results, "{\"key\":\"%s\",\"returnValue\":true}",
+			                       escaped_key);
+		}
+
+		g_free(escaped_key);
+	}
+
+	// The results only hold once the batch is committed
+	if (!_timeout_batch_end(changed))
+	{
+		goto unknown_error;
+	}
+
+	payload = g_strdup_printf("{\"returnValue\":true,\"results\":[%s]}",
+	                          results->str);
+
+	retVal = LSMessageReply(sh, message, payload, NULL);
+
+	if (!retVal)
+	{
+		SLEEPDLOG_WARNING(MSGID_LSMESSAGE_REPLY_FAIL, 0, "could not send reply");
+	}
+
+	goto cleanup;
+
+unknown_error:
+	retVal = LSMessageReply(sh, message, "{\"returnValue\":false,"
+	                        "\"errorText\":\"Could not clear timeouts.\"}", NULL);
+
+	if (!retVal)
+	{
+		SLEEPDLOG_WARNING(MSGID_UNKNOWN_ERR, 0, "could not send reply <unknown error>");
+	}
+
+	goto cleanup;
+invalid_json:
+	LSMessageReplyErrorInvalidParams(sh, message);
+	goto cleanup;
+malformed_json:
+	LSMessageReplyErrorBadJSON(sh, message);
+	goto cleanup;
+cleanup:
+
+	if (!is_error(object))
+	{
+		json_object_put(object);
+	}
+
+	if (results)
+	{
+		g_string_free(results, TRUE);
+	}
+
+	g_free(payload);
+
+	g_free(app_id);
+	return true;
+}
+
+/**
+* @brief Append one row of a timeout/query to the reply.
+*/
+static void
+_timeout_query_row_json(GString *payload, sqlite3_stmt *st, bool first)
+{
+	const char *column;
+
+	column = (const char *)sqlite3_column_text(st, 1);
+	char *app_id = g_strescape(column ? column : "", NULL);
+	column = (const char *)sqlite3_column_text(st, 2);
+	char *key = g_strescape(column ? column : "", NULL);
+	column = (const char *)sqlite3_column_text(st, 3);
+	char *uri = g_strescape(column ? column : "", NULL);
+
+	g_string_append_printf(payload,
+	                       "%s{\"app_id\":\"%s\",\"key\":\"%s\",\"uri\":\"%s\",\"public_bus\":%s,"
+	                       "\"wakeup\":%s,\"calendar\":%s,\"expiry\":%lld,\"window_s\":%d,\"early_s\":%d,"
+	                       "\"period_s\":%d}",
+	                       first ? "" : ",", app_id, key, uri,
+	                       sqlite3_column_int(st, 4) ? "true" : "false",
+	                       sqlite3_column_int(st, 5) ? "true" : "false",
+	                       sqlite3_column_int(st, 6) ? "true" : "false",
+	                       (long long)sqlite3_column_int64(st, 7),
+	                       sqlite3_column_int(st, 8), sqlite3_column_int(st, 10),
+	                       sqlite3_column_int(st, 9));
+
+	g_free(app_id);
+	g_free(key);
+	g_free(uri);
+}
+
+/**
+* @brief Handle a timeout/query message and list pending timeouts, by increasing
+* expiry.
+*
+* All parameters are optional:
+*   "app_id"      only timeouts of this application
+*   "key_prefix"  only timeouts whose key starts with this prefix
+*   "wakeup"      only wakeup (true) or non-wakeup (false) timeouts
+*   "expiry_from", "expiry_to"  only timeouts expiring in this range (seconds
+*                 since the epoch, inclusive)
+*   "limit"       page size, 1 to TIMEOUT_QUERY_MAX (default TIMEOUT_QUERY_DEFAULT)
+*   "cursor"      "next_cursor" of the previous page
+*
+* Paging resumes after the (expiry, t1key) of the last timeout returned, so that
+* every page is a range scan of expiry_index, or of owner_index when an
+* app_id is given. On the public bus, callers only see their own timeouts.
+*
+* @param  sh
+* @param  message
+* @param  ctx
+*
+* @retval
+*/
+static bool
+_alarm_timeout_query(LSHandle *sh, LSMessage *message, void *ctx)
+{
+	bool retVal;
+	struct json_object *object;
+	struct json_object *param;
+	const char *app_id = NULL;
+	const char *key_prefix;
+	const char *cursor;
+	int limit = TIMEOUT_QUERY_DEFAULT;
+	int rc;
+	int i;
+	int rows = 0;
+	int bind = 1;
+	gint64 cursor_expiry = 0;
+	gint64 cursor_id = 0;
+	struct json_object *expiry_from = NULL;
+	struct json_object *expiry_to = NULL;
+	gint64 last_expiry = 0;
+	gint64 last_id = 0;
+
+	char *caller_app_id = NULL;
+	char *prefix_end = NULL;
+	GString *sql = NULL;
+	GString *payload = NULL;
+	sqlite3_stmt *st = NULL;
+
+	object = json_tokener_parse(LSMessageGetPayload(message));
+
+	if (is_error(object))
+	{
+		goto malformed_json;
+	}
+
+	bool public_bus = LSMessageIsPublic(psh, message);
+
+	if (public_bus)
+	{
+		const char *app_instance_id = LSMessageGetApplicationID(message);
+		caller_app_id = _get_appid_dup(app_instance_id ? app_instance_id : "");
+		app_id = caller_app_id;
+	}
+	else
+	{
+		app_id = json_object_get_string(json_object_object_get(object, "app_id"));
+	}
+
+	key_prefix = json_object_get_string(json_object_object_get(object,
+	                                    "key_prefix"));
+	cursor = json_object_get_string(json_object_object_get(object, "cursor"));
+
+	if (json_object_object_get_ex(object, "limit", &param))
+	{
+		limit = json_object_get_int(param);
+
+		if (limit < 1 || limit > TIMEOUT_QUERY_MAX)
+		{
+			goto invalid_json;
+		}
+	}
+
+	if (cursor && sscanf(cursor, "%" G_GINT64_FORMAT ":%" G_GINT64_FORMAT,
+	                     &cursor_expiry, &cursor_id) != 2)
+	{
+		goto invalid_json;
+	}
+
+	sql = g_string_new("SELECT t1key,app_id,key,uri,public_bus,wakeup,calendar,expiry,"
+	                   "IFNULL(window_s,0),IFNULL(period_s,0),IFNULL(early_s,0) FROM AlarmTimeout "
+	                   "WHERE 1");
+
+	if (app_id)
+	{
+		g_string_append(sql, " AND app_id=?");
+	}
+
+	if (public_bus)
+	{
+		g_string_append(sql, " AND public_bus=1");
+	}
+
+	/*
+	   A prefix is the range [prefix, prefix with its last byte incremented),
+	   which the index on (app_id, key) can serve, unlike LIKE.
+	   */
+	if (key_prefix && key_prefix[0])
+	{
+		g_string_append(sql, " AND key>=?");
+
+		prefix_end = g_strdup(key_prefix);
+
+		for (i = strlen(prefix_end) - 1; i >= 0; i--)
+		{
+			if ((unsigned char)prefix_end[i] < 0xff)
+			{
+				prefix_end[i]++;
+				prefix_end[i + 1] = '\0';
+				break;
+			}
+		}
+
+		if (i >= 0)
+		{
+			g_string_append(sql, " AND key<?");
+		}
+	}
+
+	if (json_object_object_get_ex(object, "wakeup", &param))
+	{
+		g_string_append(sql, json_object_get_boolean(param) ?
+		                " AND wakeup=1" : " AND wakeup=0");
+	}
+
+	if (json_object_object_get_ex(object, "expiry_from", &expiry_from))
+	{
+		g_string_append(sql, " AND expiry>=?");
+	}
+
+	if (json_object_object_get_ex(object, "expiry_to", &expiry_to))
+	{
+		g_string_append(sql, " AND expiry<=?");
+	}
+
+	if (cursor)
+	{
+		g_string_append(sql, " AND (expiry>? OR (expiry=? AND t1key>?))");
+	}
+
+	g_string_append(sql, " ORDER BY expiry,t1key LIMIT ?");
+
+	if (!timeout_db)
+	{
+		goto unknown_error;
+	}
+
+	rc = sqlite3_prepare_v2(timeout_db, sql->str, -1, &st, NULL);
+
+	if (rc != SQLITE_OK)
+	{
+		SLEEPDLOG_WARNING(MSGID_ALARM_TIMEOUT_SELECT, 2,
+		                  PMLOGKS(ERRTEXT, sqlite3_errmsg(timeout_db)),
+		                  PMLOGKFV(ERRCODE, "%d", rc), "");
+		goto unknown_error;
+	}
+
+	if (app_id)
+	{
+		sqlite3_bind_text(st, bind++, app_id, -1, SQLITE_STATIC);
+	}
+
+	if (key_prefix && key_prefix[0])
+	{
+		sqlite3_bind_text(st, bind++, key_prefix, -1, SQLITE_STATIC);
+
+		if (prefix_end[0])
+		{
+			sqlite3_bind_text(st, bind++, prefix_end, -1, SQLITE_STATIC);
+		}
+	}
+
+	if (expiry_from)
+	{
+		sqlite3_bind_int64(st, bind++, json_object_get_int64(expiry_from));
+	}
+
+	if (expiry_to)
+	{
+		sqlite3_bind_int64(st, bind++, json_object_get_int64(expiry_to));
+	}
+
+	if (cursor)
+	{
+		sqlite3_bind_int64(st, bind++, cursor_expiry);
+		sqlite3_bind_int64(st, bind++, cursor_expiry);
+		sqlite3_bind_int64(st, bind++, cursor_id);
+	}
+
+	// one more row than asked for tells whether there is a next page
+	sqlite3_bind_int(st, bind++, limit + 1);
+
+	payload = g_string_new("{\"returnValue\":true,\"timeouts\":[");
+
+	while ((rc = sqlite3_step(st)) == SQLITE_ROW)
+	{
+		if (rows == limit)
+		{
+			g_string_append_printf(payload, "],\"next_cursor\":\"%" G_GINT64_FORMAT ":%"
+			                       G_GINT64_FORMAT "\"}", last_expiry, last_id);
+			break;
+		}
+
+		_timeout_query_row_json(payload, st, rows == 0);
+
+		last_id = sqlite3_column_int64(st, 0);
+		last_expiry = sqlite3_column_int64(st, 7);
+		rows++;
+	}
+
+	if (rc != SQLITE_ROW && rc != SQLITE_DONE)
+	{
+		SLEEPDLOG_WARNING(MSGID_ALARM_TIMEOUT_SELECT, 2,
+		                  PMLOGKS(ERRTEXT, sqlite3_errmsg(timeout_db)),
+		                  PMLOGKFV(ERRCODE, "%d", rc), "");
+		goto unknown_error;
+	}
+
+	if (rc == SQLITE_DONE)
+	{
+		g_string_append(payload, "]}");
+	}
+
+	retVal = LSMessageReply(sh, message, payload->str, NULL);
+
+	if (!retVal)
+	{
+		SLEEPDLOG_WARNING(MSGID_LSMESSAGE_REPLY_FAIL, 0, "could not send reply");
+	}
+
+	goto cleanup;
+
+unknown_error:
+	retVal = LSMessageReply(sh, message, "{\"returnValue\":false,"
+	                        "\"errorText\":\"Could not query timeouts.\"}", NULL);
+
+	if (!retVal)
+	{
+		SLEEPDLOG_WARNING(MSGID_UNKNOWN_ERR, 0, "could not send reply <unknown error>");
+	}
+
+	goto cleanup;
+invalid_json:
+	LSMessageReplyErrorInvalidParams(sh, message);
+	goto cleanup;
+malformed_json:
+	LSMessageReplyErrorBadJSON(sh, message);
+	goto cleanup;
+cleanup:
+
+	if (!is_error(object))
+	{
+		json_object_put(object);
+	}
+
+	if (st)
+	{
+		sqlite3_finalize(st);
+	}
+
+	if (sql)
+	{
+		g_string_free(sql, TRUE);
+	}
+
+	if (payload)
+	{
+		g_string_free(payload, TRUE);
+	}
+
+	g_free(prefix_end);
+	g_free(caller_app_id);
+	return true;
+}
+
+static LSMethod timeout_methods[] =
+{
+	{ "set", _alarm_timeout_set },
+	{ "clear", _alarm_timeout_clear },
+	{ "setBatch", _alarm_timeout_set_batch },
+	{ "clearBatch", _alarm_timeout_clear_batch },
+	{ "query", _alarm_timeout_query },
+	{ },
+};
+
+/**
+* @brief Tell whether a column exists in the AlarmTimeout table.
+*/
+static bool
+_timeout_column_exists(const char *column)
+{
+	int rc;
+	char **table;
+	int noRows, noCols;
+	char *zErrMsg;
+	int i;
+	bool found = false;
+
+	rc = sqlite3_get_table(timeout_db, "PRAGMA table_info(AlarmTimeout)",
+	                       &table, &noRows, &noCols, &zErrMsg);
+
+	if (rc != SQLITE_OK)
+	{
+		sqlite3_free(zErrMsg);
+		return false;
+	}
+
+	/* the second column of table_info is the column name */
+	for (i = 1; i <= noRows && !found; i++)
+	{
+		found = (g_strcmp0(table[i * noCols + 1], column) == 0);
+	}
+
+	sqlite3_free_table(table);
+	return found;
+}
+
+/**
+* @brief Add a column to the AlarmTimeout table, unless a release without
+* schema versions already added it.
+*/
+static bool
+_timeout_add_column(const char *column, const char *definition)
+{
+	if (_timeout_column_exists(column))
+	{
+		return true;
+	}
+
+	char *sql = g_strdup_printf("ALTER TABLE AlarmTimeout ADD COLUMN %s %s",
+	                            column, definition);
+	bool retVal = smart_sql_exec(timeout_db, sql);
+	g_free(sql);
+
+	return retVal;
+}
+
+static bool
+_timeout_migrate_activity(void)
+{
+	return _timeout_add_column("activity_id", "TEXT") &&
+	       _timeout_add_column("activity_duration_ms", "INTEGER");
+}
+
+static bool
+_timeout_migrate_window_period(void)
+{
+	return _timeout_add_column("window_s", "INTEGER DEFAULT 0") &&
+	       _timeout_add_column("period_s", "INTEGER DEFAULT 0");
+}
+
+/*
+   At most one timeout per (app_id, key, public_bus). The index serves the
+   lookups of timeout/set, timeout/clear and keep_existing, and key prefix
+   queries. Duplicates left by older versions are dropped, keeping the latest.
+   */
+static bool
+_timeout_migrate_owner_index(void)
+{
+	if (!smart_sql_exec(timeout_db,
+	                    "DELETE FROM AlarmTimeout WHERE t1key NOT IN "
+	                    "(SELECT MAX(t1key) FROM AlarmTimeout GROUP BY app_id, key, public_bus)"))
+	{
+		return false;
+	}
+
+	SLEEPDLOG_DEBUG("removed %d duplicate timeouts", sqlite3_changes(timeout_db));
+
+	return smart_sql_exec(timeout_db,
+	                      "CREATE UNIQUE INDEX IF NOT EXISTS owner_index "
+	                      "on AlarmTimeout (app_id, key, public_bus)") &&
+	       smart_sql_exec(timeout_db, "DROP INDEX IF EXISTS app_key_index");
+}
+
+/*
+   The next wakeup is looked up on every idle check and before every suspend.
+   Index wakeup timeouts by deadline so that the lookup does not walk past
+   non-wakeup ones: with a partial index where sqlite supports them (3.8.0),
+   else with wakeup as the leading column.
+   */
+static bool
+_timeout_migrate_wakeup_index(void)
+{
+	const char *create_index = sqlite3_libversion_number() >= 3008000 ?
+	                           "CREATE INDEX IF NOT EXISTS wakeup_index "
+	                           "on AlarmTimeout (deadline) WHERE wakeup=1" :
+	                           "CREATE INDEX IF NOT EXISTS wakeup_index "
+	                           "on AlarmTimeout (wakeup, deadline)";
+
+	return _timeout_add_column("deadline", "INTEGER") &&
+	       smart_sql_exec(timeout_db,
+	                      "UPDATE AlarmTimeout SET deadline=expiry+IFNULL(window_s,0)") &&
+	       smart_sql_exec(timeout_db, create_index);
+}
+
+/*
+   Non-wakeup timeouts used to take their advance on a wake from window_s, which
+   is the delay of wakeup ones: move it to its own column.
+   */
+static bool
+_timeout_migrate_early(void)
+{
+	return _timeout_add_column("early_s", "INTEGER DEFAULT 0") &&
+	       smart_sql_exec(timeout_db,
+	                      "UPDATE AlarmTimeout SET early_s=IFNULL(window_s,0),window_s=0,"
+	                      "deadline=expiry WHERE wakeup=0");
+}
+
+/*
+   Schema versions, stored in PRAGMA user_version. Each migration brings the
+   database from the previous version to its own; append new ones at the end.
+   */
+static const struct
+{
+	int version;
+	const char *name;
+	bool (*migrate)(void);
+} kTimeoutMigrations[] =
+{
+	{ 1, "activity columns",           _timeout_migrate_activity },
+	{ 2, "window_s and period_s",      _timeout_migrate_window_period },
+	{ 3, "unique owner index",         _timeout_migrate_owner_index },
+	{ 4, "wakeup deadline index",      _timeout_migrate_wakeup_index },
+	{ 5, "early_s column",             _timeout_migrate_early },
+};
+
+static int
+_timeout_schema_version(void)
+{
+	sqlite3_stmt *st = NULL;
+	int version = -1;
+
+	if (sqlite3_prepare_v2(timeout_db, "PRAGMA user_version", -1, &st,
+	                       NULL) == SQLITE_OK &&
+	        sqlite3_step(st) == SQLITE_ROW)
+	{
+		version = sqlite3_column_int(st, 0);
+	}
+
+	sqlite3_finalize(st);
+	return version;
+}
+
+/**
+* @brief Run the migrations the database has not seen yet, each in its own
+* transaction together with the version update.
+*/
+static bool
+_timeout_migrate(void)
+{
+	int version = _timeout_schema_version();
+	int i;
+
+	if (version < 0)
+	{
+		return false;
+	}
+
+	for (i = 0; i < G_N_ELEMENTS(kTimeoutMigrations); i++)
+	{
+		if (kTimeoutMigrations[i].version <= version)
+		{
+			continue;
+		}
+
+		SLEEPDLOG_DEBUG("migrating timeout database to version %d (%s)",
+		                kTimeoutMigrations[i].version, kTimeoutMigrations[i].name);
+
+		char *set_version = g_strdup_printf("PRAGMA user_version=%d",
+		                                    kTimeoutMigrations[i].version);
+		bool retVal = smart_sql_exec(timeout_db, "BEGIN TRANSACTION") &&
+		              kTimeoutMigrations[i].migrate() &&
+		              smart_sql_exec(timeout_db, set_version) &&
+		              smart_sql_exec(timeout_db, "COMMIT");
+		g_free(set_version);
+
+		if (!retVal)
+		{
+			smart_sql_exec(timeout_db, "ROLLBACK");
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+* @brief Open the timeout database, creating or upgrading its schema.
+*/
+static bool
+_timeout_db_open(void)
+{
+	bool retVal;
+
+	gchar *timeout_db_path = g_path_get_dirname(sTimeoutDbName);
+	g_mkdir_with_parents(timeout_db_path, S_IRWXU);
+	g_free(timeout_db_path);
+
+	retVal = smart_sql_open(sTimeoutDbName, &timeout_db);
+
+	if (!retVal)
+	{
+		SLEEPDLOG_ERROR(MSGID_DB_OPEN_ERR, 1, PMLOGKS("DBName", sTimeoutDbName),
+		                "Failed to open database");
+		return false;
+	}
+
+	retVal = smart_sql_exec(timeout_db, kSysTimeoutDatabaseCreateSchema);
+
+	if (!retVal)
+	{
+		SLEEPDLOG_ERROR(MSGID_DB_CREATE_ERR, 0, "could not create database");
+		return false;
+	}
+
+	retVal = smart_sql_exec(timeout_db, kSysTimeoutDatabaseCreateIndex);
+
+	if (!retVal)
+	{
+		SLEEPDLOG_ERROR(MSGID_INDEX_CREATE_FAIL, 0, "could not create index");
+		return false;
+	}
+
+	retVal = _timeout_migrate();
+
+	if (!retVal)
+	{
+		SLEEPDLOG_ERROR(MSGID_DB_CREATE_ERR, 0, "could not upgrade database");
+		return false;
+	}
+
+	return true;
+}
+
+/**
+* @brief Called when the background integrity check finds the database corrupted:
+* reopen it from what can be salvaged, and reschedule.
+*/
+static void
+_timeout_db_corrupt(sqlite3 *db, gpointer user_data)
+{
+	int i;
+	bool opened;
+
+	SLEEPDLOG_ERROR(MSGID_DB_INTEGRITY_CHK_ERR, 1, PMLOGKS(PATH, sTimeoutDbName),
+	                "Db corrupted");
+
+	// The suspend thread may be about to arm a wakeup from the old handle
+	pthread_mutex_lock(&sTimeoutDbMutex);
+
+	for (i = 0; i < kTimeoutStmtLast; i++)
+	{
+		sqlite3_finalize(sTimeoutStmts[i]);
+		sTimeoutStmts[i] = NULL;
+	}
+
+	smart_sql_close(timeout_db);
+	timeout_db = NULL;
+
+	if (!smart_sql_salvage(sTimeoutDbName))
+	{
+		remove(sTimeoutDbName);
+	}
+
+	opened = _timeout_db_open();
+
+	if (!opened)
+	{
+		smart_sql_close(timeout_db);
+		timeout_db = NULL;
+	}
+
+	pthread_mutex_unlock(&sTimeoutDbMutex);
+
+	if (opened)
+	{
+		_update_timeouts();
+	}
+}
+
+/**
+* @brief Open the database, off the main thread: the integrity check and
+* upgrades may take a while.
+*/
+static int
+_timeout_db_init(void)
+{
+	if (gSleepConfig.disable_rtc_alarms)
+	{
+		return 0;
+	}
+
+	sTimeoutDbName = g_build_filename(gSleepConfig.preference_dir,
+	                                  TIMEOUT_DATABASE_NAME, NULL);
+
+	if (!_timeout_db_open())
+	{
+		smart_sql_close(timeout_db);
+		timeout_db = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+void alarm_db_unload(void);
+
+static int
+_alarms_timeout_init(void)
+{
+	bool retVal;
+
+	if (gSleepConfig.disable_rtc_alarms)
+	{
+		SLEEPDLOG_DEBUG("RTC alarms disabled");
+		return 0;
+	}
+
+	if (!timeout_db)
+	{
+		goto error;
+	}
+
+	/* Set up luna service */
+
+	psh = GetPalmService();
+
+	LSError lserror;
+	LSErrorInit(&lserror);
+
+	if (!LSPalmServiceRegisterCategoryNoted(psh,
+	                                        "/timeout", timeout_methods /*public*/, NULL /*private*/, NULL,
+	                                        &lserror))
+	{
+		SLEEPDLOG_ERROR(MSGID_CATEGORY_REG_FAIL, 1, PMLOGKS(ERRTEXT, lserror.message),
+		                "could not register category");
+		LSErrorFree(&lserror);
+		goto error;
+	}
+
+	retVal = (update_reference_time(NULL, NULL) != invalid_time);
+
+	if (!retVal)
+	{
+		SLEEPDLOG_DEBUG("could not initialize reference clock");
+	}
+
+#ifndef WITHOUT_RTC_WATCHDOG
+	GTimerSource *timer_rtc_check = g_timer_source_new_seconds(5 * 60);
+	g_source_set_callback((GSource *)timer_rtc_check,
+	                      (GSourceFunc)_rtc_check, NULL, NULL);
+	g_source_attach((GSource *)timer_rtc_check, GetMainLoopContext());
+#endif
+
+	GTimerSource *timer_check = g_timer_source_new_seconds(60 * 60);
+	g_source_set_callback((GSource *)timer_check,
+	                      (GSourceFunc)_timer_check, NULL, NULL);
+	g_source_attach((GSource *)timer_check, GetMainLoopContext());
+
+	// update_timeouts_on_resume() reads it from the suspend thread.
+	pthread_mutex_lock(&sTimeoutDbMutex);
+	sTimerCheck = timer_check;
+	pthread_mutex_unlock(&sTimeoutDbMutex);
+
+	/** To support the deprecated interface, loaded on first use */
+	int alarm_init(void);
+	alarm_init();
+	/*************/
+
+	_update_timeouts();
+
+	/* The full integrity check runs once we are up */
+	smart_sql_check_start(timeout_db, _timeout_db_corrupt, NULL);
 
 	return 0;
 
 error:
+	/* alarm_init() will not consume what _alarm_db_load() parsed */
+	alarm_db_unload();
 	return -1;
 }
 
-INIT_FUNC(INIT_FUNC_END, _alarms_timeout_init);
+INIT_FUNC_ASYNC("config_init", _timeout_db_init);
+INIT_FUNC("config_init _timeout_db_init _alarm_db_load", _alarms_timeout_init);
 
 /* @} END OF NewInterface */
 
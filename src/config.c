@@ -36,11 +36,18 @@
 #include <errno.h>
 #include <string.h>
 #include <unistd.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sys/inotify.h>
+#include <cjson/json.h>
+#include <luna-service2/lunaservice.h>
 
 #include "config.h"
 #include "init.h"
+#include "main.h"
 #include "defines.h"
 #include "logging.h"
+#include "lunaservice_utils.h"
 
 /**
  * default sleepd config
@@ -57,6 +64,7 @@ SleepConfiguration gSleepConfig =
 
 	.suspend_with_charger = 0,
 	.disable_rtc_alarms = 0,
+	.dark_wake = false,
 	/* Visual indicator: Turn on led when screen turns off, turn off led before we go to suspend. */
 	.visual_leds_suspend = 0,
 
@@ -68,30 +76,275 @@ SleepConfiguration gSleepConfig =
 	.fasthalt = false
 };
 
-#define CONFIG_GET_INT(keyfile,cat,name,var)                    \
-do {                                                            \
-    int intVal;                                                 \
-    GError *gerror = NULL;                                      \
-    intVal = g_key_file_get_integer(keyfile,cat,name,&gerror);  \
-    if (!gerror) {                                              \
-        var = intVal;                                           \
-        SLEEPDLOG_DEBUG(#var " = %d", intVal);                          \
-    }                                                           \
-    else { g_error_free(gerror); }                              \
-} while (0)
-
-#define CONFIG_GET_BOOL(keyfile,cat,name,var)                   \
-do {                                                            \
-    bool boolVal;                                               \
-    GError *gerror = NULL;                                      \
-    boolVal = g_key_file_get_boolean(keyfile,cat,name,&gerror); \
-    if (!gerror) {                                              \
-        var = boolVal;                                          \
-        SLEEPDLOG_DEBUG(#var " = %s",                                   \
-                  boolVal ? "true" : "false");                  \
-    }                                                           \
-    else { g_error_free(gerror); }                              \
-} while (0)
+typedef enum
+{
+	kConfigInt,
+	kConfigBool,
+} ConfigType;
+
+/**
+ * A key of sleepd.conf, and the field of SleepConfiguration it sets.
+ */
+typedef struct
+{
+	const char *group;
+	const char *name;
+	ConfigType  type;
+	size_t      offset;
+	int         divisor;     // for ints given in a finer unit than the field
+	int         min;         // smallest int accepted, in the unit given
+	bool        reloadable;  // false if only read at init
+} ConfigKey;
+
+#define CONFIG_KEY(group, name, type, field, divisor, min, reloadable) \
+	{ group, name, type, offsetof(SleepConfiguration, field), divisor, min, reloadable }
+
+static const ConfigKey sConfigKeys[] =
+{
+	/// [general]
+	CONFIG_KEY("general", "debug", kConfigInt, debug, 1, 0, true),
+
+	/// [suspend]
+	CONFIG_KEY("suspend", "wait_idle_ms", kConfigInt, wait_idle_ms, 1, 1, true),
+	CONFIG_KEY("suspend", "after_resume_idle_ms", kConfigInt, after_resume_idle_ms, 1, 1,
+	           true),
+	CONFIG_KEY("suspend", "wait_suspend_response_ms", kConfigInt, wait_suspend_response_ms, 1,
+	           1, true),
+	CONFIG_KEY("suspend", "wait_prepare_suspend_ms", kConfigInt, wait_prepare_suspend_ms, 1,
+	           1, true),
+	CONFIG_KEY("suspend", "wait_alarms_ms", kConfigInt, wait_alarms_s, 1000, 0, true),
+	CONFIG_KEY("suspend", "suspend_with_charger", kConfigBool, suspend_with_charger, 1, 0,
+	           true),
+	CONFIG_KEY("suspend", "disable_rtc_alarms", kConfigBool, disable_rtc_alarms, 1, 0, false),
+	CONFIG_KEY("suspend", "dark_wake", kConfigBool, dark_wake, 1, 0, true),
+	CONFIG_KEY("suspend", "visual_leds_suspend", kConfigBool, visual_leds_suspend, 1, 0, true),
+	CONFIG_KEY("suspend", "fasthalt", kConfigBool, fasthalt, 1, 0, true),
+};
+
+#define CONFIG_FIELD(config, key, ctype) \
+	(*(ctype *)((char *)(config) + (key)->offset))
+
+/*
+   gSleepConfig is only written by the main thread, through ConfigPublish(), with
+   sConfigMutex held. The main thread may read it directly, other threads copy it
+   with ConfigSnapshot(). The generation is the number of writes so far.
+   */
+static pthread_mutex_t sConfigMutex = PTHREAD_MUTEX_INITIALIZER;
+static int sConfigGeneration = 0;
+
+static gchar *sConfigPath = NULL;
+static int sConfigNotifyFd = -1;
+
+/**
+ * @brief Number of times the config was changed since init.
+ */
+int
+ConfigGeneration(void)
+{
+	pthread_mutex_lock(&sConfigMutex);
+	int generation = sConfigGeneration;
+	pthread_mutex_unlock(&sConfigMutex);
+
+	return generation;
+}
+
+/**
+ * @brief Copy the current config. Safe from any thread.
+ *
+ * @retval Generation of the copy
+ */
+int
+ConfigSnapshot(SleepConfiguration *config)
+{
+	pthread_mutex_lock(&sConfigMutex);
+	*config = gSleepConfig;
+	int generation = sConfigGeneration;
+	pthread_mutex_unlock(&sConfigMutex);
+
+	return generation;
+}
+
+/**
+ * @brief Replace the current config, and bump the generation. Main thread only.
+ */
+void
+ConfigPublish(const SleepConfiguration *config)
+{
+	pthread_mutex_lock(&sConfigMutex);
+	gSleepConfig = *config;
+	int generation = ++sConfigGeneration;
+	pthread_mutex_unlock(&sConfigMutex);
+
+	SLEEPDLOG_DEBUG("config generation %d", generation);
+}
+
+static const ConfigKey *
+config_key_lookup(const char *name)
+{
+	int i;
+
+	for (i = 0; i < G_N_ELEMENTS(sConfigKeys); i++)
+	{
+		if (!strcmp(sConfigKeys[i].name, name))
+		{
+			return &sConfigKeys[i];
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief Set the keys found in the config file, skipping the keys only read at init
+ * unless this is init.
+ */
+static void
+config_load_keys(GKeyFile *config_file, SleepConfiguration *config, bool init)
+{
+	int i;
+
+	for (i = 0; i < G_N_ELEMENTS(sConfigKeys); i++)
+	{
+		const ConfigKey *key = &sConfigKeys[i];
+		GError *gerror = NULL;
+
+		if (!init && !key->reloadable)
+		{
+			continue;
+		}
+
+		if (key->type == kConfigInt)
+		{
+			int intVal = g_key_file_get_integer(config_file, key->group, key->name, &gerror);
+
+			if (!gerror && intVal < key->min)
+			{
+				SLEEPDLOG_WARNING(MSGID_CONFIG_VALUE_ERR, 1, PMLOGKS("Key", key->name),
+				                  "%d is below %d, ignored", intVal, key->min);
+			}
+			else if (!gerror)
+			{
+				CONFIG_FIELD(config, key, int) = intVal / key->divisor;
+				SLEEPDLOG_DEBUG("%s = %d", key->name, intVal);
+			}
+		}
+		else
+		{
+			bool boolVal = g_key_file_get_boolean(config_file, key->group, key->name,
+			                                      &gerror);
+
+			if (!gerror)
+			{
+				CONFIG_FIELD(config, key, bool) = boolVal;
+				SLEEPDLOG_DEBUG("%s = %s", key->name, boolVal ? "true" : "false");
+			}
+		}
+
+		if (gerror)
+		{
+			g_error_free(gerror);
+		}
+	}
+}
+
+static bool
+config_load(bool init)
+{
+	GKeyFile *config_file = g_key_file_new();
+
+	if (!config_file)
+	{
+		return false;
+	}
+
+	bool retVal = g_key_file_load_from_file(config_file, sConfigPath,
+	                                        G_KEY_FILE_NONE, NULL);
+
+	if (retVal)
+	{
+		SleepConfiguration config = gSleepConfig;
+
+		config_load_keys(config_file, &config, init);
+		ConfigPublish(&config);
+	}
+	else
+	{
+		SLEEPDLOG_WARNING(MSGID_CONFIG_FILE_LOAD_ERR, 1, PMLOGKS(PATH, sConfigPath),
+		                  "cannot load config file");
+	}
+
+	g_key_file_free(config_file);
+
+	return retVal;
+}
+
+/**
+ * @brief Reload sleepd.conf when it is written, or replaced by a rename.
+ */
+static gboolean
+config_notify(GIOChannel *channel, GIOCondition condition, gpointer data)
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	bool changed = false;
+	ssize_t len;
+
+	while ((len = read(sConfigNotifyFd, buf, sizeof(buf))) > 0)
+	{
+		char *ptr = buf;
+
+		while (ptr < buf + len)
+		{
+			struct inotify_event *event = (struct inotify_event *)ptr;
+
+			if (event->len && !strcmp(event->name, "sleepd.conf"))
+			{
+				changed = true;
+			}
+
+			ptr += sizeof(struct inotify_event) + event->len;
+		}
+	}
+
+	if (changed)
+	{
+		SLEEPDLOG_DEBUG("%s changed, reloading", sConfigPath);
+		config_load(false);
+	}
+
+	return TRUE;
+}
+
+static void
+config_watch(void)
+{
+	sConfigNotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+	if (sConfigNotifyFd < 0)
+	{
+		SLEEPDLOG_WARNING(MSGID_CONFIG_WATCH_ERR, 1, PMLOGKS(ERRTEXT, strerror(errno)),
+		                  "cannot watch config file");
+		return;
+	}
+
+	// Watch the directory, as the file may be replaced rather than written
+	if (inotify_add_watch(sConfigNotifyFd, WEBOS_INSTALL_DEFAULTCONFDIR,
+	                      IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+	{
+		SLEEPDLOG_WARNING(MSGID_CONFIG_WATCH_ERR, 1, PMLOGKS(ERRTEXT, strerror(errno)),
+		                  "cannot watch config file");
+		close(sConfigNotifyFd);
+		sConfigNotifyFd = -1;
+		return;
+	}
+
+	GIOChannel *channel = g_io_channel_unix_new(sConfigNotifyFd);
+	GSource *source = g_io_create_watch(channel, G_IO_IN);
+
+	g_source_set_callback(source, (GSourceFunc)config_notify, NULL, NULL);
+	g_source_attach(source, GetMainLoopContext());
+	g_source_unref(source);
+	g_io_channel_unref(channel);
+}
 
 static int
 config_init(void)
@@ -105,68 +358,162 @@ config_init(void)
 		perror("Sleepd: Could not mkdir the preferences dir.");
 	}
 
-	GKeyFile *config_file = NULL;
-	bool retVal;
+	// Load default values from configuration file
+	sConfigPath = g_build_filename(WEBOS_INSTALL_DEFAULTCONFDIR, "sleepd.conf", NULL);
 
-	config_file = g_key_file_new();
+	config_load(true);
+	config_watch();
 
-	if (!config_file)
-	{
-		return -1;
-	}
+	return 0;
+}
 
-	// Load default values from configuration file
-	char *config_path =
-	    g_build_filename(WEBOS_INSTALL_DEFAULTCONFDIR, "sleepd.conf", NULL);
-	retVal = g_key_file_load_from_file(config_file, config_path,
-	                                   G_KEY_FILE_NONE, NULL);
+INIT_FUNC("", config_init);
 
-	if (retVal)
+static void
+config_reply(LSHandle *sh, LSMessage *message, int generation,
+             const SleepConfiguration *config)
+{
+	GString *str = g_string_sized_new(512);
+	int i;
+
+	g_string_append_printf(str, "{\"returnValue\":true,\"generation\":%d,\"config\":{",
+	                       generation);
+
+	for (i = 0; i < G_N_ELEMENTS(sConfigKeys); i++)
 	{
+		const ConfigKey *key = &sConfigKeys[i];
+
+		g_string_append_printf(str, "%s\"%s\":", i ? "," : "", key->name);
+
+		if (key->type == kConfigInt)
+		{
+			g_string_append_printf(str, "%d", CONFIG_FIELD(config, key, int) * key->divisor);
+		}
+		else
+		{
+			g_string_append(str, CONFIG_FIELD(config, key, bool) ? "true" : "false");
+		}
+	}
 
-		/// [general]
-		CONFIG_GET_INT(config_file, "general", "debug", gSleepConfig.debug);
+	g_string_append(str, "}}");
 
+	LSError lserror;
+	LSErrorInit(&lserror);
 
-		/// [suspend]
-		CONFIG_GET_INT(config_file, "suspend", "wait_idle_ms",
-		               gSleepConfig.wait_idle_ms);
-		CONFIG_GET_INT(config_file, "suspend", "after_resume_idle_ms",
-		               gSleepConfig.after_resume_idle_ms);
-		CONFIG_GET_INT(config_file, "suspend", "wait_suspend_response_ms",
-		               gSleepConfig.wait_suspend_response_ms);
-		CONFIG_GET_INT(config_file, "suspend", "wait_prepare_suspend_ms",
-		               gSleepConfig.wait_prepare_suspend_ms);
-		CONFIG_GET_BOOL(config_file, "suspend", "wait_alarms_ms",
-		                gSleepConfig.wait_alarms_s);
+	if (!LSMessageReply(sh, message, str->str, &lserror))
+	{
+		LSErrorPrint(&lserror, stderr);
+		LSErrorFree(&lserror);
+	}
 
-		CONFIG_GET_BOOL(config_file, "suspend", "suspend_with_charger",
-		                gSleepConfig.suspend_with_charger);
+	g_string_free(str, TRUE);
+}
 
-		CONFIG_GET_BOOL(config_file, "suspend", "disable_rtc_alarms",
-		                gSleepConfig.disable_rtc_alarms);
+/**
+ * @brief Get the current config, with its generation.
+ *
+ * luna://com.palm.sleep/config/get
+ *
+ * {"returnValue":true,"generation":3,"config":{"debug":0,"wait_idle_ms":500,...}}
+ */
+static bool
+configGet(LSHandle *sh, LSMessage *message, void *user_data)
+{
+	SleepConfiguration config;
+	int generation = ConfigSnapshot(&config);
 
-		CONFIG_GET_BOOL(config_file, "suspend", "visual_leds_suspend",
-		                gSleepConfig.visual_leds_suspend);
+	config_reply(sh, message, generation, &config);
+	return true;
+}
 
-		CONFIG_GET_BOOL(config_file, "suspend", "fasthalt",
-		                gSleepConfig.fasthalt);
+/**
+ * @brief Change some keys of the config, all of them or none. The keys are named as
+ * in sleepd.conf, and the ones only read at init cannot be set. Timeouts must be
+ * positive. The values stay until set again, or until sleepd.conf is changed and
+ * sets them.
+ *
+ * luna://com.palm.sleep/config/set
+ *
+ * {"wait_idle_ms":2000,"suspend_with_charger":true}
+ *
+ * Replies as /config/get with the new config.
+ */
+static bool
+configSet(LSHandle *sh, LSMessage *message, void *user_data)
+{
+	struct json_object *object = json_tokener_parse(LSMessageGetPayload(message));
+	SleepConfiguration config = gSleepConfig;
+
+	if (is_error(object))
+	{
+		LSMessageReplyErrorBadJSON(sh, message);
+		return true;
 	}
-	else
+
+	json_object_object_foreach(object, name, value)
 	{
-		SLEEPDLOG_WARNING(MSGID_CONFIG_FILE_LOAD_ERR, 1, PMLOGKS(PATH, config_path),
-		                  "cannot load config file");
+		const ConfigKey *key = config_key_lookup(name);
+
+		if (!key || !key->reloadable || !value)
+		{
+			goto invalid_params;
+		}
+
+		if (key->type == kConfigInt && json_object_is_type(value, json_type_int))
+		{
+			int intVal = json_object_get_int(value);
+
+			if (intVal < key->min)
+			{
+				goto invalid_params;
+			}
+
+			CONFIG_FIELD(&config, key, int) = intVal / key->divisor;
+		}
+		else if (key->type == kConfigBool && json_object_is_type(value, json_type_boolean))
+		{
+			CONFIG_FIELD(&config, key, bool) = json_object_get_boolean(value);
+		}
+		else
+		{
+			goto invalid_params;
+		}
 	}
 
-	g_free(config_path);
+	json_object_put(object);
+
+	ConfigPublish(&config);
+	config_reply(sh, message, ConfigGeneration(), &config);
+	return true;
+
+invalid_params:
+	json_object_put(object);
+	LSMessageReplyErrorInvalidParams(sh, message);
+	return true;
+}
+
+LSMethod config_methods[] =
+{
+	{ "get", configGet },
+	{ "set", configSet },
+	{ },
+};
+
+static int
+config_lunabus_init(void)
+{
+	LSError lserror;
+	LSErrorInit(&lserror);
 
-	if (config_file)
+	if (!LSRegisterCategoryNoted(GetLunaServiceHandle(), "/config", config_methods,
+	                             NULL, &lserror))
 	{
-		g_key_file_free(config_file);
+		LSErrorPrint(&lserror, stderr);
+		LSErrorFree(&lserror);
+		return -1;
 	}
 
 	return 0;
 }
 
-
-INIT_FUNC(INIT_FUNC_FIRST, config_init);
+INIT_FUNC("config_init", config_lunabus_init);
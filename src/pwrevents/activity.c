@@ -29,15 +29,21 @@
 #include <glib.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <luna-service2/lunaservice.h>
 
 #include "suspend.h"
 #include "main.h"
 #include "clock.h"
+#include "timesource.h"
 #include "logging.h"
 #include "activity.h"
+#include "activity_ledger.h"
 #include "init.h"
+#include "config.h"
 
 //#include "metrics.h"
 
@@ -50,6 +56,15 @@
 
 #define LOG_DOMAIN "PWREVENT-ACTIVITY: "
 
+#define ACTIVITY_CHECKPOINT_FILE     "activities.ckpt"
+#define ACTIVITY_CHECKPOINT_MAGIC    0x534c4143
+#define ACTIVITY_CHECKPOINT_VERSION  1
+#define ACTIVITY_CHECKPOINT_MAX      128
+#define ACTIVITY_CHECKPOINT_ID_MAX   120
+
+// Max time a roster change may stay out of the checkpoint file.
+#define ACTIVITY_CHECKPOINT_MS       1000
+
 /**
  * @defgroup PowerEvents    Power Events
  * @ingroup Sleepd
@@ -78,18 +93,246 @@ typedef struct
 	int duration_ms;
 
 	char *activity_id;
+
+	gint64 end_boot_ms;  // end_time against CLOCK_BOOTTIME, survives sleepd restarts
+
+	PwrEventCharge charge;
 } Activity;
 
+/**
+* @brief Layout of the checkpoint file the roster is mapped to, so that in-flight
+* activities survive a restart of sleepd. The file is only valid for the boot it was
+* written in, since the end times are against CLOCK_BOOTTIME.
+*/
+
+typedef struct
+{
+	gint64 end_boot_ms;
+	gint32 duration_ms;
+	gint32 reserved;
+	char activity_id[ACTIVITY_CHECKPOINT_ID_MAX];
+} ActivityCheckpointRecord;
+
+typedef struct
+{
+	guint32 magic;
+	guint32 version;
+	guint32 generation;  // odd while a checkpoint is being written
+	guint32 count;
+	char boot_id[40];
+
+	ActivityCheckpointRecord records[ACTIVITY_CHECKPOINT_MAX];
+} ActivityCheckpoint;
+
 GQueue *activity_roster = NULL;
 pthread_mutex_t activity_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 bool gFrozen = false;
 
+static ActivityCheckpoint *sCheckpoint = NULL;
+static char sBootId[40];
+static guint sCheckpointSource = 0;
 
+static bool _activity_insert(const char *activity_id, int duration_ms);
 
+/**
+ * @brief Read the id of the current boot, checkpoints of previous boots are discarded.
+ */
+static void
+_activity_read_boot_id(void)
+{
+	gchar *contents = NULL;
+
+	if (g_file_get_contents("/proc/sys/kernel/random/boot_id", &contents, NULL,
+	                        NULL))
+	{
+		g_strlcpy(sBootId, g_strstrip(contents), sizeof(sBootId));
+		g_free(contents);
+	}
+}
 
 /**
- * @brief Initialize the activity queue
+ * @brief Map the checkpoint file in memory, creating it if needed.
+ *
+ * @retval True if the checkpoint file is mapped
+ */
+static bool
+_activity_checkpoint_open(void)
+{
+	struct stat st;
+	void *map = MAP_FAILED;
+
+	gchar *path = g_build_filename(gSleepConfig.preference_dir,
+	                               ACTIVITY_CHECKPOINT_FILE, NULL);
+
+	int fd = open(path, O_RDWR | O_CREAT, 0644);
+
+	if (fd < 0)
+	{
+		goto error;
+	}
+
+	if (fstat(fd, &st) < 0 ||
+	        (st.st_size != sizeof(ActivityCheckpoint) &&
+	         ftruncate(fd, sizeof(ActivityCheckpoint)) < 0))
+	{
+		goto error;
+	}
+
+	map = mmap(NULL, sizeof(ActivityCheckpoint), PROT_READ | PROT_WRITE,
+	           MAP_SHARED, fd, 0);
+
+	if (map == MAP_FAILED)
+	{
+		goto error;
+	}
+
+	sCheckpoint = (ActivityCheckpoint *)map;
+
+	close(fd);
+	g_free(path);
+	return true;
+
+error:
+	SLEEPDLOG_WARNING(MSGID_ACTIVITY_CHECKPOINT_ERR, 1, PMLOGKS("Path", path),
+	                  "Activities will not survive a restart of sleepd");
+
+	if (fd >= 0)
+	{
+		close(fd);
+	}
+
+	g_free(path);
+	return false;
+}
+
+/**
+ * @brief Restart the activities found in the checkpoint file which have not
+ * expired yet.
+ */
+static void
+_activity_checkpoint_restore(void)
+{
+	ActivityCheckpoint restored;
+	guint32 i;
+
+	memcpy(&restored, sCheckpoint, sizeof(restored));
+
+	if (restored.magic != ACTIVITY_CHECKPOINT_MAGIC ||
+	        restored.version != ACTIVITY_CHECKPOINT_VERSION ||
+	        (restored.generation & 1) ||
+	        restored.count > ACTIVITY_CHECKPOINT_MAX ||
+	        strncmp(restored.boot_id, sBootId, sizeof(sBootId)) != 0)
+	{
+		return;
+	}
+
+	gint64 now_boot_ms = TimeSourceGetMs(kTimeSourceBoottime);
+
+	for (i = 0; i < restored.count; i++)
+	{
+		ActivityCheckpointRecord *record = &restored.records[i];
+		gint64 remaining_ms = record->end_boot_ms - now_boot_ms;
+
+		record->activity_id[ACTIVITY_CHECKPOINT_ID_MAX - 1] = '\0';
+
+		if (remaining_ms <= 0 || !record->activity_id[0])
+		{
+			continue;
+		}
+
+		SLEEPDLOG_DEBUG("Restoring activity (%s) for %d ms", record->activity_id,
+		                (int)remaining_ms);
+
+		_activity_insert(record->activity_id, (int)remaining_ms);
+	}
+}
+
+/**
+ * @brief Write the current roster to the checkpoint file. This only stores into
+ * the shared mapping: the kernel writes it back on its own, which is enough for the
+ * data to outlive sleepd. Must be called with activity_mutex held.
+ */
+static void
+_activity_checkpoint_write_unlocked(void)
+{
+	gint64 now_boot_ms = TimeSourceGetMs(kTimeSourceBoottime);
+	guint32 count = 0;
+	GList *iter;
+
+	sCheckpoint->generation |= 1;
+	__sync_synchronize();
+
+	for (iter = activity_roster->head;
+	        iter != NULL && count < ACTIVITY_CHECKPOINT_MAX; iter = iter->next)
+	{
+		Activity *a = (Activity *)iter->data;
+
+		if (a->end_boot_ms <= now_boot_ms ||
+		        strlen(a->activity_id) >= ACTIVITY_CHECKPOINT_ID_MAX)
+		{
+			continue;
+		}
+
+		ActivityCheckpointRecord *record = &sCheckpoint->records[count++];
+
+		record->end_boot_ms = a->end_boot_ms;
+		record->duration_ms = a->duration_ms;
+		record->reserved = 0;
+		g_strlcpy(record->activity_id, a->activity_id, ACTIVITY_CHECKPOINT_ID_MAX);
+	}
+
+	sCheckpoint->magic = ACTIVITY_CHECKPOINT_MAGIC;
+	sCheckpoint->version = ACTIVITY_CHECKPOINT_VERSION;
+	sCheckpoint->count = count;
+	memcpy(sCheckpoint->boot_id, sBootId, sizeof(sBootId));
+
+	__sync_synchronize();
+	sCheckpoint->generation++;
+
+	msync(sCheckpoint, sizeof(ActivityCheckpoint), MS_ASYNC);
+}
+
+/**
+ * @brief Deferred checkpoint, runs on the main loop.
+ */
+static gboolean
+_activity_checkpoint_cb(gpointer data)
+{
+	/* activity_mutex is held across suspend while activities are frozen */
+	if (pthread_mutex_trylock(&activity_mutex) != 0)
+	{
+		return TRUE;
+	}
+
+	_activity_checkpoint_write_unlocked();
+	sCheckpointSource = 0;
+
+	pthread_mutex_unlock(&activity_mutex);
+	return FALSE;
+}
+
+/**
+ * @brief Schedule a checkpoint of the roster, so that changes reach the checkpoint
+ * file within ACTIVITY_CHECKPOINT_MS. Must be called with activity_mutex held.
+ */
+static void
+_activity_checkpoint_schedule(void)
+{
+	if (!sCheckpoint || sCheckpointSource)
+	{
+		return;
+	}
+
+	sCheckpointSource = g_timeout_add(ACTIVITY_CHECKPOINT_MS,
+	                                  _activity_checkpoint_cb, NULL);
+}
+
+
+/**
+ * @brief Initialize the activity queue, and restore the activities that were
+ * active when sleepd last exited. Runs on the main thread, as restoring an
+ * activity schedules a checkpoint on the main loop.
  */
 static int
 _activity_init(void)
@@ -99,6 +342,13 @@ _activity_init(void)
 		activity_roster = g_queue_new();
 	}
 
+	_activity_read_boot_id();
+
+	if (_activity_checkpoint_open())
+	{
+		_activity_checkpoint_restore();
+	}
+
 	return 0;
 }
 
@@ -125,13 +375,15 @@ _activity_new(const char *activity_id, int duration_ms)
 	activity->duration_ms = duration_ms;
 
 	// end += duration
-	ClockGetTime(&activity->start_time);
+	TimeSourceGet(kTimeSourceMonotonic, &activity->start_time);
 
 	activity->end_time.tv_sec = activity->start_time.tv_sec;
 	activity->end_time.tv_nsec = activity->start_time.tv_nsec;
 
 	ClockAccumMs(&activity->end_time, activity->duration_ms);
 
+	activity->end_boot_ms = TimeSourceGetMs(kTimeSourceBoottime) + activity->duration_ms;
+
 	return activity;
 }
 
@@ -234,6 +486,11 @@ _activity_insert(const char *activity_id, int duration_ms)
 
 		g_queue_insert_sorted(activity_roster, activity,
 		                      (GCompareDataFunc)_activity_compare, NULL);
+
+		PwrEventLedgerOpen(&activity->charge, activity->activity_id,
+		                   &activity->start_time, &activity->end_time);
+
+		_activity_checkpoint_schedule();
 	}
 
 	pthread_mutex_unlock(&activity_mutex);
@@ -263,8 +520,13 @@ _activity_remove_id(const char *activity_id)
 
 		if (strcmp(a->activity_id, activity_id) == 0)
 		{
+			struct timespec now;
+			TimeSourceGet(kTimeSourceMonotonic, &now);
+
 			ret_activity = a;
 			g_queue_delete_link(activity_roster, iter);
+			PwrEventLedgerClose(&a->charge, &now);
+			_activity_checkpoint_schedule();
 			break;
 		}
 	}
@@ -586,6 +848,7 @@ PwrEventActivityRemoveExpired(struct timespec *now)
 				                a->activity_id, a->duration_ms);
 			}
 
+			PwrEventLedgerClose(&a->charge, now);
 			_activity_stop_activity(a);
 
 			g_queue_delete_link(activity_roster, current_iter);
@@ -624,7 +887,7 @@ void
 PwrEventActivityPrintFrom(struct timespec *start)
 {
 	struct timespec now;
-	ClockGetTime(&now);
+	TimeSourceGet(kTimeSourceMonotonic, &now);
 
 	_activity_print(start, &now);
 }
@@ -636,7 +899,7 @@ void
 PwrEventActivityPrint(void)
 {
 	struct timespec now;
-	ClockGetTime(&now);
+	TimeSourceGet(kTimeSourceMonotonic, &now);
 
 	_activity_print(&now, &now);
 }
@@ -712,6 +975,6 @@ PwrEventThawActivities(void)
 	pthread_mutex_unlock(&activity_mutex);
 }
 
-INIT_FUNC(INIT_FUNC_EARLY, _activity_init);
+INIT_FUNC("config_init", _activity_init);
 
 /* @} END OF PowerActivities */
@@ -0,0 +1,603 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2011-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+
+/**
+* @file activity_ledger.c
+*
+* @brief Attribution of the time the device was kept awake to the activities holding it.
+*
+* Every millisecond during which at least one activity is active is split evenly between
+* all the activities active at that moment. Instead of walking the roster on every change,
+* the ledger keeps a single counter of "milliseconds per holder" which only advances while
+* the set of holders is unchanged; the share of an activity is the difference of that
+* counter between the moment it was opened and the moment it was closed. Closing a charge
+* is O(1). Opening one inserts it into the open charges sorted by end time, which is
+* O(n) in the number of open charges, but O(1) for the usual activity ending after the
+* ones already open. It is called from _activity_insert(), right after the activity
+* itself was inserted into the roster in the same O(n) way, so it does not change the
+* cost of starting an activity.
+*
+* Charges are accumulated per activity id into buckets of LEDGER_BUCKET_MS, which
+* provide the 1 hour and 24 hours sliding windows reported by PwrEventLedgerToJson().
+* The buckets follow the monotonic clock, which stops while the system sleeps: the
+* windows are the last hour and the last 24 hours the device was awake, not of wall
+* time.
+*/
+
+
+#include <glib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "timesource.h"
+#include "activity_ledger.h"
+
+#define LEDGER_BUCKET_MS    (5*60*1000)
+#define LEDGER_SLOTS        (24*60*60*1000/LEDGER_BUCKET_MS)
+
+#define LEDGER_MAX_ENTRIES  512
+
+/**
+ * @addtogroup PowerActivities
+ * @{
+ */
+
+/**
+ * @brief Per bucket state of the whole ledger.
+ */
+typedef struct
+{
+	gint64 bucket;     // bucket number currently held by this slot
+	double share;      // value of the share counter at the start of the bucket
+	gint64 awake_ms;   // time within the bucket with at least one activity active
+} LedgerSlot;
+
+/**
+ * @brief Charge of a single activity id within one bucket.
+ */
+typedef struct
+{
+	gint64 bucket;
+	double charged_ms;
+	gint64 held_ms;
+} LedgerRecord;
+
+typedef struct
+{
+	char *activity_id;
+	GArray *records;   // LedgerRecord, sorted by bucket
+} LedgerEntry;
+
+typedef struct
+{
+	const char *activity_id;
+	double charged_ms;
+	gint64 held_ms;
+} LedgerTotal;
+
+static pthread_mutex_t ledger_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* open charges, sorted by end time */
+static GQueue ledger_open = G_QUEUE_INIT;
+
+/* milliseconds of awake time charged to every single holder so far */
+static double ledger_share = 0;
+static gint64 ledger_last_ms = -1;
+
+static LedgerSlot ledger_slots[LEDGER_SLOTS];
+static GHashTable *ledger_entries = NULL;
+
+static const int ledger_windows_s[] = { 60 * 60, 24 * 60 * 60 };
+
+static gint64
+_ledger_ms(struct timespec *ts)
+{
+	return (gint64)ts->tv_sec * 1000 + ts->tv_nsec / 1000000;
+}
+
+static gint64
+_ledger_bucket(gint64 ms)
+{
+	return ms / LEDGER_BUCKET_MS;
+}
+
+static LedgerSlot *
+_ledger_slot(gint64 bucket)
+{
+	return &ledger_slots[bucket % LEDGER_SLOTS];
+}
+
+static void
+_ledger_slot_reset(gint64 bucket)
+{
+	LedgerSlot *slot = _ledger_slot(bucket);
+
+	slot->bucket = bucket;
+	slot->share = ledger_share;
+	slot->awake_ms = 0;
+}
+
+/**
+ * @brief Share counter value at the start of "bucket", or "fallback" if the bucket
+ * already left the ring.
+ */
+static double
+_ledger_slot_share(gint64 bucket, double fallback)
+{
+	LedgerSlot *slot = _ledger_slot(bucket);
+
+	return slot->bucket == bucket ? slot->share : fallback;
+}
+
+static void
+_ledger_accrue(gint64 bucket, gint64 ms, guint holders)
+{
+	if (!holders || ms <= 0)
+	{
+		return;
+	}
+
+	ledger_share += (double)ms / holders;
+
+	LedgerSlot *slot = _ledger_slot(bucket);
+
+	if (slot->bucket == bucket)
+	{
+		slot->awake_ms += ms;
+	}
+}
+
+/**
+ * @brief Advance the share counter up to "to_ms", assuming the set of holders did not
+ * change since the last call.
+ */
+static void
+_ledger_advance(gint64 to_ms)
+{
+	guint holders = g_queue_get_length(&ledger_open);
+
+	if (ledger_last_ms < 0)
+	{
+		ledger_last_ms = to_ms;
+		_ledger_slot_reset(_ledger_bucket(to_ms));
+		return;
+	}
+
+	if (to_ms <= ledger_last_ms)
+	{
+		return;
+	}
+
+	gint64 bucket = _ledger_bucket(ledger_last_ms);
+	gint64 to_bucket = _ledger_bucket(to_ms);
+
+	while (bucket < to_bucket)
+	{
+		_ledger_accrue(bucket, (bucket + 1) * LEDGER_BUCKET_MS - ledger_last_ms,
+		               holders);
+		bucket++;
+
+		// nothing accrues while idle, skip buckets which would leave the ring anyway
+		if (!holders && to_bucket - bucket >= LEDGER_SLOTS)
+		{
+			bucket = to_bucket - LEDGER_SLOTS + 1;
+		}
+
+		ledger_last_ms = bucket * LEDGER_BUCKET_MS;
+		_ledger_slot_reset(bucket);
+	}
+
+	_ledger_accrue(bucket, to_ms - ledger_last_ms, holders);
+	ledger_last_ms = to_ms;
+}
+
+static void
+_ledger_entry_free(LedgerEntry *entry)
+{
+	g_free(entry->activity_id);
+	g_array_free(entry->records, TRUE);
+	g_free(entry);
+}
+
+/**
+ * @brief Drop the records of an entry which left the 24 hours window.
+ *
+ * @retval TRUE if the entry has no records left.
+ */
+static gboolean
+_ledger_entry_trim(gpointer key, gpointer value, gpointer data)
+{
+	LedgerEntry *entry = (LedgerEntry *)value;
+	gint64 oldest = *(gint64 *)data;
+	guint stale = 0;
+
+	while (stale < entry->records->len &&
+	        g_array_index(entry->records, LedgerRecord, stale).bucket < oldest)
+	{
+		stale++;
+	}
+
+	if (stale)
+	{
+		g_array_remove_range(entry->records, 0, stale);
+	}
+
+	return entry->records->len == 0;
+}
+
+static LedgerEntry *
+_ledger_entry_lookup(const char *activity_id, gint64 bucket)
+{
+	if (!ledger_entries)
+	{
+		ledger_entries = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+		                                       (GDestroyNotify)_ledger_entry_free);
+	}
+
+	LedgerEntry *entry = g_hash_table_lookup(ledger_entries, activity_id);
+
+	if (entry)
+	{
+		return entry;
+	}
+
+	if (g_hash_table_size(ledger_entries) >= LEDGER_MAX_ENTRIES)
+	{
+		gint64 oldest = bucket - LEDGER_SLOTS + 1;
+		g_hash_table_foreach_remove(ledger_entries, _ledger_entry_trim, &oldest);
+	}
+
+	entry = g_new0(LedgerEntry, 1);
+	entry->activity_id = g_strdup(activity_id);
+	entry->records = g_array_new(FALSE, FALSE, sizeof(LedgerRecord));
+
+	g_hash_table_insert(ledger_entries, entry->activity_id, entry);
+
+	return entry;
+}
+
+static void
+_ledger_entry_add(LedgerEntry *entry, gint64 bucket, double charged_ms,
+                  gint64 held_ms)
+{
+	GArray *records = entry->records;
+
+	if (records->len &&
+	        g_array_index(records, LedgerRecord, records->len - 1).bucket == bucket)
+	{
+		LedgerRecord *record = &g_array_index(records, LedgerRecord,
+		                                      records->len - 1);
+		record->charged_ms += charged_ms;
+		record->held_ms += held_ms;
+	}
+	else
+	{
+		LedgerRecord record = { bucket, charged_ms, held_ms };
+		g_array_append_val(records, record);
+	}
+}
+
+/**
+ * @brief Book the share of a charge ending at "end_ms" into the buckets it spans.
+ * The share counter must already be advanced up to "end_ms".
+ */
+static void
+_ledger_book(PwrEventCharge *charge, gint64 end_ms)
+{
+	gint64 first = _ledger_bucket(charge->start_ms);
+	gint64 last = _ledger_bucket(end_ms);
+	gint64 bucket;
+
+	LedgerEntry *entry = _ledger_entry_lookup(charge->activity_id, last);
+
+	for (bucket = first; bucket <= last; bucket++)
+	{
+		gint64 seg_start = MAX(charge->start_ms, bucket * LEDGER_BUCKET_MS);
+		gint64 seg_end = MIN(end_ms, (bucket + 1) * LEDGER_BUCKET_MS);
+
+		if (seg_end <= seg_start)
+		{
+			continue;
+		}
+
+		double share_from = (seg_start == charge->start_ms) ? charge->share_start :
+		                    _ledger_slot_share(bucket, charge->share_start);
+		double share_to = (seg_end == end_ms) ? ledger_share :
+		                  _ledger_slot_share(bucket + 1, share_from);
+
+		_ledger_entry_add(entry, bucket, share_to - share_from, seg_end - seg_start);
+	}
+
+	gint64 oldest = last - LEDGER_SLOTS + 1;
+	_ledger_entry_trim(NULL, entry, &oldest);
+}
+
+static void
+_ledger_close_unlocked(PwrEventCharge *charge, gint64 end_ms)
+{
+	_ledger_book(charge, end_ms);
+
+	g_queue_delete_link(&ledger_open, charge->link);
+	charge->link = NULL;
+	charge->open = false;
+}
+
+/**
+ * @brief Close all the charges whose activity expired by "now_ms", each one at its own
+ * end time, and advance the share counter up to "now_ms".
+ */
+static void
+_ledger_settle(gint64 now_ms)
+{
+	PwrEventCharge *charge;
+
+	while ((charge = g_queue_peek_head(&ledger_open)) != NULL &&
+	        charge->end_ms <= now_ms)
+	{
+		_ledger_advance(charge->end_ms);
+		_ledger_close_unlocked(charge, charge->end_ms);
+	}
+
+	_ledger_advance(now_ms);
+}
+
+/**
+ * @brief Start charging awake time to an activity that just entered the roster.
+ *
+ * @param charge Ledger bookkeeping of the activity
+ * @param activity_id Must stay valid until the charge is closed
+ * @param start Start time of the activity
+ * @param end Expiry time of the activity
+ */
+void
+PwrEventLedgerOpen(PwrEventCharge *charge, const char *activity_id,
+                   struct timespec *start, struct timespec *end)
+{
+	pthread_mutex_lock(&ledger_mutex);
+
+	charge->activity_id = activity_id;
+	charge->start_ms = _ledger_ms(start);
+	charge->end_ms = _ledger_ms(end);
+
+	_ledger_settle(charge->start_ms);
+
+	charge->share_start = ledger_share;
+	charge->open = true;
+
+	/* most activities end after the ones already queued, so search from the tail */
+	GList *iter = ledger_open.tail;
+
+	while (iter && ((PwrEventCharge *)iter->data)->end_ms > charge->end_ms)
+	{
+		iter = iter->prev;
+	}
+
+	if (iter)
+	{
+		g_queue_insert_after(&ledger_open, iter, charge);
+		charge->link = iter->next;
+	}
+	else
+	{
+		g_queue_push_head(&ledger_open, charge);
+		charge->link = ledger_open.head;
+	}
+
+	pthread_mutex_unlock(&ledger_mutex);
+}
+
+/**
+ * @brief Stop charging awake time to an activity leaving the roster.
+ *
+ * @param charge Ledger bookkeeping of the activity
+ * @param now Current time; activities which expired earlier are charged up to their expiry.
+ */
+void
+PwrEventLedgerClose(PwrEventCharge *charge, struct timespec *now)
+{
+	pthread_mutex_lock(&ledger_mutex);
+
+	if (charge->open)
+	{
+		_ledger_settle(_ledger_ms(now));
+
+		if (charge->open)
+		{
+			_ledger_close_unlocked(charge, _ledger_ms(now));
+		}
+	}
+
+	pthread_mutex_unlock(&ledger_mutex);
+}
+
+static void
+_ledger_total_add(GHashTable *totals, const char *activity_id,
+                  double charged_ms, gint64 held_ms)
+{
+	LedgerTotal *total = g_hash_table_lookup(totals, activity_id);
+
+	if (!total)
+	{
+		total = g_new0(LedgerTotal, 1);
+		total->activity_id = activity_id;
+		g_hash_table_insert(totals, (gpointer)activity_id, total);
+	}
+
+	total->charged_ms += charged_ms;
+	total->held_ms += held_ms;
+}
+
+static gint
+_ledger_total_compare(gconstpointer a, gconstpointer b)
+{
+	const LedgerTotal *ta = *(const LedgerTotal **)a;
+	const LedgerTotal *tb = *(const LedgerTotal **)b;
+
+	if (ta->charged_ms == tb->charged_ms)
+	{
+		return 0;
+	}
+
+	return ta->charged_ms < tb->charged_ms ? 1 : -1;
+}
+
+/**
+ * @brief Append the top offenders of one window to "str".
+ */
+static void
+_ledger_window_json(GString *str, int window_s, int top_n, gint64 now_ms)
+{
+	gint64 oldest = _ledger_bucket(now_ms) - (gint64)window_s * 1000 /
+	                LEDGER_BUCKET_MS + 1;
+	gint64 awake_ms = 0;
+	gint64 bucket;
+
+	for (bucket = MAX(oldest, _ledger_bucket(now_ms) - LEDGER_SLOTS + 1);
+	        bucket <= _ledger_bucket(now_ms); bucket++)
+	{
+		LedgerSlot *slot = _ledger_slot(bucket);
+
+		if (slot->bucket == bucket)
+		{
+			awake_ms += slot->awake_ms;
+		}
+	}
+
+	GHashTable *totals = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+	                                           g_free);
+
+	if (ledger_entries)
+	{
+		GHashTableIter iter;
+		gpointer value;
+
+		g_hash_table_iter_init(&iter, ledger_entries);
+
+		while (g_hash_table_iter_next(&iter, NULL, &value))
+		{
+			LedgerEntry *entry = (LedgerEntry *)value;
+			guint i;
+
+			for (i = 0; i < entry->records->len; i++)
+			{
+				LedgerRecord *record = &g_array_index(entry->records, LedgerRecord, i);
+
+				if (record->bucket >= oldest)
+				{
+					_ledger_total_add(totals, entry->activity_id, record->charged_ms,
+					                  record->held_ms);
+				}
+			}
+		}
+	}
+
+	/* activities never outlive the smallest window, charge them entirely */
+	GList *link;
+
+	for (link = ledger_open.head; link != NULL; link = link->next)
+	{
+		PwrEventCharge *charge = (PwrEventCharge *)link->data;
+
+		_ledger_total_add(totals, charge->activity_id,
+		                  ledger_share - charge->share_start,
+		                  now_ms - charge->start_ms);
+	}
+
+	GPtrArray *sorted = g_ptr_array_sized_new(g_hash_table_size(totals));
+	GHashTableIter iter;
+	gpointer value;
+
+	g_hash_table_iter_init(&iter, totals);
+
+	while (g_hash_table_iter_next(&iter, NULL, &value))
+	{
+		g_ptr_array_add(sorted, value);
+	}
+
+	g_ptr_array_sort(sorted, _ledger_total_compare);
+
+	g_string_append_printf(str,
+	                       "{\"window_s\":%d,\"awake_ms\":%" G_GINT64_FORMAT ",\"top\":[",
+	                       window_s, awake_ms);
+
+	guint i;
+
+	for (i = 0; i < sorted->len && i < (guint)top_n; i++)
+	{
+		LedgerTotal *total = g_ptr_array_index(sorted, i);
+		gchar *escaped_id = g_strescape(total->activity_id, NULL);
+
+		g_string_append_printf(str,
+		                       "%s{\"id\":\"%s\",\"charged_ms\":%" G_GINT64_FORMAT
+		                       ",\"held_ms\":%" G_GINT64_FORMAT "}",
+		                       i ? "," : "", escaped_id,
+		                       (gint64)(total->charged_ms + 0.5), total->held_ms);
+
+		g_free(escaped_id);
+	}
+
+	g_string_append(str, "]}");
+
+	g_ptr_array_free(sorted, TRUE);
+	g_hash_table_destroy(totals);
+}
+
+/**
+ * @brief Build the luna reply listing the activities which kept the device awake
+ * the longest over the last hour and the last 24 hours of awake time.
+ *
+ * @param top_n Number of activities reported per window
+ *
+ * @retval Newly allocated json string
+ */
+char *
+PwrEventLedgerToJson(int top_n)
+{
+	struct timespec now;
+	GString *str = g_string_sized_new(512);
+	guint i;
+
+	TimeSourceGet(kTimeSourceMonotonic, &now);
+
+	pthread_mutex_lock(&ledger_mutex);
+
+	gint64 now_ms = _ledger_ms(&now);
+	_ledger_settle(now_ms);
+
+	g_string_append_printf(str, "{\"returnValue\":true,\"holding\":%u,\"windows\":[",
+	                       g_queue_get_length(&ledger_open));
+
+	for (i = 0; i < G_N_ELEMENTS(ledger_windows_s); i++)
+	{
+		if (i)
+		{
+			g_string_append_c(str, ',');
+		}
+
+		_ledger_window_json(str, ledger_windows_s[i], top_n, now_ms);
+	}
+
+	g_string_append(str, "]}");
+
+	pthread_mutex_unlock(&ledger_mutex);
+
+	return g_string_free(str, FALSE);
+}
+
+/* @} END OF PowerActivities */
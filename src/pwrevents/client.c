@@ -29,6 +29,7 @@
 
 #include <glib.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "logging.h"
 #include "debug.h"
@@ -54,6 +55,12 @@
  */
 static GHashTable    *sClientList = NULL;
 
+/**
+ * @brief Secondary index of sClientList: client name -> GList of the clients
+ * with that name, most recently named first.
+ */
+static GHashTable    *sClientsByName = NULL;
+
 static int sNumSuspendRequest = 0;
 static int sNumSuspendRequestAck = 0;
 static int sNumPrepareSuspend  = 0;
@@ -114,6 +121,7 @@ PwrEventClientInfoCreate(void)
 
 	ret_client->clientName = NULL;
 	ret_client->clientId = NULL;
+	ret_client->applicationName = NULL;
 	ret_client->requireSuspendRequest = false;
 	ret_client->requirePrepareSuspend = false;
 
@@ -124,6 +132,31 @@ PwrEventClientInfoCreate(void)
 }
 
 
+/**
+ * @brief Remove a client from the list of its name, if named
+ */
+static void
+PwrEventClientUnindex(struct PwrEventClientInfo *client)
+{
+	if (!client->clientName)
+	{
+		return;
+	}
+
+	GList *named = g_hash_table_lookup(sClientsByName, client->clientName);
+
+	named = g_list_remove(named, client);
+
+	if (named)
+	{
+		g_hash_table_insert(sClientsByName, g_strdup(client->clientName), named);
+	}
+	else
+	{
+		g_hash_table_remove(sClientsByName, client->clientName);
+	}
+}
+
 /**
  * @brief Free a client
  *
@@ -138,6 +171,8 @@ PwrEventClientInfoDestroy(struct PwrEventClientInfo *client)
 		return;
 	}
 
+	PwrEventClientUnindex(client);
+
 	g_free(client->clientName);
 	g_free(client->clientId);
 	g_free(client->applicationName);
@@ -171,6 +206,40 @@ PwrEventClientRegister(ClientUID uid)
 	return true;
 }
 
+/**
+ * @brief Name a registered client, and index it by that name instead of any
+ * name it had.
+ *
+ * @param info
+ * @param clientName
+ */
+
+void
+PwrEventClientSetName(struct PwrEventClientInfo *info, const char *clientName)
+{
+	if (!info || !clientName)
+	{
+		return;
+	}
+
+	if (info->clientName)
+	{
+		if (!strcmp(info->clientName, clientName))
+		{
+			return;
+		}
+
+		PwrEventClientUnindex(info);
+		g_free(info->clientName);
+	}
+
+	info->clientName = g_strdup(clientName);
+
+	GList *named = g_hash_table_lookup(sClientsByName, clientName);
+	g_hash_table_insert(sClientsByName, g_strdup(clientName),
+	                    g_list_prepend(named, info));
+}
+
 /**
  * @brief Unregister a client
  *
@@ -214,6 +283,8 @@ PwrEventClientTableCreate(void)
 {
 	sClientList = g_hash_table_new_full(g_str_hash, g_str_equal,
 	                                    g_free, ClientTableValueDestroy);
+	sClientsByName = g_hash_table_new_full(g_str_hash, g_str_equal,
+	                                       g_free, NULL);
 }
 
 /**
@@ -225,6 +296,7 @@ PwrEventClientTableDestroy(void)
 {
 	g_hash_table_remove_all(sClientList);
 	g_hash_table_destroy(sClientList);
+	g_hash_table_destroy(sClientsByName);
 }
 
 /**
@@ -259,29 +331,20 @@ bool PwrEventClientUnregisterByName(char *clientName)
 {
 	if (NULL == clientName)
 	{
-		return NULL;
+		return false;
 	}
 
-	struct PwrEventClientInfo *clientInfo = NULL;
-
-	GHashTableIter iter;
-
-	gpointer key, value;
-
-	g_hash_table_iter_init(&iter, sClientList);
+	GList *named = g_hash_table_lookup(sClientsByName, clientName);
 
-	while (g_hash_table_iter_next(&iter, &key, &value))
+	if (!named)
 	{
-		clientInfo = value;
-
-		if (!strcmp(clientInfo->clientName, clientName))
-		{
-			PwrEventClientUnregister(clientInfo->clientId);
-			return true;
-		}
+		return false;
 	}
 
-	return false;
+	struct PwrEventClientInfo *clientInfo = named->data;
+
+	PwrEventClientUnregister(clientInfo->clientId);
+	return true;
 }
 
 /**
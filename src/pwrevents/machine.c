@@ -115,14 +115,18 @@ unknown:
 	return machineName;
 }
 
+/**
+ * @brief Whether the device can suspend now. The config is passed in by the
+ * suspend thread, from its own copy.
+ */
 bool
-MachineCanSleep(void)
+MachineCanSleep(bool suspend_with_charger)
 {
 	int ret = access(WEBOS_INSTALL_SBINDIR "/suspend_action", R_OK | X_OK);
 	bool suspend_action_present = (ret == 0);
 
 	return suspend_action_present &&
-	       (!chargerIsConnected || gSleepConfig.suspend_with_charger);
+	       (!chargerIsConnected || suspend_with_charger);
 }
 
 const char *
@@ -142,84 +146,91 @@ MachineCantSleepReason(void)
 }
 
 
-void MachineSleep(void)
+void MachineSleep(bool visual_leds_suspend)
 {
 	bool success;
 	switchoffDisplay();
 
-	if (gSleepConfig.visual_leds_suspend)
+	if (visual_leds_suspend)
 	{
 		SysfsWriteString("/sys/class/leds/core_navi_center/brightness", "0");
 	}
 
 	nyx_system_suspend(GetNyxSystemDevice(), &success);
 
-	if (gSleepConfig.visual_leds_suspend)
+	if (visual_leds_suspend)
 	{
 		SysfsWriteString("/sys/class/leds/core_navi_center/brightness", "15");
 	}
 }
 
-void
-MachineForceShutdown(const char *reason)
+/**
+ * @brief Hand the shutdown or reboot over to nyx.
+ *
+ * @param  reboot     Reboot rather than power off
+ * @param  emergency  Halt right away, without the normal shutdown of the system
+ * @param  reason
+ */
+static void
+machine_halt(bool reboot, bool emergency, const char *reason)
 {
-	SLEEPDLOG_INFO(MSGID_FRC_SHUTDOWN, 1, PMLOGKS("Reason", reason),
-	               "Pwrevents shutting down system");
+	nyx_system_shutdown_type_t type = emergency ? NYX_SYSTEM_EMERG_SHUTDOWN :
+	                                  NYX_SYSTEM_NORMAL_SHUTDOWN;
 
 #ifdef REBOOT_TAKES_REASON
 
-	if (gSleepConfig.fasthalt)
+	if (reboot)
 	{
-		nyx_system_shutdown(GetNyxSystemDevice(), NYX_SYSTEM_EMERG_SHUTDOWN, reason);
+		nyx_system_reboot(GetNyxSystemDevice(), type, reason);
 	}
 	else
 	{
-		nyx_system_shutdown(GetNyxSystemDevice(), NYX_SYSTEM_NORMAL_SHUTDOWN, reason);
+		nyx_system_shutdown(GetNyxSystemDevice(), type, reason);
 	}
 
 #else
 
-	if (gSleepConfig.fasthalt)
+	if (reboot)
 	{
-		nyx_system_shutdown(GetNyxSystemDevice(), NYX_SYSTEM_EMERG_SHUTDOWN);
+		nyx_system_reboot(GetNyxSystemDevice(), type);
 	}
 	else
 	{
-		nyx_system_shutdown(GetNyxSystemDevice(), NYX_SYSTEM_NORMAL_SHUTDOWN);
+		nyx_system_shutdown(GetNyxSystemDevice(), type);
 	}
 
 #endif
 }
 
+void
+MachineForceShutdown(const char *reason)
+{
+	SLEEPDLOG_INFO(MSGID_FRC_SHUTDOWN, 1, PMLOGKS("Reason", reason),
+	               "Pwrevents shutting down system");
+
+	machine_halt(false, gSleepConfig.fasthalt, reason);
+}
+
 void
 MachineForceReboot(const char *reason)
 {
 	SLEEPDLOG_INFO(MSGID_FRC_REBOOT, 1, PMLOGKS("Reason", reason),
 	               "Pwrevents rebooting system");
 
-#ifdef REBOOT_TAKES_REASON
-
-	if (gSleepConfig.fasthalt)
-	{
-		nyx_system_reboot(GetNyxSystemDevice(), NYX_SYSTEM_EMERG_SHUTDOWN, reason);
-	}
-	else
-	{
-		nyx_system_reboot(GetNyxSystemDevice(), NYX_SYSTEM_NORMAL_SHUTDOWN, reason);
-	}
-
-#else
+	machine_halt(true, gSleepConfig.fasthalt, reason);
+}
 
-	if (gSleepConfig.fasthalt)
-	{
-		nyx_system_reboot(GetNyxSystemDevice(), NYX_SYSTEM_EMERG_SHUTDOWN);
-	}
-	else
-	{
-		nyx_system_reboot(GetNyxSystemDevice(), NYX_SYSTEM_NORMAL_SHUTDOWN);
-	}
+/**
+ * @brief Power off or reboot right away. The caller is expected to have flushed
+ * whatever must survive.
+ */
+void
+MachineFastHalt(bool reboot, const char *reason)
+{
+	SLEEPDLOG_INFO(reboot ? MSGID_FRC_REBOOT : MSGID_FRC_SHUTDOWN, 1,
+	               PMLOGKS("Reason", reason), "Pwrevents halting system");
 
-#endif
+	machine_halt(reboot, true, reason);
 }
 
 
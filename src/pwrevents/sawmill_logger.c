@@ -36,6 +36,7 @@
 #include "init.h"
 #include "sysfs.h"
 #include "logging.h"
+#include "timesource.h"
 
 #define PRINT_INTERVAL_MS 60000
 
@@ -70,7 +71,7 @@ time_to_ms(struct timespec t)
 void
 get_time_now(struct timespec *time_now)
 {
-	clock_gettime(CLOCK_REALTIME, time_now);
+	TimeSourceGet(kTimeSourceRealtime, time_now);
 }
 
 /**
@@ -606,4 +607,4 @@ _sawlog_init(void)
 	return 0;
 }
 
-INIT_FUNC(INIT_FUNC_MIDDLE, _sawlog_init);
+INIT_FUNC("config_init", _sawlog_init);
@@ -26,6 +26,8 @@
 */
 
 #include <glib.h>
+#include <string.h>
+#include <unistd.h>
 #include <cjson/json.h>
 #include <syslog.h>
 #include <luna-service2/lunaservice.h>
@@ -36,9 +38,47 @@
 #include "logging.h"
 #include "machine.h"
 #include "init.h"
+#include "config.h"
+#include "timesaver.h"
+#include "timesource.h"
+#include "sysfs.h"
 
 #define LOG_DOMAIN "SHUTDOWN: "
 
+/* Longest wait for the clients of a tier, and for a client never seen before */
+#define SHUTDOWN_TIMEOUT_SEC 15.0
+
+/*
+   A client's deadline is learned from its last SHUTDOWN_HISTORY_LEN shutdowns:
+   twice its slowest ack, plus some slack, within [SHUTDOWN_DEADLINE_MIN_SEC,
+   SHUTDOWN_TIMEOUT_SEC]. A client which did not ack counts as
+   SHUTDOWN_TIMEOUT_SEC.
+   */
+#define SHUTDOWN_HISTORY_LEN 5
+#define SHUTDOWN_DEADLINE_FACTOR 2.0
+#define SHUTDOWN_DEADLINE_SLACK_SEC 0.5
+#define SHUTDOWN_DEADLINE_MIN_SEC 1.0
+
+#define SHUTDOWN_HISTORY_NAME "shutdown_deadlines"
+
+/* Timing record of the last shutdown, reported on the next boot */
+#define SHUTDOWN_TIMING_NAME "shutdown_timing"
+
+/**
+* @brief The tiers of clients, signalled in this order unless independent.
+*/
+typedef enum
+{
+    kShutdownTierApps,
+    kShutdownTierServices,
+    kShutdownTierLast
+} ShutdownTier;
+
+static const char *ShutdownTierString[kShutdownTierLast] =
+{
+	"applications",
+	"services",
+};
 
 /**
 * @brief Contains list of applications and services
@@ -49,8 +89,14 @@ typedef struct
 	GHashTable *applications;
 	GHashTable *services;
 
-	int num_ack;
+	/* Per tier: client name -> GList of the clients with that name */
+	GHashTable *by_name[kShutdownTierLast];
+
+	int num_ack[kShutdownTierLast];
 	int num_nack;
+
+	/* Services which only shut down once the applications did */
+	int num_after_apps;
 } ShutdownClientList;
 
 typedef enum
@@ -86,8 +132,11 @@ typedef struct
 {
 	char            *id;
 	char            *name;
+	ShutdownTier     tier;
 	ShutdownReply    ack_shutdown;
 
+	bool             after_apps;
+	double           deadline;    // learned, from the signal of its tier
 	double           elapsed;
 } ShutdownClient;
 
@@ -184,6 +233,27 @@ LSMessage                *shutdown_message = NULL;
 guint shutdown_apps_timeout_id = 0;
 GTimer  *shutdown_timer = NULL;
 
+/* When each tier was signalled and done, from shutdown_timer, or < 0 */
+static double sTierStart[kShutdownTierLast];
+static double sTierEnd[kShutdownTierLast];
+
+/* Upper bounds of the buckets of the ack latency histograms */
+static const int kTimingBucketsMs[] = { 100, 250, 500, 1000, 2500, 5000, 15000 };
+
+/* Timing record of the shutdown before this boot, as json, or NULL */
+static char *sLastTiming = NULL;
+static char sBootId[40];
+static char *sTimingPath = NULL;
+static bool sTimingInitiated = false;
+
+/* Fast halt: no voting, one batched flush, emergency halt */
+static bool sFastHalt = false;
+static int sFastHaltMs = -1;
+
+/* Ack times of the last shutdowns, per tier and client name */
+static GKeyFile *sHistory = NULL;
+static char *sHistoryPath = NULL;
+
 /**
  * @defgroup ShutdownProcess    Shutdown Process
  * @ingroup PowerEvents
@@ -192,12 +262,21 @@ GTimer  *shutdown_timer = NULL;
  * When sleepd receives the /shutdown/initiate luna-call, it sends the shutdown signal
  * (shutdownApplications) to all the registered applications. It will proceed to the next
  * stage i.e sending shutdown signal (shutdownServices) to all the registered services, if
- * all the registered applications respond back by "Ack" or after a timeout of 15 sec.
+ * all the registered applications respond back by "Ack" or after a timeout.
  *
- * Again after sending the shutdownServices signal, it will allow a max timeout of 15 sec
- * for all the registered services to respond back. Finally it will respond back to the
+ * Again after sending the shutdownServices signal, it will wait for all the registered
+ * services to respond back, up to a timeout. Finally it will respond back to the
  * caller of the "initiate" luna-call with success to indicate the completion of the
  * shutdown process.
+ *
+ * Services which registered with "afterApplications":false do not wait for the
+ * applications: when every service did so, both signals are sent at once.
+ *
+ * The timeout of a tier is the deadline of its slowest client still to respond, learned
+ * from its acks of the last shutdowns, and at most 15 sec.
+ *
+ * A fast halt (the fasthalt setting, or "fastHalt":true) skips both tiers: machineOff or
+ * machineReboot then flush sleepd's state in one sync and halt right away.
  */
 
 /**
@@ -215,13 +294,344 @@ GTimer  *shutdown_timer = NULL;
  * @brief Allocate memory for a new shutdown client
  */
 
+/**
+ * @brief Whether a client name can be used as a key of the history file
+ */
+static bool
+history_key_valid(const char *name)
+{
+	return name && name[0] && !strpbrk(name, "=[]\r\n");
+}
+
+/**
+ * @brief Deadline of a client, learned from its acks of the last shutdowns
+ */
+static double
+history_deadline(ShutdownTier tier, const char *name)
+{
+	gsize len = 0;
+	gdouble *acks = NULL;
+	double slowest = 0.0;
+	int i;
+
+	if (sHistory && history_key_valid(name))
+	{
+		acks = g_key_file_get_double_list(sHistory, ShutdownTierString[tier], name,
+		                                  &len, NULL);
+	}
+
+	if (!acks || !len)
+	{
+		g_free(acks);
+		return SHUTDOWN_TIMEOUT_SEC;
+	}
+
+	for (i = 0; i < len; i++)
+	{
+		slowest = MAX(slowest, acks[i]);
+	}
+
+	g_free(acks);
+
+	return CLAMP(slowest * SHUTDOWN_DEADLINE_FACTOR + SHUTDOWN_DEADLINE_SLACK_SEC,
+	             SHUTDOWN_DEADLINE_MIN_SEC, SHUTDOWN_TIMEOUT_SEC);
+}
+
+/**
+ * @brief Add the ack time of a client to its history
+ */
+static void
+history_record(const char *key, ShutdownClient *client, void *data)
+{
+	gsize len = 0;
+	gdouble *acks;
+	GArray *updated;
+	double ack = SHUTDOWN_TIMEOUT_SEC;
+
+	if (!history_key_valid(client->name) || sTierStart[client->tier] < 0)
+	{
+		return;
+	}
+
+	if (client->ack_shutdown == kShutdownReplyAck)
+	{
+		ack = MAX(0.0, client->elapsed - sTierStart[client->tier]);
+	}
+
+	acks = g_key_file_get_double_list(sHistory, ShutdownTierString[client->tier],
+	                                  client->name, &len, NULL);
+
+	updated = g_array_new(FALSE, FALSE, sizeof(gdouble));
+
+	if (acks && len >= SHUTDOWN_HISTORY_LEN)
+	{
+		g_array_append_vals(updated, acks + len - (SHUTDOWN_HISTORY_LEN - 1),
+		                    SHUTDOWN_HISTORY_LEN - 1);
+	}
+	else if (acks)
+	{
+		g_array_append_vals(updated, acks, len);
+	}
+
+	g_array_append_val(updated, ack);
+
+	g_key_file_set_double_list(sHistory, ShutdownTierString[client->tier],
+	                           client->name, (gdouble *)updated->data, updated->len);
+
+	g_array_free(updated, TRUE);
+	g_free(acks);
+}
+
+/**
+ * @brief Record the acks of this shutdown, for the deadlines of the next ones
+ */
+static void
+history_save(void)
+{
+	gsize length = 0;
+	gchar *data;
+
+	if (!sHistory)
+	{
+		return;
+	}
+
+	g_hash_table_foreach(sClientList->applications, (GHFunc)history_record, NULL);
+	g_hash_table_foreach(sClientList->services, (GHFunc)history_record, NULL);
+
+	data = g_key_file_to_data(sHistory, &length, NULL);
+
+	if (!data || !g_file_set_contents(sHistoryPath, data, length, NULL))
+	{
+		SLEEPDLOG_WARNING(MSGID_SHUTDOWN_HISTORY_SAVE_FAIL, 1,
+		                  PMLOGKS("FileName", sHistoryPath),
+		                  "Could not save shutdown deadlines");
+	}
+
+	g_free(data);
+}
+
+typedef struct
+{
+	GString *str;
+	bool first;
+	int buckets[G_N_ELEMENTS(kTimingBucketsMs)];
+	int timed_out;
+} ShutdownTiming;
+
+/**
+ * @brief Add the ack latency of a client to the timing record of its tier
+ */
+static void
+timing_client_json(const char *key, ShutdownClient *client,
+                   ShutdownTiming *timing)
+{
+	gchar *escaped_name = g_strescape(client->name ? client->name : "", NULL);
+
+	g_string_append_printf(timing->str, "%s{\"name\":\"%s\"", timing->first ? "" : ",",
+	                       escaped_name);
+	timing->first = false;
+
+	if (client->ack_shutdown == kShutdownReplyAck)
+	{
+		int ack_ms = (int)((client->elapsed - sTierStart[client->tier]) * 1000);
+		int i;
+
+		g_string_append_printf(timing->str, ",\"ack_ms\":%d}", ack_ms);
+
+		for (i = 0; i < G_N_ELEMENTS(kTimingBucketsMs); i++)
+		{
+			if (ack_ms <= kTimingBucketsMs[i])
+			{
+				timing->buckets[i]++;
+				break;
+			}
+		}
+	}
+	else
+	{
+		g_string_append(timing->str, ",\"timed_out\":true}");
+		timing->timed_out++;
+	}
+
+	g_free(escaped_name);
+}
+
+/**
+ * @brief Write the timing record of this shutdown: when each tier was signalled
+ * and done, the ack latency of every client, and the clients which timed out.
+ *
+ * @param  action   "poweroff" or "reboot", or NULL if not known yet
+ * @param  reason   given for the action, or NULL
+ */
+static void
+timing_save(const char *action, const char *reason)
+{
+	GString *str = g_string_sized_new(1024);
+	int tier;
+	int i;
+
+	g_string_append_printf(str, "{\"time\":%ld,\"boot_id\":\"%s\",\"initiated\":%s",
+	                       (long)TimeSourceNow(), sBootId, sTimingInitiated ? "true" : "false");
+
+	if (action)
+	{
+		gchar *escaped_reason = g_strescape(reason ? reason : "", NULL);
+
+		g_string_append_printf(str, ",\"action\":\"%s\",\"reason\":\"%s\"", action,
+		                       escaped_reason);
+		g_free(escaped_reason);
+	}
+
+	if (sFastHaltMs >= 0)
+	{
+		g_string_append_printf(str, ",\"fast_halt\":true,\"halt_ms\":%d", sFastHaltMs);
+	}
+
+	if (sTimingInitiated)
+	{
+		g_string_append_printf(str, ",\"total_ms\":%d,\"tiers\":[",
+		                       (int)(g_timer_elapsed(shutdown_timer, NULL) * 1000));
+
+		for (tier = 0; tier < kShutdownTierLast; tier++)
+		{
+			ShutdownTiming timing = { str, true };
+			GHashTable *clients = (tier == kShutdownTierApps) ?
+			                      sClientList->applications : sClientList->services;
+
+			g_string_append_printf(str, "%s{\"tier\":\"%s\"", tier ? "," : "",
+			                       ShutdownTierString[tier]);
+
+			if (sTierStart[tier] < 0)
+			{
+				// not signalled, as with a fast halt
+				g_string_append(str, ",\"skipped\":true}");
+				continue;
+			}
+
+			g_string_append_printf(str, ",\"start_ms\":%d",
+			                       (int)(sTierStart[tier] * 1000));
+
+			if (sTierEnd[tier] >= 0)
+			{
+				g_string_append_printf(str, ",\"duration_ms\":%d",
+				                       (int)((sTierEnd[tier] - sTierStart[tier]) * 1000));
+			}
+
+			g_string_append(str, ",\"clients\":[");
+			g_hash_table_foreach(clients, (GHFunc)timing_client_json, &timing);
+			g_string_append(str, "],\"histogram\":[");
+
+			for (i = 0; i < G_N_ELEMENTS(kTimingBucketsMs); i++)
+			{
+				g_string_append_printf(str, "%s{\"le_ms\":%d,\"count\":%d}", i ? "," : "",
+				                       kTimingBucketsMs[i], timing.buckets[i]);
+			}
+
+			g_string_append_printf(str, "],\"timed_out\":%d}", timing.timed_out);
+		}
+
+		g_string_append(str, "]");
+	}
+
+	g_string_append(str, "}");
+
+	if (!g_file_set_contents(sTimingPath, str->str, str->len, NULL))
+	{
+		SLEEPDLOG_WARNING(MSGID_SHUTDOWN_TIMING_SAVE_FAIL, 1,
+		                  PMLOGKS("FileName", sTimingPath),
+		                  "Could not save shutdown timing");
+	}
+
+	g_string_free(str, TRUE);
+}
+
+/**
+ * @brief Load the timing record of the shutdown before this boot.
+ *
+ * The record holds the id of the boot it was written in, boot_id, and of the boot
+ * which first loaded it, loaded_boot_id, which this adds. It is reported for its
+ * loading boot only, across restarts of sleepd, so that after a boot which ends
+ * without a record, e.g. on a crash, the next boot doesn't report an older one.
+ */
+static void
+timing_load(void)
+{
+	gchar *contents = NULL;
+
+	sTimingPath = g_build_filename(gSleepConfig.preference_dir,
+	                               SHUTDOWN_TIMING_NAME, NULL);
+
+	SysfsGetString("/proc/sys/kernel/random/boot_id", sBootId, sizeof(sBootId));
+
+	if (!g_file_get_contents(sTimingPath, &contents, NULL, NULL))
+	{
+		return;
+	}
+
+	struct json_object *object = json_tokener_parse(contents);
+
+	g_free(contents);
+
+	if (is_error(object))
+	{
+		SLEEPDLOG_DEBUG("Ignoring invalid shutdown timing record");
+		return;
+	}
+
+	const char *boot_id = json_object_get_string(
+	                          json_object_object_get(object, "boot_id"));
+	const char *loaded_boot_id = json_object_get_string(
+	                                 json_object_object_get(object, "loaded_boot_id"));
+
+	if (!boot_id || !strcmp(boot_id, sBootId))
+	{
+		// written by this boot, before a restart of sleepd: not a shutdown
+		SLEEPDLOG_DEBUG("Ignoring shutdown timing record of this boot");
+	}
+	else if (!loaded_boot_id)
+	{
+		json_object_object_add(object, "loaded_boot_id",
+		                       json_object_new_string(sBootId));
+		sLastTiming = g_strdup(json_object_to_json_string(object));
+
+		if (!g_file_set_contents(sTimingPath, sLastTiming, -1, NULL))
+		{
+			SLEEPDLOG_WARNING(MSGID_SHUTDOWN_TIMING_SAVE_FAIL, 1,
+			                  PMLOGKS("FileName", sTimingPath),
+			                  "Could not save shutdown timing");
+		}
+	}
+	else if (!strcmp(loaded_boot_id, sBootId))
+	{
+		sLastTiming = g_strdup(json_object_to_json_string(object));
+	}
+	else
+	{
+		SLEEPDLOG_DEBUG("Ignoring stale shutdown timing record");
+	}
+
+	json_object_put(object);
+}
+
 static ShutdownClient *
-client_new(const char *key, const char *clientName)
+client_new(const char *key, const char *clientName, ShutdownTier tier)
 {
 	ShutdownClient *client = g_new0(ShutdownClient, 1);
 	client->id  = g_strdup(key);
 	client->name = g_strdup(clientName);
+	client->tier = tier;
 	client->ack_shutdown = kShutdownReplyNoRsp;
+	client->deadline = history_deadline(tier, clientName);
+
+	if (client->name)
+	{
+		GHashTable *by_name = sClientList->by_name[tier];
+		GList *named = g_hash_table_lookup(by_name, client->name);
+
+		g_hash_table_insert(by_name, g_strdup(client->name),
+		                    g_list_prepend(named, client));
+	}
 
 	return client;
 }
@@ -234,6 +644,27 @@ client_free(ShutdownClient *client)
 {
 	if (client)
 	{
+		if (client->after_apps)
+		{
+			sClientList->num_after_apps--;
+		}
+
+		if (client->name)
+		{
+			GHashTable *by_name = sClientList->by_name[client->tier];
+			GList *named = g_list_remove(g_hash_table_lookup(by_name, client->name),
+			                             client);
+
+			if (named)
+			{
+				g_hash_table_insert(by_name, g_strdup(client->name), named);
+			}
+			else
+			{
+				g_hash_table_remove(by_name, client->name);
+			}
+		}
+
 		g_free(client->id);
 		g_free(client->name);
 		g_free(client);
@@ -249,7 +680,7 @@ client_free(ShutdownClient *client)
 static void
 client_new_application(const char *key, const char *clientName)
 {
-	ShutdownClient *client = client_new(key, clientName);
+	ShutdownClient *client = client_new(key, clientName, kShutdownTierApps);
 	g_hash_table_replace(sClientList->applications, client->id, client);
 }
 
@@ -258,11 +689,19 @@ client_new_application(const char *key, const char *clientName)
  *
  * @param key Unique key for this client
  * @param clientName Name of the application
+ * @param afterApps Whether the service must wait for the applications to shut down
  */
 static void
-client_new_service(const char *key, const char *clientName)
+client_new_service(const char *key, const char *clientName, bool afterApps)
 {
-	ShutdownClient *client = client_new(key, clientName);
+	ShutdownClient *client = client_new(key, clientName, kShutdownTierServices);
+	client->after_apps = afterApps;
+
+	if (afterApps)
+	{
+		sClientList->num_after_apps++;
+	}
+
 	g_hash_table_replace(sClientList->services, client->id, client);
 }
 
@@ -325,7 +764,15 @@ client_lookup_app(const char *uid)
 static void
 client_list_reset_ack_count()
 {
-	sClientList->num_ack = 0;
+	int i;
+
+	for (i = 0; i < kShutdownTierLast; i++)
+	{
+		sClientList->num_ack[i] = 0;
+		sTierStart[i] = -1.0;
+		sTierEnd[i] = -1.0;
+	}
+
 	sClientList->num_nack = 0;
 }
 
@@ -350,7 +797,7 @@ client_list_vote_init()
 static void
 client_vote(ShutdownClient *client, bool ack)
 {
-	if (!client)
+	if (!client || client->ack_shutdown != kShutdownReplyNoRsp)
 	{
 		return;
 	}
@@ -361,7 +808,7 @@ client_vote(ShutdownClient *client, bool ack)
 
 	if (ack)
 	{
-		sClientList->num_ack++;
+		sClientList->num_ack[client->tier]++;
 	}
 	else
 	{
@@ -375,9 +822,9 @@ client_vote(ShutdownClient *client, bool ack)
 static void
 client_vote_print(const char *key, ShutdownClient *client, void *data)
 {
-	SLEEPDLOG_DEBUG("%s %s %s @ %fs", client->id, client->name,
+	SLEEPDLOG_DEBUG("%s %s %s @ %fs (deadline %fs)", client->id, client->name,
 	                shutdown_reply_to_string(client->ack_shutdown),
-	                client->elapsed);
+	                client->elapsed, client->deadline);
 }
 
 /**
@@ -413,7 +860,7 @@ shutdown_apps_ready()
 	if (0 == sClientList->num_nack)
 	{
 		int num_clients = g_hash_table_size(sClientList->applications);
-		return sClientList->num_ack >= num_clients;
+		return sClientList->num_ack[kShutdownTierApps] >= num_clients;
 	}
 	else
 	{
@@ -432,7 +879,7 @@ shutdown_services_ready()
 	if (0 == sClientList->num_nack)
 	{
 		int num_clients = g_hash_table_size(sClientList->services);
-		return sClientList->num_ack >= num_clients;
+		return sClientList->num_ack[kShutdownTierServices] >= num_clients;
 	}
 	else
 	{
@@ -466,6 +913,56 @@ shutdown_state_dispatch(ShutdownEvent *event)
 	}
 }
 
+/**
+ * @brief Latest deadline of the clients of a tier which did not respond yet
+ */
+static void
+client_pending_deadline(const char *key, ShutdownClient *client,
+                        double *deadline)
+{
+	if (client->ack_shutdown == kShutdownReplyNoRsp)
+	{
+		*deadline = MAX(*deadline, client->deadline);
+	}
+}
+
+/**
+ * @brief (Re)arm the timeout of a tier, for its slowest client still to respond.
+ */
+static void
+shutdown_arm_timeout(ShutdownTier tier)
+{
+	GHashTable *clients = (tier == kShutdownTierApps) ?
+	                      sClientList->applications : sClientList->services;
+	double deadline = 0.0;
+
+	g_hash_table_foreach(clients, (GHFunc)client_pending_deadline, &deadline);
+
+	double remaining = sTierStart[tier] + deadline -
+	                   g_timer_elapsed(shutdown_timer, NULL);
+
+	if (shutdown_apps_timeout_id)
+	{
+		g_source_remove(shutdown_apps_timeout_id);
+	}
+
+	shutdown_apps_timeout_id = g_timeout_add(remaining > 0 ? remaining * 1000 : 0,
+	                           (GSourceFunc)shutdown_timeout, NULL);
+}
+
+/**
+ * @brief Stop waiting on the current tier
+ */
+static void
+shutdown_cancel_timeout(void)
+{
+	if (shutdown_apps_timeout_id)
+	{
+		g_source_remove(shutdown_apps_timeout_id);
+		shutdown_apps_timeout_id = 0;
+	}
+}
+
 /**
  * @brief Broadcast the "shutdownApplications" signal
  */
@@ -476,6 +973,8 @@ send_shutdown_apps()
 	LSError lserror;
 	LSErrorInit(&lserror);
 
+	sTierStart[kShutdownTierApps] = g_timer_elapsed(shutdown_timer, NULL);
+
 	retVal = LSSignalSend(GetLunaServiceHandle(),
 	                      "luna://com.palm.sleep/shutdown/shutdownApplications",
 	                      "{}", &lserror);
@@ -500,6 +999,8 @@ send_shutdown_services()
 	LSError lserror;
 	LSErrorInit(&lserror);
 
+	sTierStart[kShutdownTierServices] = g_timer_elapsed(shutdown_timer, NULL);
+
 	retVal = LSSignalSend(GetLunaServiceHandle(),
 	                      "luna://com.palm.sleep/shutdown/shutdownServices",
 	                      "{}", &lserror);
@@ -540,37 +1041,21 @@ shutdown_client_cancel_registration_by_name(char *clientName)
 		return;
 	}
 
-	ShutdownClient *clientInfo = NULL;
-	GHashTableIter iter;
-	gpointer key, value;
-
-	g_hash_table_iter_init(&iter, sClientList->applications);
+	GList *named = g_hash_table_lookup(sClientList->by_name[kShutdownTierApps],
+	                                   clientName);
 
-	while (g_hash_table_iter_next(&iter, &key, &value))
+	if (named)
 	{
-		clientInfo = value;
-
-		if (!strcmp(clientInfo->name, clientName))
-		{
-			client_unregister_service(clientInfo->id);
-			break;
-		}
+		client_unregister_application(((ShutdownClient *)named->data)->id);
 	}
 
-	g_hash_table_iter_init(&iter, sClientList->services);
+	named = g_hash_table_lookup(sClientList->by_name[kShutdownTierServices],
+	                            clientName);
 
-	while (g_hash_table_iter_next(&iter, &key, &value))
+	if (named)
 	{
-		clientInfo = value;
-
-		if (!strcmp(clientInfo->name, clientName))
-		{
-			client_unregister_service(clientInfo->id);
-			return;
-		}
+		client_unregister_service(((ShutdownClient *)named->data)->id);
 	}
-
-	return;
 }
 
 /**
@@ -585,7 +1070,17 @@ state_idle(ShutdownEvent *event, ShutdownState *next)
 	{
 		case kShutdownEventShutdownInit:
 			client_list_vote_init();
-			*next = kPowerShutdownApps;
+
+			if (sFastHalt)
+			{
+				SLEEPDLOG_DEBUG("Fast halt: skipping shutdown of apps and services");
+				*next = kPowerShutdownAction;
+			}
+			else
+			{
+				*next = kPowerShutdownApps;
+			}
+
 			return true;
 
 		default:
@@ -595,7 +1090,8 @@ state_idle(ShutdownEvent *event, ShutdownState *next)
 
 /**
  * @brief This is the first state that sleepd will go into once the shutdown process has begun.
- * In this state the "shutdownApplications" signal is sent to all the registered clients.
+ * In this state the "shutdownApplications" signal is sent to all the registered clients, and
+ * the "shutdownServices" signal too if no service waits for the applications.
  */
 static bool
 state_shutdown_apps(ShutdownEvent *event, ShutdownState *next)
@@ -605,22 +1101,29 @@ state_shutdown_apps(ShutdownEvent *event, ShutdownState *next)
 	event->id = kShutdownEventNone;
 	*next = kPowerShutdownAppsProcess;
 
-	shutdown_apps_timeout_id =
-	    g_timeout_add_seconds(15, (GSourceFunc)shutdown_timeout, NULL);
-
 	send_shutdown_apps();
 
+	if (sClientList->num_after_apps == 0)
+	{
+		SLEEPDLOG_DEBUG("Services do not depend on apps, shutting both down");
+		send_shutdown_services();
+	}
+
+	shutdown_arm_timeout(kShutdownTierApps);
+
 	return true;
 }
 
 /**
- * @brief This function is called when any of the clients haven't responded back even after 15 sec.
+ * @brief This function is called when any of the clients haven't responded back by their deadline.
  */
 static bool
 shutdown_timeout(void *data)
 {
 	ShutdownEvent event;
 
+	shutdown_apps_timeout_id = 0;
+
 	event.id = kShutdownEventTimeout;
 	event.client = NULL;
 
@@ -663,40 +1166,48 @@ state_shutdown_apps_process(ShutdownEvent *event, ShutdownState *next)
 
 		client_list_print(sClientList->applications);
 
-		g_source_remove(shutdown_apps_timeout_id);
+		shutdown_cancel_timeout();
+		sTierEnd[kShutdownTierApps] = g_timer_elapsed(shutdown_timer, NULL);
 
 		*next = kPowerShutdownServices;
 		return true;
 	}
 	else if (readiness < 0)
 	{
+		shutdown_cancel_timeout();
 		*next = kPowerShutdownNone;
 		return false;
 	}
 	else
 	{
+		if (event->id == kShutdownEventAck)
+		{
+			shutdown_arm_timeout(kShutdownTierApps);
+		}
+
 		*next = kPowerShutdownAppsProcess;
 		return false;
 	}
 }
 
 /**
- * @brief This is the first state that sleepd will go into once the shutdown process has begun.
- * In this state the "shutdownServices" signal is sent to all the registered clients.
+ * @brief This is the state that sleepd will go into once the applications shut down.
+ * In this state the "shutdownServices" signal is sent to all the registered clients, unless
+ * it was already sent along with the "shutdownApplications" signal.
  */
 
 static bool
 state_shutdown_services(ShutdownEvent *event, ShutdownState *next)
 {
-	client_list_reset_ack_count();
-
 	event->id = kShutdownEventNone;
 	*next = kPowerShutdownServicesProcess;
 
-	shutdown_apps_timeout_id =
-	    g_timeout_add_seconds(15, (GSourceFunc)shutdown_timeout, NULL);
+	if (sTierStart[kShutdownTierServices] < 0)
+	{
+		send_shutdown_services();
+	}
 
-	send_shutdown_services();
+	shutdown_arm_timeout(kShutdownTierServices);
 
 	return true;
 }
@@ -736,16 +1247,23 @@ state_shutdown_services_process(ShutdownEvent *event, ShutdownState *next)
 		client_list_print(sClientList->services);
 
 		*next = kPowerShutdownAction;
-		g_source_remove(shutdown_apps_timeout_id);
+		shutdown_cancel_timeout();
+		sTierEnd[kShutdownTierServices] = g_timer_elapsed(shutdown_timer, NULL);
 		return true;
 	}
 	else if (readiness < 0)
 	{
+		shutdown_cancel_timeout();
 		*next = kPowerShutdownNone;
 		return false;
 	}
 	else
 	{
+		if (event->id == kShutdownEventAck)
+		{
+			shutdown_arm_timeout(kShutdownTierServices);
+		}
+
 		*next = kPowerShutdownServicesProcess;
 		return false;
 	}
@@ -759,6 +1277,12 @@ state_shutdown_services_process(ShutdownEvent *event, ShutdownState *next)
 static bool
 state_shutdown_action(ShutdownEvent *event, ShutdownState *next)
 {
+	SLEEPDLOG_DEBUG("Shutdown: clients done @ %fs", g_timer_elapsed(shutdown_timer,
+	                NULL));
+
+	history_save();
+	timing_save(NULL, NULL);
+
 	bool retVal =
 	    LSMessageReply(GetLunaServiceHandle(), shutdown_message,
 	                   "{\"success\":true}", NULL);
@@ -815,7 +1339,9 @@ send_reply(LSHandle *sh, LSMessage *message,
  * @brief The callback function for "initiate" method. This will initiate the shutdown process.
  *
  * @param  sh
- * @param  message This method doesn't need any arguments.
+ * @param  message with optional "fastHalt" (default: the fasthalt setting) to skip the
+ *                 shutdown of apps and services, and have machineOff or machineReboot
+ *                 halt right away.
  * @param  user_data
  */
 static bool
@@ -826,10 +1352,27 @@ initiateShutdown(LSHandle *sh, LSMessage *message, void *user_data)
 	event.id = kShutdownEventShutdownInit;
 	event.client = NULL;
 
+	struct json_object *object = json_tokener_parse(LSMessageGetPayload(message));
+
+	sFastHalt = gSleepConfig.fasthalt;
+
+	if (!is_error(object))
+	{
+		struct json_object *fast_halt = json_object_object_get(object, "fastHalt");
+
+		if (fast_halt)
+		{
+			sFastHalt = json_object_get_boolean(fast_halt);
+		}
+
+		json_object_put(object);
+	}
+
 	LSMessageRef(message);
 	shutdown_message = message;
 
 	g_timer_start(shutdown_timer);
+	sTimingInitiated = true;
 
 	shutdown_state_dispatch(&event);
 	return true;
@@ -1006,7 +1549,9 @@ end:
  * added.
  *
  * @param sh
- * @param message contains "clientName" for service name.
+ * @param message contains "clientName" for service name, and optional "afterApplications"
+ *                (default true): false if the service does not depend on the applications
+ *                to shut down.
  * @param user_data
  */
 
@@ -1027,7 +1572,11 @@ shutdownServicesRegister(LSHandle *sh, LSMessage *message,
 	const char *clientName = json_object_get_string(json_object_object_get(
 	                             object, "clientName"));
 
-	client_new_service(clientId, clientName);
+	struct json_object *after_apps = json_object_object_get(object,
+	                                 "afterApplications");
+
+	client_new_service(clientId, clientName,
+	                   !after_apps || json_object_get_boolean(after_apps));
 
 	bool retVal;
 	LSError lserror;
@@ -1051,11 +1600,57 @@ end:
 	return true;
 }
 
+/**
+ * @brief Whether machineOff or machineReboot should halt right away: if asked in the
+ * message, or else as decided by initiate, or by the fasthalt setting if there was
+ * no initiate.
+ */
+static bool
+fast_halt_requested(struct json_object *object)
+{
+	struct json_object *fast_halt = json_object_object_get(object, "fastHalt");
+
+	if (fast_halt)
+	{
+		return json_object_get_boolean(fast_halt);
+	}
+
+	// initiate seeded sFastHalt from the setting, unless it asked otherwise
+	return sTimingInitiated ? sFastHalt : gSleepConfig.fasthalt;
+}
+
+/**
+ * @brief Flush our state in a single write phase and halt.
+ *
+ * Alarms and timeouts are written to storage as they change, their database log
+ * included: only the time and the timing record are left to write, and everything
+ * is then synced at once rather than file by file. The halt_ms of the timing
+ * record so covers the writes but not the sync.
+ */
+static void
+fast_halt(bool reboot, const char *reason)
+{
+	gint64 start = g_get_monotonic_time();
+
+	timesaver_save_unsynced();
+
+	sFastHaltMs = (g_get_monotonic_time() - start) / 1000;
+	timing_save(reboot ? "reboot" : "poweroff", reason);
+
+	sync();
+
+	SLEEPDLOG_INFO(MSGID_FAST_HALT, 1, PMLOGKFV("HALT_MS", "%d",
+	               (int)((g_get_monotonic_time() - start) / 1000)),
+	               "State flushed, halting");
+
+	MachineFastHalt(reboot, reason);
+}
+
 /**
  * @brief Shutdown the machine forcefully
  *
  * @param sh
- * @param message with "reason" field for shutdown reason.
+ * @param message with "reason" field for shutdown reason, and optional "fastHalt".
  * @param user_data
  */
 static bool
@@ -1080,7 +1675,16 @@ machineOff(LSHandle *sh, LSMessage *message,
 		goto cleanup;
 	}
 
-	MachineForceShutdown(reason);
+	if (fast_halt_requested(object))
+	{
+		fast_halt(false, reason);
+	}
+	else
+	{
+		timing_save("poweroff", reason);
+		MachineForceShutdown(reason);
+	}
+
 	LSMessageReplySuccess(sh, message);
 
 cleanup:
@@ -1097,7 +1701,7 @@ cleanup:
  * @brief Reboot the machine forcefully by calling "reboot"
  *
  * @param sh
- * @param message with "reason" field for reboot reason.
+ * @param message with "reason" field for reboot reason, and optional "fastHalt".
  * @param user_data
  */
 
@@ -1123,7 +1727,16 @@ machineReboot(LSHandle *sh, LSMessage *message,
 		goto cleanup;
 	}
 
-	MachineForceReboot(reason);
+	if (fast_halt_requested(object))
+	{
+		fast_halt(true, reason);
+	}
+	else
+	{
+		timing_save("reboot", reason);
+		MachineForceReboot(reason);
+	}
+
 	LSMessageReplySuccess(sh, message);
 
 cleanup:
@@ -1136,6 +1749,30 @@ cleanup:
 	return true;
 }
 
+/**
+ * @brief Report the timing record of the shutdown before this boot: when each tier
+ * was signalled and done, the ack latency of every client and the clients which
+ * timed out.
+ *
+ * @param sh
+ * @param message This method doesn't need any arguments.
+ * @param user_data
+ */
+static bool
+shutdownTiming(LSHandle *sh, LSMessage *message, void *user_data)
+{
+	if (sLastTiming)
+	{
+		send_reply(sh, message, "{\"returnValue\":true,\"last\":%s}", sLastTiming);
+	}
+	else
+	{
+		send_reply(sh, message, "{\"returnValue\":true}");
+	}
+
+	return true;
+}
+
 LSMethod shutdown_methods[] =
 {
 	{ "initiate", initiateShutdown, },
@@ -1151,6 +1788,8 @@ LSMethod shutdown_methods[] =
 	{ "machineOff", machineOff },
 	{ "machineReboot", machineReboot },
 
+	{ "timing", shutdownTiming },
+
 	{ },
 };
 
@@ -1169,18 +1808,32 @@ shutdown_init(void)
 	                            NULL, (GDestroyNotify)client_free);
 	sClientList->services = g_hash_table_new_full(g_str_hash, g_str_equal,
 	                        NULL, (GDestroyNotify)client_free);
-	sClientList->num_ack = 0;
-	sClientList->num_nack = 0;
+
+	int tier;
+
+	for (tier = 0; tier < kShutdownTierLast; tier++)
+	{
+		sClientList->by_name[tier] = g_hash_table_new_full(g_str_hash, g_str_equal,
+		                             g_free, NULL);
+	}
+	client_list_reset_ack_count();
 
 	shutdown_timer = g_timer_new();
 
+	sHistoryPath = g_build_filename(gSleepConfig.preference_dir,
+	                                SHUTDOWN_HISTORY_NAME, NULL);
+	sHistory = g_key_file_new();
+	g_key_file_load_from_file(sHistory, sHistoryPath, G_KEY_FILE_NONE, NULL);
+
+	timing_load();
+
 	gCurrentState = &kStateMachine[kPowerShutdownNone];
 
 	LSError lserror;
 	LSErrorInit(&lserror);
 
-	if (!LSRegisterCategory(GetLunaServiceHandle(),
-	                        "/shutdown", shutdown_methods, shutdown_signals, NULL, &lserror))
+	if (!LSRegisterCategoryNoted(GetLunaServiceHandle(),
+	                             "/shutdown", shutdown_methods, shutdown_signals, &lserror))
 	{
 		goto error;
 	}
@@ -1193,6 +1846,6 @@ error:
 	return -1;
 }
 
-INIT_FUNC(INIT_FUNC_MIDDLE, shutdown_init);
+INIT_FUNC("config_init", shutdown_init);
 
 /* @} END OF ShutdownProcess */
@@ -38,6 +38,7 @@
 
 #include "suspend.h"
 #include "clock.h"
+#include "timesource.h"
 #include "wait.h"
 #include "machine.h"
 #include "debug.h"
@@ -53,6 +54,7 @@
 #include "reference_time.h"
 #include "config.h"
 #include "sawmill_logger.h"
+#include "wakeup.h"
 #include "nyx/nyx_client.h"
 
 #include <cjson/json.h>
@@ -60,9 +62,6 @@
 
 #define LOG_DOMAIN "PWREVENT-SUSPEND: "
 
-#define kPowerBatteryCheckReasonSysfs "/sys/power/batterycheck_wakeup"
-#define kPowerWakeupSourcesSysfs      "/sys/power/wakeup_event_list"
-
 #define MIN_IDLE_SEC 5
 
 /*
@@ -79,6 +78,7 @@ enum
     kPowerStateKernelResume,
     kPowerStateActivityResume,
     kPowerStateAbortSuspend,
+    kPowerStateDarkResume,
     kPowerStateLast
 };
 typedef int PowerState;
@@ -87,15 +87,16 @@ enum
 {
     kResumeTypeKernel,
     kResumeTypeActivity,
-    kResumeAbortSuspend
+    kResumeAbortSuspend,
+    kResumeTypeDark
 };
 
 static char *resume_type_descriptions[] =
 {
 	"kernel",
 	"pwrevent_activity",
-	"pwrevent_non_idle",
 	"abort_suspend",
+	"dark_wake",
 };
 
 // A PowerStateProc processes the current state and returns the next state
@@ -119,6 +120,7 @@ static PowerState StateSleep(void);
 static PowerState StateKernelResume(void);
 static PowerState StateActivityResume(void);
 static PowerState StateAbortSuspend(void);
+static PowerState StateDarkResume(void);
 
 /**
  * @defgroup SuspendLogic   Suspend/Resume State Machine
@@ -158,6 +160,12 @@ static PowerState StateAbortSuspend(void);
  * to "On" state.
  *
  * 8. AbortSuspend: It will broadcast the "Resume" signal and go back to the "On" state.
+ *
+ * 9. DarkResume: The system woke up only because one of our RTC alarms is due (and "dark_wake" is
+ * enabled). Due timeouts are fired and only the "darkResume" signal is broadcast; the other clients are
+ * never told that the system resumed. Once idle again, the device goes straight back to the "Sleep"
+ * state without a new round of votes. If the display turns on meanwhile, the "Resume" signal is
+ * broadcast and the device is fully awake again.
  */
 
 /**
@@ -176,7 +184,8 @@ static const PowerStateNode kStateMachine[kPowerStateLast] =
 	[kPowerStateSleep]          = { kPowerStateSleep,            StateSleep },
 	[kPowerStateKernelResume]   = { kPowerStateKernelResume,     StateKernelResume },
 	[kPowerStateActivityResume] = { kPowerStateActivityResume,   StateActivityResume },
-	[kPowerStateAbortSuspend]   = { kPowerStateAbortSuspend,     StateAbortSuspend }
+	[kPowerStateAbortSuspend]   = { kPowerStateAbortSuspend,     StateAbortSuspend },
+	[kPowerStateDarkResume]     = { kPowerStateDarkResume,       StateDarkResume }
 };
 
 // current state
@@ -201,11 +210,19 @@ struct timespec sTimeOnWake;
 struct timespec sSuspendRTC;
 struct timespec sWakeRTC;
 
+/* True while awake only to service our own RTC alarm, see StateDarkResume() */
+static bool sDarkWake = false;
+
+/* The suspend thread's copy of the config, refreshed when its generation changes */
+static SleepConfiguration sConfig;
+static int sConfigGeneration = -1;
+
 void SuspendIPCInit(void);
 int SendSuspendRequest(const char *message);
 int SendPrepareSuspend(const char *message);
 int SendResume(int resumetype, char *message);
 int SendSuspended(const char *message);
+int SendDarkResume(const char *message);
 
 void
 StateLoopShutdown(void)
@@ -278,6 +295,18 @@ switchoffDisplay(void)
  * specified time, to trigger the next state in the state machine.
  */
 
+/**
+ * @brief Pick up config changes, on the suspend thread.
+ */
+static void
+SuspendConfigRefresh(void)
+{
+	if (ConfigGeneration() != sConfigGeneration)
+	{
+		sConfigGeneration = ConfigSnapshot(&sConfig);
+	}
+}
+
 gboolean
 IdleCheck(gpointer ctx)
 {
@@ -287,10 +316,20 @@ IdleCheck(gpointer ctx)
 	struct timespec now;
 	int next_idle_ms = 0;
 
-	if (!IsDisplayOn())
+	SuspendConfigRefresh();
+
+	bool display_on = IsDisplayOn();
+
+	if (sDarkWake && display_on)
+	{
+		sDarkWake = false;
+		SendResume(kResumeTypeKernel, "resume (dark wake ended, display on)");
+	}
+
+	if (!display_on)
 	{
 
-		ClockGetTime(&now);
+		TimeSourceGet(kTimeSourceMonotonic, &now);
 
 		/*
 		 * Enforce that the minimum time awake must be at least
@@ -300,7 +339,7 @@ IdleCheck(gpointer ctx)
 		last_wake.tv_sec = sTimeOnWake.tv_sec;
 		last_wake.tv_nsec = sTimeOnWake.tv_nsec;
 
-		ClockAccumMs(&last_wake, gSleepConfig.after_resume_idle_ms);
+		ClockAccumMs(&last_wake, sConfig.after_resume_idle_ms);
 
 		if (!ClockTimeIsGreater(&last_wake, &now))
 		{
@@ -334,7 +373,7 @@ IdleCheck(gpointer ctx)
 					g_free(key);
 					int next_wake = expiry - reference_time();
 
-					if (next_wake >= 0 && next_wake <= gSleepConfig.wait_alarms_s)
+					if (next_wake >= 0 && next_wake <= sConfig.wait_alarms_s)
 					{
 						SLEEPDLOG_DEBUG("Not going to sleep because an alarm is about to fire in %d sec\n",
 						                next_wake);
@@ -367,7 +406,7 @@ IdleCheck(gpointer ctx)
 
 resched:
 	{
-		long wait_idle_ms = gSleepConfig.wait_idle_ms;
+		long wait_idle_ms = sConfig.wait_idle_ms;
 		long max_duration_ms = PwrEventActivityGetMaxDuration(&now);
 
 		if (max_duration_ms > wait_idle_ms)
@@ -391,6 +430,8 @@ SuspendStateUpdate(PowerEvent power_event)
 	gSuspendEvent = power_event;
 	PowerState next_state = kPowerStateLast;
 
+	SuspendConfigRefresh();
+
 	do
 	{
 		next_state = gCurrentStateNode.function();
@@ -420,10 +461,13 @@ SuspendThread(void *ctx)
 	context = g_main_context_new();
 
 	suspend_loop = g_main_loop_new(context, FALSE);
+	TimeSourceAttach(context);
 	g_main_context_unref(context);
 
+	SuspendConfigRefresh();
+
 	idle_scheduler = g_timer_source_new(
-	                     gSleepConfig.wait_idle_ms, gSleepConfig.wait_idle_granularity_ms);
+	                     sConfig.wait_idle_ms, sConfig.wait_idle_granularity_ms);
 
 	g_source_set_callback((GSource *)idle_scheduler,
 	                      IdleCheck, NULL, NULL);
@@ -452,7 +496,8 @@ StateOn(void)
 	switch (gSuspendEvent)
 	{
 		case kPowerEventForceSuspend:
-			next_state = kPowerStateSuspendRequest;
+			// clients were never told about a dark wake, there is nothing to vote on
+			next_state = sDarkWake ? kPowerStateSleep : kPowerStateSuspendRequest;
 			break;
 
 		case kPowerEventIdleEvent:
@@ -482,11 +527,17 @@ StateOn(void)
 static PowerState
 StateOnIdle(void)
 {
-	if (!MachineCanSleep())
+	if (!MachineCanSleep(sConfig.suspend_with_charger))
 	{
 		return kPowerStateOn;
 	}
 
+	if (sDarkWake)
+	{
+		// clients already approved the suspend we are going back to
+		return kPowerStateSleep;
+	}
+
 	return kPowerStateSuspendRequest;
 }
 
@@ -511,7 +562,7 @@ StateSuspendRequest(void)
 	static int log_count = START_LOG_COUNT;
 	PowerState ret;
 
-	ClockGetTime(&sTimeOnStartSuspend);
+	TimeSourceGet(kTimeSourceMonotonic, &sTimeOnStartSuspend);
 
 	WaitObjectLock(&gWaitSuspendResponse);
 
@@ -521,13 +572,13 @@ StateSuspendRequest(void)
 
 	// send msg to ask for permission to sleep
 	SLEEPDLOG_DEBUG("Sent \"suspend request\", waiting up to %dms",
-	                gSleepConfig.wait_suspend_response_ms);
+	                sConfig.wait_suspend_response_ms);
 
 	if (!PwrEventClientsApproveSuspendRequest())
 	{
 		// wait for the message to arrive
 		timeout = WaitObjectWait(&gWaitSuspendResponse,
-		                         gSleepConfig.wait_suspend_response_ms);
+		                         sConfig.wait_suspend_response_ms);
 	}
 
 	WaitObjectUnlock(&gWaitSuspendResponse);
@@ -606,13 +657,13 @@ StatePrepareSuspend(void)
 	SendPrepareSuspend("");
 
 	PMLOG_TRACE("Sent \"prepare suspend\", waiting up to %dms",
-	            gSleepConfig.wait_prepare_suspend_ms);
+	            sConfig.wait_prepare_suspend_ms);
 
 	if (!PwrEventClientsApprovePrepareSuspend())
 	{
 
 		timeout = WaitObjectWait(&gWaitPrepareSuspend,
-		                         gSleepConfig.wait_prepare_suspend_ms);
+		                         sConfig.wait_prepare_suspend_ms);
 	}
 
 	WaitObjectUnlock(&gWaitPrepareSuspend);
@@ -681,7 +732,7 @@ InstrumentOnSleep(void)
 	struct timespec diff;
 	struct timespec diffAwake;
 
-	ClockGetTime(&sTimeOnSuspended);
+	TimeSourceGet(kTimeSourceMonotonic, &sTimeOnSuspended);
 	get_time_now(&sSuspendRTC);
 
 	ClockDiff(&diff, &sTimeOnSuspended, &sTimeOnStartSuspend);
@@ -711,7 +762,7 @@ InstrumentOnSleep(void)
 void
 InstrumentOnWake(int resumeType)
 {
-	ClockGetTime(&sTimeOnWake);
+	TimeSourceGet(kTimeSourceMonotonic, &sTimeOnWake);
 	get_time_now(&sWakeRTC);
 
 	struct timespec diffAsleep;
@@ -744,6 +795,17 @@ InstrumentOnWake(int resumeType)
 }
 
 
+/**
+ * @brief Tell whether the system was woken up by our own RTC alarm and nothing else, in which
+ * case there is no need to resume the rest of the system.
+ */
+static bool
+WokeByTimeoutAlarm(unsigned int wakeup_sources)
+{
+	return wakeup_sources == WAKEUP_SOURCE_MASK(kWakeupSourceRtc) &&
+	       timeout_wakeup_due();
+}
+
 /**
  * @brief In this state it will first send the "Suspended" signal to everybody. If any activity is active
  * at this point it will go resume by going to the "ActivityResume" state, else it will set the next state
@@ -760,7 +822,10 @@ StateSleep(void)
 
 	PMLOG_TRACE("State Sleep, We will try to go to sleep now");
 
-	SendSuspended("attempting to suspend (We are trying to sleep)");
+	if (!sDarkWake)
+	{
+		SendSuspended("attempting to suspend (We are trying to sleep)");
+	}
 
 	{
 		time_t expiry = 0;
@@ -792,12 +857,21 @@ StateSleep(void)
 
 	else
 	{
-		if (MachineCanSleep())
+		if (MachineCanSleep(sConfig.suspend_with_charger))
 		{
 			if (queue_next_wakeup())
 			{
 				// let the system sleep now.
-				MachineSleep();
+				timeout_db_checkpoint();
+				PwrEventWakeupOnSleep();
+				MachineSleep(sConfig.visual_leds_suspend);
+
+				unsigned int wakeup_sources = PwrEventWakeupClassify();
+
+				if (sConfig.dark_wake && WokeByTimeoutAlarm(wakeup_sources))
+				{
+					nextState = kPowerStateDarkResume;
+				}
 			}
 			else
 			{
@@ -828,6 +902,8 @@ static PowerState
 StateAbortSuspend(void)
 {
 	PMLOG_TRACE("State Abort suspend");
+	sDarkWake = false;
+	update_timeouts_on_resume();
 	SendResume(kResumeAbortSuspend, "resume (suspend aborted)");
 
 	return kPowerStateOn;
@@ -845,6 +921,11 @@ _stateResume(int resumeType)
 {
 	PMLOG_TRACE("We awoke");
 
+	sDarkWake = false;
+
+	// fire the timeouts that expired while asleep, without waiting for our own resume signal
+	update_timeouts_on_resume();
+
 	char *resumeDesc = g_strdup_printf("resume (%s)",
 	                                   resume_type_descriptions[resumeType]);
 	SendResume(resumeType, resumeDesc);
@@ -857,7 +938,7 @@ _stateResume(int resumeType)
 	InstrumentOnWake(resumeType);
 
 	// if we are inactive in 1s, go back to sleep.
-	ScheduleIdleCheck(gSleepConfig.after_resume_idle_ms, false);
+	ScheduleIdleCheck(sConfig.after_resume_idle_ms, false);
 
 	return kPowerStateOn;
 }
@@ -889,6 +970,31 @@ StateActivityResume(void)
 	return _stateResume(kResumeTypeActivity);
 }
 
+/**
+ * @brief We are in this state if the system woke up only because one of our RTC alarms is due.
+ * The due timeouts are fired and only the clients which subscribed to "darkResume" are told; once
+ * idle, the device goes back to sleep without broadcasting "Resume" nor voting again.
+ *
+ * @retval PowerState Next state
+ */
+
+static PowerState
+StateDarkResume(void)
+{
+	PMLOG_TRACE("Dark wake for a timeout");
+
+	sDarkWake = true;
+
+	update_timeouts_on_resume();
+	SendDarkResume("woke up for a timeout");
+
+	InstrumentOnWake(kResumeTypeDark);
+
+	ScheduleIdleCheck(sConfig.after_resume_idle_ms, false);
+
+	return kPowerStateOn;
+}
+
 /**
  * @brief Initialize the Suspend/Resume state machine.
  */
@@ -899,14 +1005,13 @@ SuspendInit(void)
 	pthread_t suspend_tid;
 
 	// initialize wake time.
-	ClockGetTime(&sTimeOnWake);
+	TimeSourceGet(kTimeSourceMonotonic, &sTimeOnWake);
 
 	WaitObjectInit(&gWaitSuspendResponse);
 	WaitObjectInit(&gWaitPrepareSuspend);
 
 	WaitObjectInit(&gWaitResumeMessage);
 
-	com_palm_suspend_lunabus_init();
 	PwrEventClientTableCreate();
 
 	SuspendIPCInit();
@@ -932,6 +1037,16 @@ SuspendInit(void)
 		abort();
 	}
 
+	return 0;
+}
+
+/**
+ * @brief Open the led controller, off the main thread: opening nyx devices may
+ * take a while.
+ */
+static int
+SuspendLedsInit(void)
+{
 	int ret = nyx_device_open(NYX_DEVICE_LED_CONTROLLER, "Default", &nyxDev);
 
 	if (ret != NYX_ERROR_NONE)
@@ -956,6 +1071,10 @@ TriggerSuspend(const char *reason, PowerEvent event)
 	g_source_unref(source);
 }
 
-INIT_FUNC(INIT_FUNC_END, SuspendInit);
+INIT_FUNC_ASYNC("", SuspendLedsInit);
+
+/* The suspend thread uses activities, leds and the timeout db right away */
+INIT_FUNC("config_init com_palm_suspend_lunabus_init _activity_init "
+          "SuspendLedsInit _timeout_db_init", SuspendInit);
 
 /* @} END OF SuspendLogic */
@@ -36,6 +36,8 @@
 #include "shutdown.h"
 #include "suspend.h"
 #include "activity.h"
+#include "activity_ledger.h"
+#include "wakeup.h"
 #include "logging.h"
 #include "lunaservice_utils.h"
 #include "config.h"
@@ -230,6 +232,117 @@ end:
 	return true;
 }
 
+/**
+ * @brief Report the activities which kept the device awake the longest over the last
+ * hour and the last 24 hours. The optional "top" parameter limits the number of
+ * activities reported per window (default 10).
+ *
+ * @param  sh
+ * @param  message
+ * @param  user_data
+ */
+bool
+activityLedgerCallback(LSHandle *sh, LSMessage *message, void *user_data)
+{
+	int top_n = 10;
+
+	struct json_object *object = json_tokener_parse(LSMessageGetPayload(message));
+
+	if (is_error(object))
+	{
+		goto malformed_json;
+	}
+
+	struct json_object *json_top = json_object_object_get(object, "top");
+
+	if (json_top)
+	{
+		top_n = json_object_get_int(json_top);
+
+		if (top_n <= 0 || top_n > 100)
+		{
+			goto invalid_syntax;
+		}
+	}
+
+	LSError lserror;
+	LSErrorInit(&lserror);
+
+	char *reply = PwrEventLedgerToJson(top_n);
+
+	if (!LSMessageReply(sh, message, reply, &lserror))
+	{
+		LSErrorPrint(&lserror, stderr);
+		LSErrorFree(&lserror);
+	}
+
+	g_free(reply);
+	goto end;
+
+invalid_syntax:
+	LSMessageReplyErrorInvalidParams(sh, message);
+	goto end;
+malformed_json:
+	LSMessageReplyErrorBadJSON(sh, message);
+	goto end;
+end:
+
+	if (!is_error(object))
+	{
+		json_object_put(object);
+	}
+
+	return true;
+}
+
+/**
+ * @brief Report, per wakeup source, how many times it woke the system up and how
+ * long the system then stayed awake.
+ *
+ * @param  sh
+ * @param  message
+ * @param  user_data
+ */
+bool
+wakeupStatsCallback(LSHandle *sh, LSMessage *message, void *user_data)
+{
+	LSError lserror;
+	LSErrorInit(&lserror);
+
+	char *reply = PwrEventWakeupStatsToJson();
+
+	if (!LSMessageReply(sh, message, reply, &lserror))
+	{
+		LSErrorPrint(&lserror, stderr);
+		LSErrorFree(&lserror);
+	}
+
+	g_free(reply);
+	return true;
+}
+
+/**
+ * @brief Reply with the startup profile: the time taken by each init func, and
+ * when the first request was served.
+ */
+bool
+startupStatsCallback(LSHandle *sh, LSMessage *message, void *user_data)
+{
+	LSError lserror;
+	LSErrorInit(&lserror);
+
+	char *reply = InitStartupToJson();
+
+	if (!LSMessageReply(sh, message, reply, &lserror))
+	{
+		LSErrorPrint(&lserror, stderr);
+		LSErrorFree(&lserror);
+	}
+
+	g_free(reply);
+	return true;
+}
+
 /**
  * @brief Register a new client with the given name.
  *
@@ -285,7 +398,7 @@ identifyCallback(LSHandle *sh, LSMessage *message, void *data)
 		goto error;
 	}
 
-	info->clientName = g_strdup(clientName);
+	PwrEventClientSetName(info, clientName);
 	info->clientId = g_strdup(clientId);
 	info->applicationName = g_strdup(applicationName);
 
@@ -445,6 +558,34 @@ SendResume(int resumetype, char *message)
 }
 
 
+/**
+ * @brief Broadcast the "darkResume" signal when the device woke up only to service
+ * one of our RTC alarms. Unlike "resume", only clients which subscribed to this
+ * signal are told that the system is running.
+ */
+
+int
+SendDarkResume(const char *message)
+{
+	bool retVal;
+	LSError lserror;
+	LSErrorInit(&lserror);
+
+	SLEEPDLOG_DEBUG("sending \"darkResume\" because %s", message);
+
+	retVal = LSSignalSend(GetLunaServiceHandle(),
+	                      "luna://com.palm.sleep/com/palm/power/darkResume",
+	                      "{}", &lserror);
+
+	if (!retVal)
+	{
+		LSErrorPrint(&lserror, stderr);
+		LSErrorFree(&lserror);
+	}
+
+	return retVal;
+}
+
 /**
  * @brief Broadcast the "suspended" signal when the system is just about to go to sleep.
  */
@@ -779,7 +920,10 @@ visualLedSuspendCallback(LSHandle *sh, LSMessage *message, void *data)
 	}
 
 	bool on = json_object_get_boolean(json_on);
-	gSleepConfig.visual_leds_suspend = on;
+	SleepConfiguration config = gSleepConfig;
+
+	config.visual_leds_suspend = on;
+	ConfigPublish(&config);
 
 	goto end;
 invalid_syntax:
@@ -833,6 +977,9 @@ LSMethod com_palm_suspend_methods[] =
 	{ "forceSuspend", forceSuspendCallback },
 	{ "identify", identifyCallback },
 	{ "clientCancelByName", clientCancelByName },
+	{ "activityLedger", activityLedgerCallback },
+	{ "wakeupStats", wakeupStatsCallback },
+	{ "startupStats", startupStatsCallback },
 
 	{ "visualLedSuspend", visualLedSuspendCallback },
 	{ "TESTSuspend", TESTSuspendCallback },
@@ -844,6 +991,7 @@ LSMethod com_palm_suspend_public_methods[] =
 {
 	{ "activityStart", activityStartCallback },
 	{ "activityEnd", activityEndCallback },
+	{ },
 };
 
 LSSignal com_palm_suspend_signals[] =
@@ -855,6 +1003,7 @@ LSSignal com_palm_suspend_signals[] =
 	{ "prepareSuspend" },
 	{ "suspended" },
 	{ "resume" },
+	{ "darkResume" },
 
 	{ },
 };
@@ -864,10 +1013,9 @@ int com_palm_suspend_lunabus_init(void)
 	LSError lserror;
 	LSErrorInit(&lserror);
 
-	if (!LSPalmServiceRegisterCategory(GetPalmService(), "/com/palm/power",
-	                                   com_palm_suspend_public_methods, com_palm_suspend_methods,
-	                                   com_palm_suspend_signals,
-	                                   NULL, &lserror))
+	if (!LSPalmServiceRegisterCategoryNoted(GetPalmService(), "/com/palm/power",
+	                                        com_palm_suspend_public_methods, com_palm_suspend_methods,
+	                                        com_palm_suspend_signals, &lserror))
 	{
 		goto error;
 	}
@@ -880,6 +1028,6 @@ error:
 	return -1;
 }
 
-INIT_FUNC(INIT_FUNC_END, com_palm_suspend_lunabus_init);
+INIT_FUNC("", com_palm_suspend_lunabus_init);
 
 /* @} END OF SuspendIPC */
@@ -0,0 +1,421 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2011-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+
+/**
+* @file wakeup.c
+*
+* @brief Classification and accounting of the sources which wake the system up.
+*
+* Every kernel resume is classified from the wakeup sources reported by the kernel.
+* For each source, we count the wakeups and the time the system then stayed awake
+* until it went back to sleep. RTC wakeups are further attributed to the timeout
+* the alarm was armed for. Kernel source names are matched exactly against a table
+* of known names.
+*/
+
+
+#include <glib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "clock.h"
+#include "timesource.h"
+#include "sysfs.h"
+#include "suspend.h"
+#include "logging.h"
+#include "timeout_alarm.h"
+#include "wakeup.h"
+
+#define LOG_DOMAIN "PWREVENT-WAKEUP: "
+
+#define kPowerBatteryCheckReasonSysfs "/sys/power/batterycheck_wakeup"
+#define kPowerWakeupSourcesSysfs      "/sys/power/wakeup_event_list"
+
+/**
+ * @addtogroup SuspendLogic
+ * @{
+ */
+
+typedef struct
+{
+	char *name;
+	int count;
+	long awake_ms;
+} WakeupStat;
+
+static const char *wakeup_source_names[kWakeupSourceLast] =
+{
+	[kWakeupSourceRtc]          = "rtc",
+	[kWakeupSourcePowerKey]     = "power_key",
+	[kWakeupSourceCharger]      = "charger",
+	[kWakeupSourceNetwork]      = "network",
+	[kWakeupSourceBatteryCheck] = "battery_check",
+	[kWakeupSourceOther]        = "other",
+};
+
+/*
+   Kernel wakeup source names, without their instance number ("rtc0" is "rtc").
+   Names which are not listed are accounted as kWakeupSourceOther, under their
+   own name.
+   */
+static const struct
+{
+	const char *name;
+	WakeupSource source;
+} wakeup_source_names_kernel[] =
+{
+	{ "rtc",            kWakeupSourceRtc },
+	{ "alarm",          kWakeupSourceRtc },
+	{ "alarmtimer",     kWakeupSourceRtc },
+	{ "rtc_alarm",      kWakeupSourceRtc },
+	{ "qpnp_rtc_alarm", kWakeupSourceRtc },
+	{ "power_key",      kWakeupSourcePowerKey },
+	{ "pwrkey",         kWakeupSourcePowerKey },
+	{ "pmic_pwrkey",    kWakeupSourcePowerKey },
+	{ "qpnp_pon",       kWakeupSourcePowerKey },
+	{ "power_button",   kWakeupSourcePowerKey },
+	{ "usb",            kWakeupSourceCharger },
+	{ "usb_vbus",       kWakeupSourceCharger },
+	{ "vbus",           kWakeupSourceCharger },
+	{ "charger",        kWakeupSourceCharger },
+	{ "dock",           kWakeupSourceCharger },
+	{ "wlan",           kWakeupSourceNetwork },
+	{ "wlan_rx_wake",   kWakeupSourceNetwork },
+	{ "wifi",           kWakeupSourceNetwork },
+	{ "modem",          kWakeupSourceNetwork },
+	{ "rmnet",          kWakeupSourceNetwork },
+	{ "bluetooth",      kWakeupSourceNetwork },
+	{ "bt_host_wake",   kWakeupSourceNetwork },
+	{ "hci",            kWakeupSourceNetwork },
+};
+
+/*
+   The per timeout and per unclassified name tables hold at most this many names;
+   the wakeups of any other name are accounted under WAKEUP_OVERFLOW_NAME.
+   */
+#define WAKEUP_TABLE_MAX     64
+#define WAKEUP_OVERFLOW_NAME "(others)"
+
+static pthread_mutex_t wakeup_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static WakeupStat wakeup_stats[kWakeupSourceLast];
+
+/* RTC wakeups per timeout, and unrecognized kernel sources, keyed by name */
+static GHashTable *wakeup_timeouts = NULL;
+static GHashTable *wakeup_others = NULL;
+
+/* Wakeups avoided by coalescing tolerant timeouts into an RTC wake */
+static int wakeups_saved = 0;
+
+/* Wakeup being accounted until the next sleep */
+static unsigned int current_mask = 0;
+static char *current_timeout = NULL;
+static GSList *current_others = NULL;
+static struct timespec current_wake_time;
+
+static WakeupStat *
+_wakeup_stat_lookup(GHashTable **table, const char *name)
+{
+	if (!*table)
+	{
+		*table = g_hash_table_new(g_str_hash, g_str_equal);
+	}
+
+	WakeupStat *stat = g_hash_table_lookup(*table, name);
+
+	if (!stat && g_hash_table_size(*table) >= WAKEUP_TABLE_MAX)
+	{
+		name = WAKEUP_OVERFLOW_NAME;
+		stat = g_hash_table_lookup(*table, name);
+	}
+
+	if (!stat)
+	{
+		stat = g_new0(WakeupStat, 1);
+		stat->name = g_strdup(name);
+		g_hash_table_insert(*table, stat->name, stat);
+	}
+
+	return stat;
+}
+
+static WakeupSource
+_wakeup_classify_name(const char *name)
+{
+	gchar *base = g_ascii_strdown(name, -1);
+	WakeupSource source = kWakeupSourceOther;
+	size_t len = strlen(base);
+	int i;
+
+	while (len > 1 && g_ascii_isdigit(base[len - 1]))
+	{
+		base[--len] = '\0';
+	}
+
+	for (i = 0; i < G_N_ELEMENTS(wakeup_source_names_kernel); i++)
+	{
+		if (!strcmp(base, wakeup_source_names_kernel[i].name))
+		{
+			source = wakeup_source_names_kernel[i].source;
+			break;
+		}
+	}
+
+	g_free(base);
+	return source;
+}
+
+/**
+ * @brief Classify the wakeup the system just resumed from, and start accounting the time
+ * spent awake to its sources. Called from the suspend thread right after the kernel
+ * resumed.
+ *
+ * @retval Mask of WAKEUP_SOURCE_MASK() of every source that woke the system up.
+ */
+unsigned int
+PwrEventWakeupClassify(void)
+{
+	char sources[256];
+	int battery_reason = BATTERYCHECK_NONE;
+	unsigned int mask = 0;
+	GSList *others = NULL;
+	int i;
+
+	if (SysfsGetString(kPowerWakeupSourcesSysfs, sources, sizeof(sources)) == 0)
+	{
+		gchar **names = g_strsplit_set(sources, " ,\t\n", -1);
+
+		for (i = 0; names[i] != NULL; i++)
+		{
+			if (!names[i][0])
+			{
+				continue;
+			}
+
+			WakeupSource source = _wakeup_classify_name(names[i]);
+
+			mask |= WAKEUP_SOURCE_MASK(source);
+
+			if (source == kWakeupSourceOther)
+			{
+				others = g_slist_prepend(others, g_strdup(names[i]));
+			}
+		}
+
+		g_strfreev(names);
+	}
+	else
+	{
+		sources[0] = '\0';
+	}
+
+	if (SysfsGetInt(kPowerBatteryCheckReasonSysfs, &battery_reason) == 0 &&
+	        battery_reason > BATTERYCHECK_NONE && battery_reason < BATTERYCHECK_END)
+	{
+		mask |= WAKEUP_SOURCE_MASK(kWakeupSourceBatteryCheck);
+	}
+
+	// Without a list of wakeup sources, trust that our due alarm woke us up.
+	if (!mask && timeout_wakeup_due())
+	{
+		mask = WAKEUP_SOURCE_MASK(kWakeupSourceRtc);
+	}
+
+	if (!mask)
+	{
+		mask = WAKEUP_SOURCE_MASK(kWakeupSourceOther);
+	}
+
+	gchar *timeout = NULL;
+	int coalesced = 0;
+
+	if (mask & WAKEUP_SOURCE_MASK(kWakeupSourceRtc))
+	{
+		gchar *app_id = NULL;
+		gchar *key = NULL;
+
+		if (timeout_get_armed_wakeup(&app_id, &key))
+		{
+			timeout = g_strdup_printf("%s %s", app_id, key);
+			coalesced = timeout_wakeup_coalesced();
+		}
+
+		g_free(app_id);
+		g_free(key);
+	}
+
+	SLEEPDLOG_DEBUG("Woke up by \"%s\" (mask 0x%x, timeout %s)", sources, mask,
+	                timeout ? timeout : "none");
+
+	pthread_mutex_lock(&wakeup_mutex);
+
+	for (i = 0; i < kWakeupSourceLast; i++)
+	{
+		if (mask & WAKEUP_SOURCE_MASK(i))
+		{
+			wakeup_stats[i].count++;
+		}
+	}
+
+	if (timeout)
+	{
+		_wakeup_stat_lookup(&wakeup_timeouts, timeout)->count++;
+	}
+
+	wakeups_saved += coalesced;
+
+	GSList *iter;
+
+	for (iter = others; iter != NULL; iter = iter->next)
+	{
+		_wakeup_stat_lookup(&wakeup_others, (char *)iter->data)->count++;
+	}
+
+	g_free(current_timeout);
+	g_slist_free_full(current_others, g_free);
+
+	current_mask = mask;
+	current_timeout = timeout;
+	current_others = others;
+	TimeSourceGet(kTimeSourceMonotonic, &current_wake_time);
+
+	pthread_mutex_unlock(&wakeup_mutex);
+
+	return mask;
+}
+
+/**
+ * @brief Charge the time spent awake since the last wakeup to its sources.
+ * Called from the suspend thread right before the system goes to sleep.
+ */
+void
+PwrEventWakeupOnSleep(void)
+{
+	struct timespec now;
+	struct timespec diff;
+	int i;
+
+	TimeSourceGet(kTimeSourceMonotonic, &now);
+
+	pthread_mutex_lock(&wakeup_mutex);
+
+	if (!current_mask)
+	{
+		goto out;
+	}
+
+	ClockDiff(&diff, &now, &current_wake_time);
+	long awake_ms = ClockGetMs(&diff);
+
+	for (i = 0; i < kWakeupSourceLast; i++)
+	{
+		if (current_mask & WAKEUP_SOURCE_MASK(i))
+		{
+			wakeup_stats[i].awake_ms += awake_ms;
+		}
+	}
+
+	if (current_timeout)
+	{
+		_wakeup_stat_lookup(&wakeup_timeouts, current_timeout)->awake_ms += awake_ms;
+	}
+
+	GSList *iter;
+
+	for (iter = current_others; iter != NULL; iter = iter->next)
+	{
+		_wakeup_stat_lookup(&wakeup_others, (char *)iter->data)->awake_ms += awake_ms;
+	}
+
+	current_mask = 0;
+	g_free(current_timeout);
+	current_timeout = NULL;
+	g_slist_free_full(current_others, g_free);
+	current_others = NULL;
+
+out:
+	pthread_mutex_unlock(&wakeup_mutex);
+}
+
+static void
+_wakeup_table_json(GString *str, GHashTable *table)
+{
+	bool first = true;
+
+	if (!table)
+	{
+		return;
+	}
+
+	GHashTableIter iter;
+	gpointer value;
+
+	g_hash_table_iter_init(&iter, table);
+
+	while (g_hash_table_iter_next(&iter, NULL, &value))
+	{
+		WakeupStat *stat = (WakeupStat *)value;
+		gchar *escaped_name = g_strescape(stat->name, NULL);
+
+		g_string_append_printf(str,
+		                       "%s{\"name\":\"%s\",\"count\":%d,\"awake_ms\":%ld}",
+		                       first ? "" : ",", escaped_name, stat->count, stat->awake_ms);
+		first = false;
+
+		g_free(escaped_name);
+	}
+}
+
+/**
+ * @brief Build the luna reply with the wakeup counts and awake time per source.
+ *
+ * @retval Newly allocated json string
+ */
+char *
+PwrEventWakeupStatsToJson(void)
+{
+	GString *str = g_string_sized_new(512);
+	int i;
+
+	pthread_mutex_lock(&wakeup_mutex);
+
+	g_string_append(str, "{\"returnValue\":true,\"sources\":[");
+
+	for (i = 0; i < kWakeupSourceLast; i++)
+	{
+		g_string_append_printf(str,
+		                       "%s{\"source\":\"%s\",\"count\":%d,\"awake_ms\":%ld}",
+		                       i ? "," : "", wakeup_source_names[i],
+		                       wakeup_stats[i].count, wakeup_stats[i].awake_ms);
+	}
+
+	g_string_append(str, "],\"timeouts\":[");
+	_wakeup_table_json(str, wakeup_timeouts);
+
+	g_string_append(str, "],\"unclassified\":[");
+	_wakeup_table_json(str, wakeup_others);
+
+	g_string_append_printf(str, "],\"wakeups_saved\":%d}", wakeups_saved);
+
+	pthread_mutex_unlock(&wakeup_mutex);
+
+	return g_string_free(str, FALSE);
+}
+
+/* @} END OF SuspendLogic */
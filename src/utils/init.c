@@ -19,6 +19,7 @@
 #include <glib.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "init.h"
 #include "config.h"
@@ -26,145 +27,456 @@
 #include "debug.h"
 #include "logging.h"
 
-typedef struct _GNamedHookList
+/* Threads running the INIT_FUNC_ASYNC funcs */
+#define INIT_WORKERS 2
+
+typedef struct
 {
-	GHookList   hookList;
-	const char *name;
-} GNamedHookList;
+	InitFunc    func;
+	const char *func_name;
+	const char *after;
+	bool        async;
 
-/* hash from string -> GNamedHookList */
-static GHashTable *namedInitFuncs = NULL;
+	/* Filled in by TheOneInit() */
+	GPtrArray  *dependents;
+	int         pending;
+	bool        dispatched;
+	bool        on_worker;
+	int         ret;
+	gint64      start_us;
+	gint64      end_us;
+	gint64      cpu_us;
+} InitHook;
 
-static void
-HookInit(gpointer func)
-{
-	InitFunc f = func;
-	int ret = f();
+/* All the init funcs, in the order they were declared */
+static GPtrArray *sInitHooks = NULL;
+
+/*
+   Startup profile, from g_get_monotonic_time(): when the binary was loaded
+   (the first INIT_FUNC declared), init ran, and the first luna request was
+   served.
+   */
+static gint64 sLoadUs = 0;
+static gint64 sInitStartUs = 0;
+static gint64 sInitEndUs = 0;
+static gint64 sFirstReplyUs = 0;
 
-	if (ret < 0)
+/**
+ * Add an InitFunc, to run once the funcs named in 'after' completed
+ */
+void
+InitFuncAdd(InitFunc func, const char *func_name, const char *after,
+            bool async)
+{
+	if (!sInitHooks)
 	{
-		SLEEPDLOG_ERROR(MSGID_HOOKINIT_FAIL, 0, "Could not initialize %p", func);
+		sInitHooks = g_ptr_array_new();
+		sLoadUs = g_get_monotonic_time();
 	}
+
+	InitHook *hook = g_new0(InitHook, 1);
+
+	hook->func = func;
+	hook->func_name = func_name;
+	hook->after = after ? after : "";
+	hook->async = async;
+
+	g_ptr_array_add(sInitHooks, hook);
 }
 
-typedef struct
+static InitHook *
+InitHookLookup(const char *func_name)
 {
-	GHook            base;
-	const char      *func_name;
-	InitFuncPriority priority;
-} GPrioritizedHook;
+	int i;
+
+	for (i = 0; i < sInitHooks->len; i++)
+	{
+		InitHook *hook = g_ptr_array_index(sInitHooks, i);
+
+		if (!strcmp(hook->func_name, func_name))
+		{
+			return hook;
+		}
+	}
+
+	return NULL;
+}
 
 /**
- * @returns 1 if new_hook should be inserted after sibling,
- * and <= 0 if new_hook should be inserted before sibling.
+ * Resolve the 'after' names of every hook into dependency edges
  */
-static gint
-GPrioritizedHookCompare(GHook *new_hook, GHook *sibling)
+static void
+InitHooksLink(void)
 {
-	GPrioritizedHook *new_hook_pr = (GPrioritizedHook *)new_hook;
-	GPrioritizedHook *sibling_pr = (GPrioritizedHook *)sibling;
+	int i, j;
+
+	for (i = 0; i < sInitHooks->len; i++)
+	{
+		InitHook *hook = g_ptr_array_index(sInitHooks, i);
+		hook->dependents = g_ptr_array_new();
+	}
 
-	return (new_hook_pr->priority > sibling_pr->priority);
+	for (i = 0; i < sInitHooks->len; i++)
+	{
+		InitHook *hook = g_ptr_array_index(sInitHooks, i);
+		gchar **names = g_strsplit(hook->after, " ", -1);
+
+		for (j = 0; names[j] != NULL; j++)
+		{
+			if (!names[j][0])
+			{
+				continue;
+			}
+
+			InitHook *dependency = InitHookLookup(names[j]);
+
+			if (!dependency)
+			{
+				SLEEPDLOG_ERROR(MSGID_HOOKINIT_FAIL, 0, "%s: unknown init dependency %s",
+				                hook->func_name, names[j]);
+				continue;
+			}
+
+			g_ptr_array_add(dependency->dependents, hook);
+			hook->pending++;
+		}
+
+		g_strfreev(names);
+	}
 }
 
 /**
- * Add an InitFunc to the hooklist with the name 'name'
+ * Find a dependency of 'hook' which was not dispatched yet, if any
  */
-void
-NamedInitFuncAdd(const char *name, InitFuncPriority priority, InitFunc func,
-                 const char *func_name)
+static InitHook *
+InitHookBlocker(InitHook *hook)
 {
-	if (!namedInitFuncs)
+	InitHook *blocker = NULL;
+	gchar **names = g_strsplit(hook->after, " ", -1);
+	int i;
+
+	for (i = 0; names[i] != NULL && !blocker; i++)
 	{
-		namedInitFuncs = g_hash_table_new(g_str_hash, g_str_equal);
+		InitHook *dependency = names[i][0] ? InitHookLookup(names[i]) : NULL;
 
-		if (!namedInitFuncs)
+		if (dependency && !dependency->dispatched)
 		{
-			SLEEPDLOG_ERROR(MSGID_NAMED_INIT_FUNC_OOM, 0,
-			                "Out of memory on initialization");
-			abort();
+			blocker = dependency;
 		}
 	}
 
-	if (g_hash_table_lookup(namedInitFuncs, (gconstpointer)name) == NULL)
+	g_strfreev(names);
+	return blocker;
+}
+
+/**
+ * Pick a hook on a dependency cycle, once nothing else can run: every hook left
+ * is blocked by another one left, so following the blockers for as many steps as
+ * there are hooks ends up on a cycle.
+ */
+static InitHook *
+InitHookInCycle(void)
+{
+	InitHook *hook = NULL;
+	int i;
+
+	for (i = 0; i < sInitHooks->len && !hook; i++)
 	{
-		GNamedHookList *namedHookList = malloc(sizeof(GNamedHookList));
+		InitHook *candidate = g_ptr_array_index(sInitHooks, i);
 
-		if (!namedHookList)
+		if (!candidate->dispatched)
 		{
-			SLEEPDLOG_ERROR(MSGID_NAMED_HOOK_LIST_OOM, 0,
-			                "Out of memory on initialization");
-			abort();
+			hook = candidate;
 		}
+	}
 
-		g_hook_list_init((GHookList *)namedHookList, sizeof(GPrioritizedHook));
+	for (i = 0; hook && i < sInitHooks->len; i++)
+	{
+		InitHook *blocker = InitHookBlocker(hook);
 
-		namedHookList->name = name;
+		if (!blocker)
+		{
+			break;
+		}
 
-		g_hash_table_insert(namedInitFuncs, (char *)name, namedHookList);
+		hook = blocker;
 	}
 
-	GHookList *hookList = (GHookList *)g_hash_table_lookup(namedInitFuncs,
-	                      (gconstpointer)name);
+	return hook;
+}
 
-	GPrioritizedHook *hook = (GPrioritizedHook *)g_hook_alloc(hookList);
+static gint64
+InitThreadCpuUs(void)
+{
+	struct timespec ts;
 
-	hook->base.data = func;
-	hook->base.func = HookInit;
-	hook->priority  = priority;
-	hook->func_name = func_name;
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+	{
+		return 0;
+	}
 
-	g_hook_insert_sorted(hookList, (GHook *)hook, GPrioritizedHookCompare);
+	return (gint64)ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000;
 }
 
-void
-GProritizedHookPrint(GHook *hook, gpointer data)
+static void
+InitHookRun(InitHook *hook)
 {
-	GPrioritizedHook *gphook = (GPrioritizedHook *)hook;
-	SLEEPDLOG_DEBUG("%d. %s", gphook->priority, gphook->func_name);
+	gint64 cpu_start_us = InitThreadCpuUs();
+
+	hook->start_us = g_get_monotonic_time();
+	hook->ret = hook->func();
+	hook->end_us = g_get_monotonic_time();
+	hook->cpu_us = InitThreadCpuUs() - cpu_start_us;
 }
 
-void
-GHookListPrint(gpointer key, gpointer value, gpointer data)
+/**
+ * Hand a hook whose dependencies completed to a worker, or queue it to run here
+ */
+static void
+InitHookDispatch(InitHook *hook, GThreadPool *workers, GQueue *ready,
+                 int *running)
+{
+	hook->dispatched = true;
+
+	if (hook->async && workers)
+	{
+		hook->on_worker = true;
+		g_thread_pool_push(workers, hook, NULL);
+		(*running)++;
+	}
+	else
+	{
+		g_queue_push_tail(ready, hook);
+	}
+}
+
+static void
+InitWorker(gpointer data, gpointer user_data)
 {
-	const char *hookName = (const char *)key;
-	GHookList *hookList = (GHookList *)value;
+	InitHook *hook = (InitHook *)data;
+	GAsyncQueue *done = (GAsyncQueue *)user_data;
 
-	SLEEPDLOG_DEBUG("InitList: %s", hookName);
-	g_hook_list_marshal(hookList, TRUE, GProritizedHookPrint, NULL);
+	InitHookRun(hook);
+	g_async_queue_push(done, hook);
 }
 
 /**
- * Print out the hook lists (for debug).
+ * Print out the init funcs and their dependencies (for debug).
  */
 void
 PrintHookLists(void)
 {
-	g_hash_table_foreach(namedInitFuncs, GHookListPrint, NULL);
+	int i;
+
+	for (i = 0; i < sInitHooks->len; i++)
+	{
+		InitHook *hook = g_ptr_array_index(sInitHooks, i);
+		SLEEPDLOG_DEBUG("%s%s after: %s", hook->func_name,
+		                hook->async ? " (async)" : "", hook->after);
+	}
+}
+
+static gint
+InitHookCompareStart(gconstpointer a, gconstpointer b)
+{
+	const InitHook *hook_a = *(InitHook *const *)a;
+	const InitHook *hook_b = *(InitHook *const *)b;
+
+	return (hook_a->start_us > hook_b->start_us) - (hook_a->start_us <
+	        hook_b->start_us);
+}
+
+/**
+ * Log when each init func started and how long it ran, relative to the start
+ */
+static void
+InitTimelinePrint(gint64 start_us, gint64 end_us)
+{
+	GPtrArray *timeline = g_ptr_array_sized_new(sInitHooks->len);
+	int i;
+
+	for (i = 0; i < sInitHooks->len; i++)
+	{
+		g_ptr_array_add(timeline, g_ptr_array_index(sInitHooks, i));
+	}
+
+	g_ptr_array_sort(timeline, InitHookCompareStart);
+
+	for (i = 0; i < timeline->len; i++)
+	{
+		InitHook *hook = g_ptr_array_index(timeline, i);
+
+		SLEEPDLOG_DEBUG("init @%6.1f ms +%6.1f ms (cpu %6.1f ms) %s%s",
+		                (hook->start_us - start_us) / 1000.0,
+		                (hook->end_us - hook->start_us) / 1000.0, hook->cpu_us / 1000.0,
+		                hook->func_name, hook->on_worker ? " (worker)" : "");
+	}
+
+	g_ptr_array_free(timeline, TRUE);
+
+	SLEEPDLOG_INFO(MSGID_INIT_DONE, 2, PMLOGKFV("FUNCS", "%d", sInitHooks->len),
+	               PMLOGKFV("INIT_MS", "%lld", (long long)(end_us - start_us) / 1000),
+	               "Initialized");
 }
 
 /**
  * Runs all of the initialization hooks
  *
  * This function runs all of the initialization functions which are preloaded
- * into our {@link namedInitFuncs} array via the use of the {@link INIT_FUNC}
- * macro using some GCC-specific functionality which runs code to install the
- * hooks as the sleepd binary is loaded from disk.
+ * into {@link sInitHooks} via the use of the {@link INIT_FUNC} macro using
+ * some GCC-specific functionality which runs code to install the hooks as the
+ * sleepd binary is loaded from disk.
+ *
+ * Each func runs as soon as the funcs it depends on completed: INIT_FUNC_ASYNC
+ * ones on a small pool of worker threads, the others on this thread, meanwhile.
+ * Returns once they all completed.
  */
 void
 TheOneInit(void)
 {
+	if (!sInitHooks)
+	{
+		return;
+	}
+
 	if (gSleepConfig.debug)
 	{
 		PrintHookLists();
 	}
 
-	/** Run common init funcs **/
-	GHookList *commonInitFuncs = g_hash_table_lookup(namedInitFuncs,
-	                             COMMON_INIT_NAME);
+	gint64 start_us = g_get_monotonic_time();
+
+	sInitStartUs = start_us;
 
-	if (commonInitFuncs)
+	GAsyncQueue *done = g_async_queue_new();
+	GThreadPool *workers = g_thread_pool_new(InitWorker, done, INIT_WORKERS,
+	                       FALSE, NULL);
+	GQueue ready = G_QUEUE_INIT;
+	int running = 0;
+	int completed = 0;
+	int i;
+
+	InitHooksLink();
+
+	for (i = 0; i < sInitHooks->len; i++)
 	{
-		g_hook_list_invoke(commonInitFuncs, FALSE);
+		InitHook *hook = g_ptr_array_index(sInitHooks, i);
+
+		if (hook->pending == 0)
+		{
+			InitHookDispatch(hook, workers, &ready, &running);
+		}
 	}
+
+	while (completed < sInitHooks->len)
+	{
+		InitHook *hook = g_queue_pop_head(&ready);
+
+		if (hook)
+		{
+			InitHookRun(hook);
+		}
+		else if (running > 0)
+		{
+			hook = g_async_queue_pop(done);
+			running--;
+		}
+		else
+		{
+			/* Nothing can run: a dependency cycle. Break it at one of its hooks. */
+			hook = InitHookInCycle();
+
+			SLEEPDLOG_ERROR(MSGID_HOOKINIT_FAIL, 0, "init dependency cycle at %s",
+			                hook->func_name);
+
+			hook->dispatched = true;
+			InitHookRun(hook);
+		}
+
+		completed++;
+
+		if (hook->ret < 0)
+		{
+			SLEEPDLOG_ERROR(MSGID_HOOKINIT_FAIL, 0, "Could not initialize %s",
+			                hook->func_name);
+		}
+
+		for (i = 0; i < hook->dependents->len; i++)
+		{
+			InitHook *dependent = g_ptr_array_index(hook->dependents, i);
+
+			if (--dependent->pending == 0 && !dependent->dispatched)
+			{
+				InitHookDispatch(dependent, workers, &ready, &running);
+			}
+		}
+	}
+
+	if (workers)
+	{
+		g_thread_pool_free(workers, FALSE, TRUE);
+	}
+
+	g_async_queue_unref(done);
+
+	sInitEndUs = g_get_monotonic_time();
+
+	InitTimelinePrint(start_us, sInitEndUs);
+}
+
+/**
+ * Note that a luna request was served, to time the first one
+ */
+void
+InitNoteReply(void)
+{
+	if (sFirstReplyUs)
+	{
+		return;
+	}
+
+	sFirstReplyUs = g_get_monotonic_time();
+
+	SLEEPDLOG_DEBUG("first request served %.1f ms after load",
+	                (sFirstReplyUs - sLoadUs) / 1000.0);
+}
+
+static int
+InitMs(gint64 us)
+{
+	return us ? (int)((us - sLoadUs) / 1000) : -1;
+}
+
+/**
+ * Build the luna reply with the startup profile: when init started and completed,
+ * and the first request was served, then the wall and cpu time of each init func, all
+ * in ms from when the binary was loaded.
+ *
+ * @retval Newly allocated json string
+ */
+char *
+InitStartupToJson(void)
+{
+	GString *str = g_string_sized_new(1024);
+	int i;
+
+	g_string_append_printf(str, "{\"returnValue\":true,\"init_start_ms\":%d,"
+	                       "\"init_end_ms\":%d,\"first_reply_ms\":%d,\"funcs\":[",
+	                       InitMs(sInitStartUs), InitMs(sInitEndUs), InitMs(sFirstReplyUs));
+
+	for (i = 0; sInitHooks && i < sInitHooks->len; i++)
+	{
+		InitHook *hook = g_ptr_array_index(sInitHooks, i);
+
+		g_string_append_printf(str,
+		                       "%s{\"name\":\"%s\",\"start_ms\":%d,\"wall_us\":%lld,"
+		                       "\"cpu_us\":%lld,\"worker\":%s,\"ret\":%d}",
+		                       i ? "," : "", hook->func_name, InitMs(hook->start_us),
+		                       (long long)(hook->end_us - hook->start_us), (long long)hook->cpu_us,
+		                       hook->on_worker ? "true" : "false", hook->ret);
+	}
+
+	g_string_append(str, "]}");
+
+	return g_string_free(str, FALSE);
 }
@@ -16,6 +16,10 @@
 *
 * LICENSE@@@ */
 
+#include <glib.h>
+
+#include "init.h"
+#include "main.h"
 #include "lunaservice_utils.h"
 
 void
@@ -82,3 +86,237 @@ LSMessageReplySuccess(LSHandle *sh, LSMessage *message)
 	}
 }
 
+
+/*
+   The categories registered through the functions below first get a copy of
+   their method tables pointing at _noted_method(), which calls the real method
+   then tells init that a request was served, to time the first one. The
+   category data maps each method name to the real method. Once the first
+   request was served, the real methods are put back in place, so that later
+   requests go straight to them.
+   */
+typedef struct
+{
+	LSHandle   *sh;
+	const char *category;
+	LSMethod   *methods;
+} NotedCategory;
+
+static GArray *sNotedCategories = NULL;
+static GPtrArray *sNotedTables = NULL;
+static bool sNotedReplied = false;
+
+/**
+ * @brief Register the real methods over the noted ones, and drop the tables.
+ */
+static gboolean
+_noted_unwrap(gpointer data)
+{
+	bool unwrapped = true;
+	int i;
+
+	for (i = 0; i < sNotedCategories->len; i++)
+	{
+		NotedCategory *noted = &g_array_index(sNotedCategories, NotedCategory, i);
+		LSError lserror;
+		LSErrorInit(&lserror);
+
+		if (!LSRegisterCategoryAppend(noted->sh, noted->category, noted->methods, NULL,
+		                              &lserror) ||
+		        !LSCategorySetData(noted->sh, noted->category, NULL, &lserror))
+		{
+			LSErrorPrint(&lserror, stderr);
+			LSErrorFree(&lserror);
+			unwrapped = false;
+		}
+	}
+
+	// A category left noted still needs its table
+	if (unwrapped)
+	{
+		g_ptr_array_free(sNotedTables, TRUE);
+		sNotedTables = NULL;
+	}
+
+	g_array_free(sNotedCategories, TRUE);
+	sNotedCategories = NULL;
+
+	return FALSE;
+}
+
+static bool
+_noted_method(LSHandle *sh, LSMessage *message, void *user_data)
+{
+	GHashTable *methods = (GHashTable *)user_data;
+	LSMethodFunction func = NULL;
+	bool retVal;
+
+	if (methods)
+	{
+		func = (LSMethodFunction)g_hash_table_lookup(methods, LSMessageGetMethod(message));
+	}
+
+	if (!func)
+	{
+		LSMessageReplyErrorUnknown(sh, message);
+		return true;
+	}
+
+	retVal = func(sh, message, NULL);
+
+	if (!sNotedReplied)
+	{
+		sNotedReplied = true;
+		InitNoteReply();
+
+		GSource *source = g_idle_source_new();
+		g_source_set_callback(source, _noted_unwrap, NULL, NULL);
+		g_source_attach(source, GetMainLoopContext());
+		g_source_unref(source);
+	}
+
+	return retVal;
+}
+
+static LSMethod *
+_noted_methods(GHashTable *table, LSMethod *methods)
+{
+	LSMethod *noted;
+	int count = 0;
+	int i;
+
+	if (!methods)
+	{
+		return NULL;
+	}
+
+	while (methods[count].name)
+	{
+		count++;
+	}
+
+	// The copy stays registered with the category for the life of the service
+	noted = g_new0(LSMethod, count + 1);
+
+	for (i = 0; i < count; i++)
+	{
+		noted[i] = methods[i];
+		noted[i].function = _noted_method;
+		g_hash_table_insert(table, (gpointer)methods[i].name, (gpointer)methods[i].function);
+	}
+
+	return noted;
+}
+
+/**
+ * @brief Remember the real methods of a category, to put back once the first
+ * request was served.
+ */
+static void
+_noted_add(LSHandle *sh, const char *category, LSMethod *methods)
+{
+	NotedCategory noted = { sh, category, methods };
+
+	if (!methods)
+	{
+		return;
+	}
+
+	if (!sNotedCategories)
+	{
+		sNotedCategories = g_array_new(FALSE, FALSE, sizeof(NotedCategory));
+	}
+
+	g_array_append_val(sNotedCategories, noted);
+}
+
+static void
+_noted_add_table(GHashTable *table)
+{
+	if (!sNotedTables)
+	{
+		sNotedTables = g_ptr_array_new_with_free_func(
+		                   (GDestroyNotify)g_hash_table_destroy);
+	}
+
+	g_ptr_array_add(sNotedTables, table);
+}
+
+/**
+ * @brief Same as LSRegisterCategory(), with the first request noted for the
+ * startup profile. The methods are called with NULL user_data.
+ *
+ * If the method table can't be attached, the category stays registered but
+ * its methods all reply with an error.
+ */
+bool
+LSRegisterCategoryNoted(LSHandle *sh, const char *category,
+                        LSMethod *methods, LSSignal *signals, LSError *lserror)
+{
+	if (sNotedReplied)
+	{
+		return LSRegisterCategory(sh, category, methods, signals, NULL, lserror);
+	}
+
+	GHashTable *table = g_hash_table_new(g_str_hash, g_str_equal);
+	LSMethod *noted = _noted_methods(table, methods);
+
+	if (!LSRegisterCategory(sh, category, noted, signals, NULL, lserror))
+	{
+		g_free(noted);
+		g_hash_table_destroy(table);
+		return false;
+	}
+
+	if (!LSCategorySetData(sh, category, table, lserror))
+	{
+		g_hash_table_destroy(table);
+		return false;
+	}
+
+	_noted_add_table(table);
+	_noted_add(sh, category, methods);
+
+	return true;
+}
+
+/**
+ * @brief Same as LSPalmServiceRegisterCategory(), with the first request noted for
+ * the startup profile. The methods are called with NULL user_data, and a method
+ * both public and private must have the same function in both tables.
+ */
+bool
+LSPalmServiceRegisterCategoryNoted(LSPalmService *psh, const char *category,
+                                   LSMethod *public_methods, LSMethod *private_methods,
+                                   LSSignal *signals, LSError *lserror)
+{
+	if (sNotedReplied)
+	{
+		return LSPalmServiceRegisterCategory(psh, category, public_methods,
+		                                     private_methods, signals, NULL, lserror);
+	}
+
+	GHashTable *table = g_hash_table_new(g_str_hash, g_str_equal);
+	LSMethod *noted_public = _noted_methods(table, public_methods);
+	LSMethod *noted_private = _noted_methods(table, private_methods);
+
+	if (!LSPalmServiceRegisterCategory(psh, category, noted_public, noted_private,
+	                                   signals, table, lserror))
+	{
+		g_free(noted_public);
+		g_free(noted_private);
+		g_hash_table_destroy(table);
+		return false;
+	}
+
+	LSHandle *public_sh = LSPalmServiceGetPublicConnection(psh);
+	LSHandle *private_sh = LSPalmServiceGetPrivateConnection(psh);
+
+	// The private bus serves the public methods as well
+	_noted_add_table(table);
+	_noted_add(public_sh, category, public_methods);
+	_noted_add(private_sh, category, public_methods);
+	_noted_add(private_sh, category, private_methods);
+
+	return true;
+}
@@ -28,13 +28,14 @@
  * 1) Can be forced to expire.
  * 2) The expiration interval may be changed.
  * 3) Uses a montonic clock.
+ * 4) Reads the clock once per main loop iteration, see timesource.c.
  *
  */
 
 #include <glib.h>
 
 #include "timersource.h"
-#include "clock.h"
+#include "timesource.h"
 #include "logging.h"
 
 struct _GTimerSource
@@ -103,9 +104,21 @@ g_timer_get_current_time(GTimerSource *tsource, GTimeVal *now)
 {
 	g_return_if_fail(now != NULL);
 
-	// TODO: We should do a time_is_current and skip syscalls
 	struct timespec tv;
-	ClockGetTime(&tv);
+	TimeSourceGet(kTimeSourceMonotonic, &tv);
+
+	now->tv_sec = tv.tv_sec;
+	now->tv_usec = tv.tv_nsec / 1000;
+}
+
+/* Time of the current main loop iteration, shared by every source polling it */
+static void
+g_timer_get_loop_time(GTimerSource *tsource, GTimeVal *now)
+{
+	g_return_if_fail(now != NULL);
+
+	struct timespec tv;
+	TimeSourceGetLoop(kTimeSourceMonotonic, &tv);
 
 	now->tv_sec = tv.tv_sec;
 	now->tv_usec = tv.tv_nsec / 1000;
@@ -119,7 +132,7 @@ g_timer_source_prepare(GSource    *source,
 
 	GTimerSource *tsource = (GTimerSource *)source;
 
-	g_timer_get_current_time(tsource, &now);
+	g_timer_get_loop_time(tsource, &now);
 
 	// assume monotic clock
 
@@ -150,7 +163,7 @@ g_timer_source_check(GSource *source)
 	GTimeVal now;
 	GTimerSource *tsource = (GTimerSource *)source;
 
-	g_timer_get_current_time(tsource, &now);
+	g_timer_get_loop_time(tsource, &now);
 
 	return (tsource->expiration.tv_sec < now.tv_sec) ||
 	       ((tsource->expiration.tv_sec == now.tv_sec) &&
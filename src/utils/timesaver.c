@@ -26,9 +26,11 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <string.h>
+#include <stdbool.h>
 
 #include "config.h"
 #include "logging.h"
+#include "timesource.h"
 #include "main.h"
 #include <ctype.h>
 
@@ -40,13 +42,13 @@ static char *time_db = NULL;
 static char *time_db_tmp = NULL;
 
 /**
- * @brief Save the current time in the file "time_saver" so that it can be used in future.
+ * @brief Write the current time to the file "time_saver".
  *
- * @retval
+ * @param  sync  Sync the file before replacing the previous one; otherwise the caller
+ *               must sync the file system itself.
  */
-
-void
-timesaver_save()
+static void
+_timesaver_write(bool sync)
 {
 	if (!time_db)
 	{
@@ -77,7 +79,7 @@ timesaver_save()
 		{
 			struct timespec tp;
 
-			clock_gettime(CLOCK_REALTIME, &tp);
+			TimeSourceGet(kTimeSourceRealtime, &tp);
 
 			SLEEPDLOG_DEBUG("Saving to file %ld", tp.tv_sec);
 
@@ -104,7 +106,10 @@ timesaver_save()
 				buf += written;
 			}
 
-			fsync(file);
+			if (sync)
+			{
+				fsync(file);
+			}
 
 			close(file);
 
@@ -122,6 +127,25 @@ timesaver_save()
 	return;
 }
 
+/**
+ * @brief Save the current time in the file "time_saver" so that it can be used in future.
+ */
+void
+timesaver_save()
+{
+	_timesaver_write(true);
+}
+
+/**
+ * @brief Save the current time like timesaver_save(), but leave syncing to the
+ * caller, which batches it with its other writes.
+ */
+void
+timesaver_save_unsynced(void)
+{
+	_timesaver_write(false);
+}
+
 bool ConvertJsonTime(const char *time, int *hour, int *minute, int *second)
 {
 	gchar **time_str;
@@ -0,0 +1,306 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2011-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+
+/**
+ * @file timesource.c
+ *
+ * @brief The one place sleepd reads the time from.
+ *
+ * Every clock read goes through the backend installed here: the system clocks
+ * and the RTC in production, or a simulated time which only moves when
+ * TimeSourceAdvanceMs() is called, so that days of alarms and suspends can be
+ * replayed in a few milliseconds.
+ *
+ * The sources of a main loop poll the time in every iteration. Once a context
+ * has a time source attached with TimeSourceAttach(), TimeSourceGetLoop() reads
+ * each clock at most once per iteration of that context: the time before the
+ * poll while preparing, and the time after the poll while checking and
+ * dispatching.
+ */
+
+#include <glib.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "timesource.h"
+#include "main.h"
+#include "init.h"
+
+#define NSEC_PER_SEC  1000000000L
+#define NSEC_PER_MSEC 1000000L
+
+/* Monotonic and boot time when a simulation starts, away from 0 which means unset */
+#define TIME_SOURCE_SIMULATED_BASE_S 1000
+
+static const clockid_t sSystemClocks[kTimeSourceLast] =
+{
+	[kTimeSourceMonotonic] = CLOCK_MONOTONIC,
+	[kTimeSourceBoottime]  = CLOCK_BOOTTIME,
+	[kTimeSourceRealtime]  = CLOCK_REALTIME,
+};
+
+static int
+_system_get_time(TimeSourceClock clock, struct timespec *ts)
+{
+	return clock_gettime(sSystemClocks[clock], ts);
+}
+
+static nyx_error_t
+_system_get_rtc(time_t *rtc)
+{
+	return nyx_system_query_rtc_time(GetNyxSystemDevice(), rtc);
+}
+
+static const TimeSourceBackend sSystemBackend =
+{
+	.name     = "system",
+	.get_time = _system_get_time,
+	.get_rtc  = _system_get_rtc,
+};
+
+static pthread_mutex_t sSimulatedMutex = PTHREAD_MUTEX_INITIALIZER;
+static gint64 sSimulatedMs = 0;
+static time_t sSimulatedRealtime = 0;
+
+static int
+_simulated_get_time(TimeSourceClock clock, struct timespec *ts)
+{
+	pthread_mutex_lock(&sSimulatedMutex);
+	gint64 ms = sSimulatedMs;
+	time_t base = clock == kTimeSourceRealtime ? sSimulatedRealtime :
+	              TIME_SOURCE_SIMULATED_BASE_S;
+	pthread_mutex_unlock(&sSimulatedMutex);
+
+	ts->tv_sec = base + ms / 1000;
+	ts->tv_nsec = (ms % 1000) * NSEC_PER_MSEC;
+
+	return 0;
+}
+
+static nyx_error_t
+_simulated_get_rtc(time_t *rtc)
+{
+	struct timespec ts;
+
+	_simulated_get_time(kTimeSourceRealtime, &ts);
+	*rtc = ts.tv_sec;
+
+	return NYX_ERROR_NONE;
+}
+
+static const TimeSourceBackend sSimulatedBackend =
+{
+	.name     = "simulated",
+	.get_time = _simulated_get_time,
+	.get_rtc  = _simulated_get_rtc,
+};
+
+static const TimeSourceBackend *sBackend = &sSystemBackend;
+
+/*
+   Clocks read in the current iteration of the main loop run by this thread, if a
+   time source is attached to its context.
+   */
+static __thread bool sLoopAttached = false;
+static __thread unsigned int sLoopValid = 0;
+static __thread struct timespec sLoopTime[kTimeSourceLast];
+
+/**
+ * @brief Install the backend every clock is read from. Must be called before
+ * the threads of sleepd start.
+ */
+void
+TimeSourceSetBackend(const TimeSourceBackend *backend)
+{
+	sBackend = backend ? backend : &sSystemBackend;
+}
+
+/**
+ * @brief Name of the current backend.
+ */
+const char *
+TimeSourceName(void)
+{
+	return sBackend->name;
+}
+
+/**
+ * @brief Install the simulated backend, starting at 'realtime' (seconds since the
+ * epoch) on the system time and the RTC.
+ */
+void
+TimeSourceSimulate(time_t realtime)
+{
+	pthread_mutex_lock(&sSimulatedMutex);
+	sSimulatedMs = 0;
+	sSimulatedRealtime = realtime;
+	pthread_mutex_unlock(&sSimulatedMutex);
+
+	TimeSourceSetBackend(&sSimulatedBackend);
+}
+
+/**
+ * @brief Move every simulated clock forward.
+ */
+void
+TimeSourceAdvanceMs(gint64 ms)
+{
+	if (ms <= 0)
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&sSimulatedMutex);
+	sSimulatedMs += ms;
+	pthread_mutex_unlock(&sSimulatedMutex);
+}
+
+/**
+ * @brief Read a clock.
+ *
+ * @retval 0, or -1 if the clock could not be read
+ */
+int
+TimeSourceGet(TimeSourceClock clock, struct timespec *ts)
+{
+	return sBackend->get_time(clock, ts);
+}
+
+/**
+ * @brief Read a clock, in ms.
+ *
+ * @retval The time, or 0 if the clock could not be read
+ */
+gint64
+TimeSourceGetMs(TimeSourceClock clock)
+{
+	struct timespec ts;
+
+	if (TimeSourceGet(clock, &ts) == -1)
+	{
+		return 0;
+	}
+
+	return (gint64)ts.tv_sec * 1000 + ts.tv_nsec / NSEC_PER_MSEC;
+}
+
+/**
+ * @brief The system time, in seconds since the epoch, like time(NULL).
+ */
+time_t
+TimeSourceNow(void)
+{
+	struct timespec ts;
+
+	if (TimeSourceGet(kTimeSourceRealtime, &ts) == -1)
+	{
+		return (time_t) - 1;
+	}
+
+	return ts.tv_sec;
+}
+
+/**
+ * @brief Read the RTC, in seconds since the epoch.
+ */
+nyx_error_t
+TimeSourceGetRtc(time_t *rtc)
+{
+	return sBackend->get_rtc(rtc);
+}
+
+/**
+ * @brief Read a clock as of the current main loop iteration. Meant for the
+ * prepare and check functions of sources, which all poll the time in every
+ * iteration. Outside of a context with a time source attached, this reads the
+ * clock.
+ */
+void
+TimeSourceGetLoop(TimeSourceClock clock, struct timespec *ts)
+{
+	if (!sLoopAttached)
+	{
+		TimeSourceGet(clock, ts);
+		return;
+	}
+
+	if (!(sLoopValid & (1u << clock)))
+	{
+		TimeSourceGet(clock, &sLoopTime[clock]);
+		sLoopValid |= 1u << clock;
+	}
+
+	*ts = sLoopTime[clock];
+}
+
+static gboolean
+_loop_source_prepare(GSource *source, gint *timeout_ms)
+{
+	sLoopAttached = true;
+	sLoopValid = 0;
+
+	*timeout_ms = -1;
+	return FALSE;
+}
+
+static gboolean
+_loop_source_check(GSource *source)
+{
+	// Time moved on while we polled
+	sLoopValid = 0;
+	return FALSE;
+}
+
+static gboolean
+_loop_source_dispatch(GSource *source, GSourceFunc callback, gpointer user_data)
+{
+	return TRUE;
+}
+
+static GSourceFuncs sLoopSourceFuncs =
+{
+	.prepare  = _loop_source_prepare,
+	.check    = _loop_source_check,
+	.dispatch = _loop_source_dispatch,
+	.finalize = NULL,
+};
+
+/**
+ * @brief Attach a source which marks the iterations of 'context' for
+ * TimeSourceGetLoop(). Its prepare and check run before those of every other
+ * source of the context.
+ */
+void
+TimeSourceAttach(GMainContext *context)
+{
+	GSource *source = g_source_new(&sLoopSourceFuncs, sizeof(GSource));
+
+	g_source_set_priority(source, G_MININT);
+	g_source_attach(source, context);
+	g_source_unref(source);
+}
+
+static int
+_time_source_init(void)
+{
+	TimeSourceAttach(GetMainLoopContext());
+	return 0;
+}
+
+INIT_FUNC("", _time_source_init);